@@ -0,0 +1,359 @@
+/*!
+
+	@file admission.c
+
+	@brief Admission control of the connections accepted by as-server.
+
+	Accepted connections wait in a bounded queue for a worker. A
+	full queue turns connections away at once. Connections that did
+	wait are shed the way CoDel drops packets: once the time spent
+	in the queue has stayed above AS_QUEUE_TARGET milliseconds for a
+	whole AS_QUEUE_INTERVAL, one connection is shed, and then more
+	at shrinking intervals for as long as the delay stays high. The
+	queue delay, not its length, decides, so a burst that the
+	workers drain in time is let through untouched while a standing
+	queue is cut back before clients time out waiting in it.
+
+	Shed clients are told when to retry, from the time the workers
+	need to drain the queue, so that retries come back spread out
+	instead of adding to the overload.
+
+	Admins that change sessions are served in threads of their own
+	and counted apart, so that a handover to a new binary can hold
+	off new ones and wait for those already running.
+
+*/
+
+
+
+#ifndef ADMISSION_C
+#define ADMISSION_C
+
+
+
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "admission.h"
+
+#include "attendance_server.h"
+
+
+
+/// Queued connections, a ring guarded by the queue lock
+static struct admission_entry queue[AS_QUEUE_LEN];
+static int head, n_queued;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+
+/// Connections taken by workers and not yet done with
+static int n_serving;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+
+/// Admins changing sessions in their own threads, and whether new ones are held off
+static int n_admins;
+static int admins_held;
+
+/// Time the queue delay first stayed above target until, or 0 if below
+static long long first_above;
+
+/// Set while shedding, with the time of the next shed and number shed
+static int shedding;
+static long long next_shed;
+static int n_shed;
+
+/// Moving average of the time a worker takes to serve a connection
+static long long service_usec = 1000;
+
+
+
+static long long usecs(const struct timeval *tv) {
+
+	return tv->tv_sec * 1000000LL + tv->tv_usec;
+
+}
+
+static long long control_law(long long t, int count) {
+
+	// Shed more often the longer the delay stays high
+	return t + (long long)(AS_QUEUE_INTERVAL * 1000 / sqrt(count));
+
+}
+
+/* Called with the queue lock held, on the connection just taken */
+static int should_shed(long long now, long long delay) {
+
+	int above_target = 0;
+
+	if ( delay < AS_QUEUE_TARGET * 1000LL || n_queued == 0 ) {
+		first_above = 0;
+	} else if ( first_above == 0 ) {
+		first_above = now + AS_QUEUE_INTERVAL * 1000LL;
+	} else if ( now >= first_above ) {
+		above_target = 1;
+	}
+
+	if ( shedding ) {
+
+		if ( !above_target ) {
+			shedding = 0;
+			return 0;
+		}
+
+		if ( now < next_shed )
+			return 0;
+
+		n_shed++;
+		next_shed = control_law(next_shed, n_shed);
+
+		return 1;
+
+	}
+
+	if ( !above_target )
+		return 0;
+
+	// Start shedding, faster if the last episode ended recently
+	shedding = 1;
+	n_shed = n_shed > 2 && now - next_shed < 16 * AS_QUEUE_INTERVAL * 1000LL ? n_shed - 2 : 1;
+	next_shed = control_law(now, n_shed);
+
+	return 1;
+
+}
+
+
+
+/*!
+
+	@brief Queue an accepted connection for a worker.
+
+	@return 0 on success, or -1 if the queue is full.
+
+*/
+int admission_enqueue(int sock_fd, unsigned peer_addr) {
+
+	struct admission_entry *entry;
+
+	pthread_mutex_lock(&queue_lock);
+
+	if ( n_queued == AS_QUEUE_LEN ) {
+		pthread_mutex_unlock(&queue_lock);
+		return -1;
+	}
+
+	entry = &queue[(head + n_queued++) % AS_QUEUE_LEN];
+	entry->sock_fd = sock_fd;
+	entry->peer_addr = peer_addr;
+	gettimeofday(&entry->queued, NULL);
+
+	pthread_cond_signal(&queued);
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Take the connection queued longest, waiting for one.
+
+	@param shed Set if the connection should be shed.
+
+*/
+void admission_next(struct admission_entry *entry, int *shed) {
+
+	struct timeval now;
+
+	pthread_mutex_lock(&queue_lock);
+
+	while ( n_queued == 0 )
+		pthread_cond_wait(&queued, &queue_lock);
+
+	*entry = queue[head];
+	head = (head + 1) % AS_QUEUE_LEN;
+	n_queued--;
+	n_serving++;
+
+	gettimeofday(&now, NULL);
+	*shed = should_shed(usecs(&now), usecs(&now) - usecs(&entry->queued));
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Record the time a worker took to serve a connection.
+
+	@param started Time the worker took the connection.
+
+*/
+void admission_served(const struct timeval *started) {
+
+	struct timeval now;
+	long long elapsed;
+
+	gettimeofday(&now, NULL);
+	elapsed = usecs(&now) - usecs(started);
+
+	pthread_mutex_lock(&queue_lock);
+	service_usec += (elapsed - service_usec) / 8;
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Record that a worker is done with the connection it took.
+
+*/
+void admission_done(void) {
+
+	pthread_mutex_lock(&queue_lock);
+
+	if ( --n_serving == 0 && n_queued == 0 && n_admins == 0 )
+		pthread_cond_broadcast(&idle);
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Count an admin that is about to change sessions.
+
+	Taken once the admin authenticated, so that one that has not
+	cannot hold up a drain.
+
+	@return 0 if the admin may go ahead, -1 if admins are held off.
+
+*/
+int admission_admin_begin(void) {
+
+	int status = 0;
+
+	pthread_mutex_lock(&queue_lock);
+
+	if ( admins_held )
+		status = -1;
+	else
+		n_admins++;
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return status;
+
+}
+
+/*!
+
+	@brief Record that an admin counted by admission_admin_begin() is done.
+
+*/
+void admission_admin_end(void) {
+
+	pthread_mutex_lock(&queue_lock);
+
+	if ( --n_admins == 0 && n_queued == 0 && n_serving == 0 )
+		pthread_cond_broadcast(&idle);
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Wait until every queued connection and admin has been served.
+
+	Admins that would change sessions are held off from then on,
+	until admission_resume(). Only meaningful once no more
+	connections are being queued.
+
+	@param timeout Seconds to wait at most.
+	@return 0 once all were served, or -1 if some still are.
+
+*/
+int admission_drain(int timeout) {
+
+	struct timespec deadline;
+	int status = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout;
+
+	pthread_mutex_lock(&queue_lock);
+
+	admins_held = 1;
+
+	while ( n_queued > 0 || n_serving > 0 || n_admins > 0 )
+		if ( pthread_cond_timedwait(&idle, &queue_lock, &deadline) == ETIMEDOUT ) {
+			status = n_queued > 0 || n_serving > 0 || n_admins > 0 ? -1 : 0;
+			break;
+		}
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return status;
+
+}
+
+/*!
+
+	@brief Let admins change sessions again after a drain.
+
+*/
+void admission_resume(void) {
+
+	pthread_mutex_lock(&queue_lock);
+	admins_held = 0;
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Time a turned away client should wait before retrying.
+
+	@return Microseconds the workers need to drain the queue, within
+	AS_RETRY_MIN and AS_RETRY_MAX milliseconds.
+
+*/
+long long admission_retry_after(void) {
+
+	long long wait;
+
+	pthread_mutex_lock(&queue_lock);
+	wait = n_queued * service_usec / AS_WORKER_THREADS;
+	pthread_mutex_unlock(&queue_lock);
+
+	if ( wait < AS_RETRY_MIN * 1000LL )
+		wait = AS_RETRY_MIN * 1000LL;
+	if ( wait > AS_RETRY_MAX * 1000LL )
+		wait = AS_RETRY_MAX * 1000LL;
+
+	return wait;
+
+}
+
+
+
+#endif /* ADMISSION_C */
+
+
+
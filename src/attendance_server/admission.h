@@ -0,0 +1,53 @@
+/*!
+
+	@file admission.h
+	@brief Header file for admission control of accepted connections.
+
+*/
+
+
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+
+
+#include <sys/time.h>
+
+
+
+/*!
+
+	@brief A connection waiting for a worker.
+
+*/
+struct admission_entry {
+
+	int sock_fd;
+
+	/// Address of the peer, in network byte order
+	unsigned peer_addr;
+
+	/// Time the connection was queued
+	struct timeval queued;
+
+};
+
+
+
+int admission_enqueue(int sock_fd, unsigned peer_addr);
+void admission_next(struct admission_entry *entry, int *shed);
+void admission_served(const struct timeval *started);
+void admission_done(void);
+int admission_admin_begin(void);
+void admission_admin_end(void);
+int admission_drain(int timeout);
+void admission_resume(void);
+long long admission_retry_after(void);
+
+
+
+#endif /* ADMISSION_H */
+
+
+
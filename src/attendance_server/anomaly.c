@@ -0,0 +1,230 @@
+/*!
+
+	@file anomaly.c
+
+	@brief Detectors of suspicious marks, run on every mark of a session.
+
+	Proxy marking shows up as one device marking several roll
+	numbers, one device marking many times in a short while, marks
+	arriving far faster than usual, or marks claiming times that
+	cannot be right. Each session keeps the state to spot these as
+	marks come in, in constant time and memory per mark: devices are
+	kept in a fixed table that forgets the stalest one when full, and
+	the usual rate of marks is a moving average kept a second at a
+	time.
+
+	Marks from devices of no known MAC address, as made by OP_MARK,
+	are only checked for their rate and their time.
+
+*/
+
+
+
+#ifndef ANOMALY_C
+#define ANOMALY_C
+
+
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "anomaly.h"
+
+
+
+/// Slots probed for a device before the stalest of them is replaced
+#define ANOMALY_PROBES 8
+
+/// Marks a slot in use, above the 48 bits of the MAC address
+#define ANOMALY_USED (1ULL << 63)
+
+
+
+static unsigned long long mac_key(const unsigned char *mac_addr) {
+
+	unsigned long long key = ANOMALY_USED;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		key |= (unsigned long long)mac_addr[i] << (8 * (5 - i));
+
+	return key;
+
+}
+
+static struct anomaly_device *find_device(struct anomaly *anomaly, unsigned long long key) {
+
+	/* Fibonacci hashing, the vendor prefix alone would cluster badly */
+	unsigned i = (unsigned)((key * 11400714819323198485ull) >> 32);
+	struct anomaly_device *device, *oldest = NULL;
+	int n_probes;
+
+	for (n_probes = 0; n_probes < ANOMALY_PROBES; n_probes++, i++) {
+
+		device = &anomaly->devices[i & (AS_ANOMALY_DEVICES - 1)];
+
+		if ( device->key == key )
+			return device;
+
+		if ( !device->key ) {
+			oldest = device;
+			break;
+		}
+
+		if ( !oldest || device->window_start < oldest->window_start )
+			oldest = device;
+
+	}
+
+	// A device forgotten this way is only ever under-reported
+	memset(oldest, 0, sizeof(struct anomaly_device));
+	oldest->key = key;
+
+	return oldest;
+
+}
+
+/* Check a mark against the earlier marks of the same device */
+static int check_device(struct anomaly *anomaly, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, long long now) {
+
+	struct anomaly_device *device = find_device(anomaly, mac_key(mac_addr));
+	int anomalies = 0;
+
+	if ( device->window_start == 0 ) {
+		device->roll_number = roll_number;
+		device->last_roll = roll_number;
+		device->last_time = tv_sec;
+	}
+
+	// A roll number of 0 is one the device asked for none and was not registered to
+	if ( roll_number ) {
+		if ( !device->roll_number )
+			device->roll_number = roll_number;
+		else if ( roll_number != device->roll_number && roll_number != device->last_roll )
+			anomalies |= ANOMALY_DEVICE_ROLLS;
+		device->last_roll = roll_number;
+	}
+
+	if ( tv_sec < device->last_time )
+		anomalies |= ANOMALY_TIMING;
+	device->last_time = tv_sec;
+
+	if ( now - device->window_start >= AS_ANOMALY_WINDOW ) {
+		device->window_start = now;
+		device->n_window = 0;
+	}
+
+	// Flagged once per window, however many more marks follow
+	if ( ++device->n_window == AS_ANOMALY_BURST + 1 )
+		anomalies |= ANOMALY_DEVICE_BURST;
+
+	return anomalies;
+
+}
+
+/* Count a mark in the current second, against the usual rate */
+static int check_rate(struct anomaly *anomaly, long long now) {
+
+	double keep = 1.0 - 1.0 / AS_ANOMALY_RATE_SPAN;
+
+	if ( now > anomaly->bucket ) {
+
+		// The second that ended, then every idle second since
+		anomaly->usual_rate = anomaly->usual_rate * keep + anomaly->n_bucket * (1.0 - keep);
+		anomaly->usual_rate *= pow(keep, now - anomaly->bucket - 1);
+
+		anomaly->bucket = now;
+		anomaly->n_bucket = 0;
+		anomaly->spiked = 0;
+
+	}
+
+	anomaly->n_bucket++;
+
+	if ( anomaly->spiked || anomaly->n_bucket < AS_ANOMALY_RATE_MIN
+		|| anomaly->n_bucket < AS_ANOMALY_SPIKE * anomaly->usual_rate )
+		return 0;
+
+	anomaly->spiked = 1;
+
+	return ANOMALY_RATE_SPIKE;
+
+}
+
+/*!
+
+	@brief Create the anomaly detectors of a session.
+
+	@return The detectors, or NULL on failure.
+
+*/
+struct anomaly *anomaly_new(void) {
+
+	struct anomaly *anomaly;
+
+	if ( !(anomaly = (struct anomaly*)calloc(1, sizeof(struct anomaly))) ) {
+		printf("anomaly_new: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	pthread_mutex_init(&anomaly->lock, NULL);
+
+	return anomaly;
+
+}
+
+/*!
+
+	@brief Check a mark for anomalies.
+
+	@param mac_addr Device that made the mark, or NULL if unknown.
+	@param roll_number Roll number the mark was for, or 0 if unknown.
+	@param tv_sec Time of the mark, as the client claimed it.
+	@param now Time the server received the mark.
+	@return The anomalies found, as ANOMALY_* flags.
+
+*/
+int anomaly_check(struct anomaly *anomaly, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, const struct timeval *now) {
+
+	int anomalies = 0;
+
+	if ( llabs(tv_sec - now->tv_sec) > AS_ANOMALY_SKEW )
+		anomalies |= ANOMALY_TIMING;
+
+	pthread_mutex_lock(&anomaly->lock);
+
+	if ( mac_addr )
+		anomalies |= check_device(anomaly, mac_addr, roll_number, tv_sec, now->tv_sec);
+
+	anomalies |= check_rate(anomaly, now->tv_sec);
+
+	pthread_mutex_unlock(&anomaly->lock);
+
+	return anomalies;
+
+}
+
+/*!
+
+	@brief Free the anomaly detectors of a session.
+
+*/
+void anomaly_free(struct anomaly *anomaly) {
+
+	pthread_mutex_destroy(&anomaly->lock);
+	free(anomaly);
+
+	return;
+
+}
+
+
+
+#endif /* ANOMALY_C */
+
+
+
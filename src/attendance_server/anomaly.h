@@ -0,0 +1,84 @@
+/*!
+
+	@file anomaly.h
+	@brief Header file for the detectors of suspicious marks.
+
+*/
+
+
+
+#ifndef ANOMALY_H
+#define ANOMALY_H
+
+
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "attendance_server.h"
+
+
+
+/*!
+
+	@brief A device seen marking in a session.
+
+	Slots hold MAC addresses as 48-bit keys with a high bit set, so a
+	key of 0 marks a free slot.
+
+*/
+struct anomaly_device {
+
+	unsigned long long key;
+
+	/// Roll number the device marked first, and the one it marked last
+	int roll_number;
+	int last_roll;
+
+	/// Time of the last mark the device made, as it claimed
+	long long last_time;
+
+	/// Start of the window the device's marks are being counted in, and its count
+	long long window_start;
+	int n_window;
+
+};
+
+/*!
+
+	@brief Anomaly detectors of a session.
+
+	Every mark is checked in constant time, under a lock held for a
+	handful of probes and comparisons.
+
+*/
+struct anomaly {
+
+	/// Devices seen, once full the one whose window started longest ago is forgotten
+	struct anomaly_device devices[AS_ANOMALY_DEVICES];
+
+	/// Second being counted, its marks and whether it was flagged
+	long long bucket;
+	int n_bucket;
+	int spiked;
+
+	/// Average marks per second before the current one
+	double usual_rate;
+
+	pthread_mutex_t lock;
+
+};
+
+
+
+struct anomaly *anomaly_new(void);
+int anomaly_check(struct anomaly *anomaly, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, const struct timeval *now);
+void anomaly_free(struct anomaly *anomaly);
+
+
+
+#endif /* ANOMALY_H */
+
+
+
@@ -1,85 +1,305 @@
-
-
-
 #ifndef ATTENDANCE_SERVER_C
 #define ATTENDANCE_SERVER_C
 
 
 
 #include <time.h>
+#include <poll.h>
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <endian.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/random.h>
 #include <sys/types.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 
-#include "arecord_list.h"
+#include "roster.h"
+#include "feed.h"
+#include "anomaly.h"
+#include "session.h"
+#include "replica.h"
+#include "upgrade.h"
+#include "identity.h"
+#include "scheduler.h"
+#include "dbpool.h"
+#include "admission.h"
+#include "sockio.h"
+#include "markpack.h"
 #include "database_client.h"
 
 #include "attendance_server.h"
 
 
 
-/* List to hold attendance records */
-static struct arecord_list *arecords;
+/* Returned by handlers that leave the connection to another thread */
+#define CONN_DETACHED 1
+
+/* Admin request handed to its own thread */
+struct admin_request {
+
+	int sock_fd;
+	int op_code;
+	unsigned flags;
+	int session_id;
+
+	/* Schedule of OP_SCHEDULE */
+	long long open_time;
+	long long late_after;
+	long long close_time;
+
+	/* Sequence number of the last mark an OP_SYNC admin has */
+	long long cursor;
+
+	/* Number of marks of OP_MARK_BATCH */
+	int n_marks;
+
+};
+
+/* Records being streamed to an admin, batched or packed if the admin asked for it */
+struct close_stream {
+
+	int sock_fd;
+	unsigned flags;
+
+	/* Seconds the admin may take to read each frame */
+	int timeout;
+
+	int n_batched;
+	struct markpack_mark marks[AS_BATCH_RECORDS];
+
+	/* Frame payload */
+	union {
+		struct as_msg_data records[AS_BATCH_RECORDS];
+		unsigned char packed[MARKPACK_MAX_LEN(AS_BATCH_RECORDS)];
+	};
 
-/* Flag indicating if attendances are still being recorded */
-static int server_open = 1;
+};
+
+/* Admin threads running, authenticated or not, at most AS_MAX_ADMINS */
+static int n_admin_threads;
 
 /* Networking functions */
 static int server_socket_new(char *port);
 static void htonmsg(struct as_msg *msg);
 static void ntohmsg(struct as_msg *msg);
-static int recv_data(int sock_fd, char *recv_buf, int recv_len);
-static int send_data(int sock_fd, char *send_buf, int send_len);
-static int recv_msg(int sock_fd, struct as_msg *msg);
-static int send_msg(int sock_fd, struct as_msg *msg);
+static int recv_msg(int sock_fd, struct as_msg *msg, int timeout);
+static int send_msg(int sock_fd, struct as_msg *msg, int timeout);
+static int send_status(int sock_fd, int status, int timeout);
+static int send_busy(int sock_fd, int timeout);
+static void turn_away(int sock_fd);
+static void report_stall(void);
 
-/* Record list callbacks */
-static int match_record(struct arecord *record, void *cb_data);
-static int send_record(struct arecord *record, void *cb_data);
+/* Session callbacks */
+static int send_mark(int roll_number, long long tv_sec, long long tv_usec, void *cb_data);
 
 /* Attendance server helpers */
 static unsigned gen_random_u32(void);
 static unsigned compute_resp(unsigned challenge);
-static int register_mark(struct as_msg_data *data);
+static int authenticate(int sock_fd);
+static int stream_mark(struct close_stream *stream, int roll_number, long long tv_sec, long long tv_usec);
+static int flush_stream(struct close_stream *stream);
+static int send_anomaly(int sock_fd, struct feed_entry *entry);
+static const char *anomaly_name(int anomaly);
+static int valid_time(long long tv_sec, long long tv_usec);
 
 /* Attendance server functions */
-static int handle_mark(struct as_msg_data *data, int sock_fd);
-static int handle_close(int sock_fd);
+static int mark_session(int session_id, int roll_number, long long tv_sec, long long tv_usec);
+static void watch_mark(int session_id, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, long long tv_usec);
+static int handle_mark(struct as_msg *msg, int sock_fd);
+static int handle_mark_mac(struct as_msg *msg, int sock_fd);
+static int handle_invalidate(int sock_fd);
+static int handle_admin(struct as_msg *msg, int sock_fd);
+static int admin_mutates(int op_code);
+static void *serve_admin(void *arg);
+static int admin_close(int sock_fd, int session_id, unsigned flags);
+static int admin_open(int sock_fd, int session_id);
+static int admin_expire(int sock_fd, int session_id);
+static int admin_schedule(int sock_fd, struct admin_request *request);
+static int admin_sync(int sock_fd, int session_id, long long cursor, unsigned flags);
+static int admin_subscribe(int sock_fd, int session_id, unsigned flags);
+static int admin_export(int sock_fd, int session_id, unsigned flags);
+static int admin_mark_batch(int sock_fd, int session_id, int n_marks);
+static void run_event(int event, int session_id, time_t when);
+static void schedule_expiries(void);
 
 /* Attendance message handler */
 static int attendance_server_handle_msg(struct as_msg *msg, int sock_fd);
 
+/* Accepting connections, and worker threads serving them */
+static int accept_connections(int server_sockfd, int upgrade_fd);
+static void serve_connection(struct admission_entry *entry, int shed);
+static void *serve_connections(void *arg);
+
 
 
 int main(int argc, char **argv) {
 
-	struct as_msg msg;
-	int server_sockfd, conn_sockfd;
+	pthread_t workers[AS_WORKER_THREADS];
+	struct session *session;
+	int server_sockfd, upgrade_fd, upgrade_conn = -1, n_workers, opt, upgrade = 0;
+	char *standby = NULL, *follow_port = NULL, *port, *roster_file;
+	char standby_ip[INET_ADDRSTRLEN];
+	int standby_port = 0;
+
+	/* Replicate to a standby, stand by for a primary, or take over from a running server */
+	while ( (opt = getopt(argc, argv, "r:f:u")) != -1 ) {
+		if ( opt == 'r' )
+			standby = optarg;
+		else if ( opt == 'f' )
+			follow_port = optarg;
+		else if ( opt == 'u' )
+			upgrade = 1;
+		else
+			break;
+	}
 
-	if ( argc != 2 ) {
-		printf("Usage: %s <PORT>\n", argv[0]);
+	if ( opt != -1 || (upgrade && follow_port) || (standby && follow_port) || (argc - optind != 1 && argc - optind != 2)
+		|| (standby && sscanf(standby, "%15[0-9.]:%d", standby_ip, &standby_port) != 2) ) {
+		printf("Usage: %s [-r <STANDBY IP>:<STANDBY PORT> | -f <REPLICATION PORT>] [-u] <PORT> [ROSTER]\n", argv[0]);
 		return -1;
 	}
 
-	if ( !(arecords = arecord_list_new()) )
+	port = argv[optind];
+	roster_file = argc - optind == 2 ? argv[optind + 1] : NULL;
+
+	/* Roster mode: only students on the roster can be marked */
+	if ( roster_file ) {
+		if ( roster_load(roster_file) <= 0 ) {
+			printf("Failed to load a roster from %s\n", roster_file);
+			return -1;
+		}
+		printf("Roster mode: %d students enrolled.\n", roster_size());
+	}
+
+	sessions_init(roster_file != NULL, follow_port != NULL);
+
+	/* The sessions of a server we take over from come from that server */
+	if ( !upgrade ) {
+
+		if ( sessions_recover() < 0 )
+			return -1;
+
+		/* Serve the default session for clients that do not name one */
+		if ( !(session = session_get(AS_DEFAULT_SESSION)) && !(session = session_open(AS_DEFAULT_SESSION)) )
+			return -1;
+		session_put(session);
+
+	}
+
+	if ( sched_start(run_event) < 0 )
+		return -1;
+
+	if ( !upgrade )
+		schedule_expiries();
+
+	/* A standby only serves clients once its primary is gone */
+	if ( follow_port && replica_follow(follow_port) < 0 )
 		return -1;
 
-	if ( (server_sockfd = server_socket_new(argv[1])) < 0 )
+	if ( upgrade ) {
+		if ( (server_sockfd = upgrade_take(port, &upgrade_conn)) < 0 )
+			return -1;
+		printf("Took over the sessions and listening socket of the running server.\n");
+	} else if ( (server_sockfd = server_socket_new(port)) < 0 ) {
 		return -1;
+	}
+
+	if ( standby && replica_start(standby_ip, standby_port) < 0 )
+		return -1;
+
+	for (n_workers = 0; n_workers < AS_WORKER_THREADS; n_workers++)
+		if ( pthread_create(&workers[n_workers], NULL, serve_connections, NULL) != 0 ) {
+			perror("pthread_create() failed");
+			return -1;
+		}
+
+	/* The server we took over from exits once we are serving */
+	if ( upgrade_conn >= 0 )
+		upgrade_ready(upgrade_conn);
+
+	upgrade_fd = upgrade_listen(port);
+
+	while ( accept_connections(server_sockfd, upgrade_fd) == 0 ) {
+
+		/* A new binary is taking over, hand it everything once nothing changes sessions any more */
+		printf("Handing over to a new binary...\n");
+		sched_suspend();
+
+		if ( admission_drain(AS_DRAIN_TIMEOUT) < 0 ) {
+			printf("Connections still being served after %d seconds, serving on.\n", AS_DRAIN_TIMEOUT);
+			upgrade_refuse(upgrade_fd);
+		} else if ( upgrade_handoff(upgrade_fd, server_sockfd) == 0 ) {
+			printf("Handed over, exiting.\n");
+			return 0;
+		} else {
+			printf("Handover failed, serving on.\n");
+		}
+
+		admission_resume();
+		sched_resume();
+
+	}
+
+	/* Shouldn't get here unless we're handling interrupts */
+
+	if ( upgrade_fd >= 0 )
+		close(upgrade_fd);
+
+	close(server_sockfd);
+
+	sessions_free();
+	identity_free();
+	dbpool_free();
+	if ( roster_file )
+		roster_free();
+
+	return 0;
+
+}
+
+
+
+/*
+ * Accept connections until a new binary connects to take over, which
+ * returns 0, or until the listening socket fails, which returns -1.
+ * Connections arriving during the handover wait in the backlog.
+ */
+static int accept_connections(int server_sockfd, int upgrade_fd) {
+
+	struct pollfd fds[2];
+
+	fds[0].fd = server_sockfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = upgrade_fd;
+	fds[1].events = POLLIN;
 
 	while ( 1 ) {
 
 		struct sockaddr_in peer_addr;
 		socklen_t peer_addrlen;
+		int conn_sockfd;
+
+		if ( poll(fds, 2, -1) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("poll() failed");
+			return -1;
+		}
+
+		if ( fds[1].revents & POLLIN )
+			return 0;
+
+		if ( !(fds[0].revents & POLLIN) )
+			continue;
 
 		peer_addrlen = sizeof(peer_addr);
 		conn_sockfd = accept(server_sockfd, (struct sockaddr*)&peer_addr, &peer_addrlen);
@@ -87,107 +307,211 @@ int main(int argc, char **argv) {
 		if ( conn_sockfd < 0 ) {
 			perror("accept() failed");
 			if ( errno == EBADF || errno == EINVAL || errno == ENOTSOCK ) break;
-			close(conn_sockfd);
 			continue;
 		}
 
-		if ( recv_msg(conn_sockfd, &msg) < 0 ) {
-			close(conn_sockfd);
-			continue;
-		}
+		/* Connections are accepted at once and wait in our queue rather than the backlog */
+		if ( admission_enqueue(conn_sockfd, peer_addr.sin_addr.s_addr) < 0 )
+			turn_away(conn_sockfd);
 
-		/* Only local processes should be trusted for attendance requests */
-		if ( peer_addr.sin_addr.s_addr != inet_addr("127.0.0.1") && msg.request.op_code == OP_MARK ) {
-			close(conn_sockfd);
-			continue;
-		}
+	}
 
-		if ( attendance_server_handle_msg(&msg, conn_sockfd) < 0 ) {
-			close(conn_sockfd);
-			continue;
-		}
+	return -1;
+
+}
 
+static void serve_connection(struct admission_entry *entry, int shed) {
+
+	struct as_msg msg;
+	struct timeval started;
+	int status, conn_sockfd = entry->sock_fd;
+
+	gettimeofday(&started, NULL);
+
+	if ( (status = recv_msg(conn_sockfd, &msg, AS_IO_TIMEOUT)) < 0 ) {
+		if ( status == SOCKIO_TIMEOUT )
+			report_stall();
 		close(conn_sockfd);
+		return;
+	}
 
+	/* Only local processes should be trusted for attendance requests */
+	if ( entry->peer_addr != inet_addr("127.0.0.1") && (msg.request.op_code == OP_MARK
+		|| msg.request.op_code == OP_MARK_MAC || msg.request.op_code == OP_INVALIDATE) ) {
+		close(conn_sockfd);
+		return;
 	}
 
-	/* Shouldn't get here unless we're handling interrupts */
+	/* Marks are shed under overload, the client retries them later */
+	if ( shed && (msg.request.op_code == OP_MARK || msg.request.op_code == OP_MARK_MAC) ) {
+		turn_away(conn_sockfd);
+		return;
+	}
+
+	if ( attendance_server_handle_msg(&msg, conn_sockfd) == CONN_DETACHED )
+		return;
 
 	close(conn_sockfd);
-	close(server_sockfd);
 
-	arecord_list_free(arecords);
+	admission_served(&started);
 
-	return 0;
+	return;
 
 }
 
+static void *serve_connections(void *arg) {
+
+	(void)arg;
 
+	while ( 1 ) {
 
-static int match_record(struct arecord *record, void *cb_data) {
+		struct admission_entry entry;
+		int shed;
 
-	int roll_number = *(int*)cb_data;
+		admission_next(&entry, &shed);
+		serve_connection(&entry, shed);
+		admission_done();
 
-	if ( roll_number == record->roll_number )
-		return 1;
+	}
 
-	return 0;
+	return NULL;
 
 }
 
-static int register_mark(struct as_msg_data *data) {
+static int mark_session(int session_id, int roll_number, long long tv_sec, long long tv_usec) {
 
-	int roll_number;
-	int n_records_matched;
-	struct arecord *new_record;
+	struct session *session;
+	int status;
 
-	roll_number = data->roll_number;
+	if ( !(session = session_get(session_id)) )
+		return DENY;
 
-	n_records_matched =
-		arecord_list_foreach(arecords, match_record, &roll_number);
+	status = session_mark(session, roll_number, tv_sec, tv_usec);
 
-	if ( n_records_matched > 0 )
-		// Already recorded
-		return PRESENT;
+	session_put(session);
 
-	if ( !server_open )
-		return ABSENT;
+	return status;
 
-	if ( !(new_record = arecord_new()) )
-		return DENY;
+}
+
+/*
+ * Run the anomaly detectors of a session over a mark made by a student,
+ * accepted or not. Called once the student has the reply, so the
+ * detectors add nothing to the time a mark takes. Each anomaly found
+ * is logged and published to the admins following anomalies.
+ */
+static void watch_mark(int session_id, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, long long tv_usec) {
+
+	struct session *session;
+	struct timeval now;
+	int anomalies, anomaly;
 
-	new_record->tv_sec = data->tv_sec;
-	new_record->tv_usec = data->tv_usec;
-	new_record->roll_number = data->roll_number;
+	if ( !(session = session_get(session_id)) )
+		return;
 
-	arecord_list_insert(arecords, new_record);
+	gettimeofday(&now, NULL);
+	anomalies = anomaly_check(session->anomaly, mac_addr, roll_number, tv_sec, &now);
 
-	return PRESENT;
+	session_put(session);
+
+	for (anomaly = 1; anomalies; anomaly <<= 1) {
+
+		if ( !(anomalies & anomaly) )
+			continue;
+		anomalies &= ~anomaly;
+
+		if ( mac_addr )
+			printf("Flagged %s in session %d, roll number %d from %02x:%02x:%02x:%02x:%02x:%02x.\n",
+				anomaly_name(anomaly), session_id, roll_number, mac_addr[0], mac_addr[1],
+				mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+		else
+			printf("Flagged %s in session %d, roll number %d.\n", anomaly_name(anomaly), session_id, roll_number);
+
+		feed_flag(session_id, anomaly, mac_addr, roll_number, tv_sec, tv_usec);
+
+	}
+
+	return;
 
 }
 
-static int handle_mark(struct as_msg_data *data, int sock_fd) {
+static int handle_mark(struct as_msg *msg, int sock_fd) {
 
 	int status;
-	struct as_msg msg;
 
-	status = register_mark(data);
+	if ( !valid_time(msg->tv_sec, msg->tv_usec) )
+		return send_status(sock_fd, BAD_REQUEST, AS_IO_TIMEOUT);
 
-	memset(&msg, 0, sizeof(msg));
-	msg.reply.status = status;
+	status = send_status(sock_fd, mark_session(msg->session_id, msg->roll_number, msg->tv_sec, msg->tv_usec),
+		AS_IO_TIMEOUT);
+
+	watch_mark(msg->session_id, NULL, msg->roll_number, msg->tv_sec, msg->tv_usec);
+
+	return status;
+
+}
 
-	if ( send_msg(sock_fd, &msg) < 0 )
+static int handle_mark_mac(struct as_msg *msg, int sock_fd) {
+
+	struct as_msg_mac mac;
+	struct as_msg reply;
+	int roll_number, found, status;
+
+	if ( sockio_recv(sock_fd, &mac, sizeof(mac), AS_IO_TIMEOUT * 1000) < 0 )
 		return -1;
 
-	return 0;
+	if ( !valid_time(msg->tv_sec, msg->tv_usec) )
+		return send_status(sock_fd, BAD_REQUEST, AS_IO_TIMEOUT);
+
+	memset(&reply, 0, sizeof(reply));
+
+	// Resolved from the cached registry, without a round trip to the database server
+	if ( (found = identity_resolve(mac.mac_addr, &roll_number)) < 0 )
+		reply.reply.status = DENY;
+	else if ( !found )
+		reply.reply.status = UNREGISTERED;
+	else if ( msg->roll_number && msg->roll_number != roll_number )
+		// The device belongs to someone else
+		reply.reply.status = DENY;
+	else
+		reply.reply.status = mark_session(msg->session_id, roll_number, msg->tv_sec, msg->tv_usec);
+
+	if ( found > 0 )
+		reply.roll_number = roll_number;
+
+	status = send_msg(sock_fd, &reply, AS_IO_TIMEOUT);
+
+	// The roll number asked for is the one that gives a proxy away
+	watch_mark(msg->session_id, mac.mac_addr, msg->roll_number ? msg->roll_number : reply.roll_number,
+		msg->tv_sec, msg->tv_usec);
+
+	return status;
+
+}
+
+static int handle_invalidate(int sock_fd) {
+
+	identity_invalidate();
+
+	return send_status(sock_fd, DONE, AS_IO_TIMEOUT);
 
 }
 
 static unsigned gen_random_u32(void) {
 
-	srand(time(NULL));
+	static __thread unsigned seed;
+	unsigned value;
+
+	// From the kernel, a challenge must not be guessable from the time it was sent
+	if ( getrandom(&value, sizeof(value), 0) == sizeof(value) )
+		return value;
+
+	// Without getrandom, each thread keeps a generator of its own, seeded once
+	if ( !seed )
+		seed = (unsigned)time(NULL) ^ (unsigned)pthread_self();
 
-	return (unsigned)rand();
+	return (unsigned)rand_r(&seed);
 
 }
 
@@ -215,30 +539,264 @@ static unsigned compute_resp(unsigned challenge) {
 
 }
 
-static int send_record(struct arecord *record, void *cb_data) {
+static int stream_mark(struct close_stream *stream, int roll_number, long long tv_sec, long long tv_usec) {
 
 	struct as_msg msg;
-	int sock_fd = *(int*)cb_data;
+	struct markpack_mark *mark;
+
+	if ( stream->flags & (CLOSE_BATCH | CLOSE_COMPACT) ) {
+
+		mark = &stream->marks[stream->n_batched++];
+		mark->roll_number = roll_number;
+		mark->tv_sec = tv_sec;
+		mark->tv_usec = tv_usec;
+
+		if ( stream->n_batched == AS_BATCH_RECORDS )
+			return flush_stream(stream);
+
+		return 0;
+
+	}
 
 	memset(&msg, 0, sizeof(msg));
 	msg.reply.status = DATA;
-	msg.tv_sec = record->tv_sec;
-	msg.tv_usec = record->tv_usec;
-	msg.roll_number = record->roll_number;
+	msg.tv_sec = tv_sec;
+	msg.tv_usec = tv_usec;
+	msg.roll_number = roll_number;
+
+	return send_msg(stream->sock_fd, &msg, stream->timeout);
+
+}
+
+static int flush_stream(struct close_stream *stream) {
+
+	struct as_msg msg;
+	struct iovec iov[2];
+	int i;
+
+	if ( stream->n_batched == 0 )
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.roll_number = stream->n_batched;
+
+	if ( stream->flags & CLOSE_COMPACT ) {
+
+		int len = markpack_encode(stream->marks, stream->n_batched, stream->packed);
+
+		msg.reply.status = DATA_COMPACT;
+		msg.tv_sec = len;
+		msg.tv_usec = markpack_crc32(stream->packed, len);
+
+		iov[1].iov_base = stream->packed;
+		iov[1].iov_len = len;
+
+	} else {
 
-	if ( send_msg(sock_fd, &msg) < 0 )
+		for (i = 0; i < stream->n_batched; i++) {
+			stream->records[i].tv_sec = htobe64(stream->marks[i].tv_sec);
+			stream->records[i].tv_usec = htobe64(stream->marks[i].tv_usec);
+			stream->records[i].roll_number = htonl(stream->marks[i].roll_number);
+		}
+
+		msg.reply.status = DATA_BATCH;
+
+		iov[1].iov_base = stream->records;
+		iov[1].iov_len = stream->n_batched * sizeof(struct as_msg_data);
+
+	}
+
+	htonmsg(&msg);
+
+	// The frame header and its records go out in a single call
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = sizeof(msg);
+
+	stream->n_batched = 0;
+
+	return sockio_sendv(stream->sock_fd, iov, 2, stream->timeout * 1000);
+
+}
+
+static int send_mark(int roll_number, long long tv_sec, long long tv_usec, void *cb_data) {
+
+	struct close_stream *stream = (struct close_stream*)cb_data;
+
+	if ( stream_mark(stream, roll_number, tv_sec, tv_usec) < 0 )
 		return 0;
 
 	return 1;
 
 }
 
-static int handle_close(int sock_fd) {
+static int send_anomaly(int sock_fd, struct feed_entry *entry) {
+
+	struct as_msg msg;
+	struct iovec iov[2];
+
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = ANOMALY;
+	msg.reply.chal = entry->anomaly;
+	msg.tv_sec = entry->mark.tv_sec;
+	msg.tv_usec = entry->mark.tv_usec;
+	msg.roll_number = entry->mark.roll_number;
+	msg.session_id = entry->session_id;
+	htonmsg(&msg);
+
+	// The anomaly and the device that raised it go out in a single call
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = sizeof(msg);
+	iov[1].iov_base = entry->mac_addr;
+	iov[1].iov_len = sizeof(struct as_msg_mac);
+
+	return sockio_sendv(sock_fd, iov, 2, AS_FEED_HEARTBEAT * 1000);
+
+}
+
+static const char *anomaly_name(int anomaly) {
+
+	switch ( anomaly ) {
+		case ANOMALY_DEVICE_ROLLS:
+			return "a device marking several roll numbers";
+		case ANOMALY_DEVICE_BURST:
+			return "a burst of marks from a device";
+		case ANOMALY_RATE_SPIKE:
+			return "a spike in the rate of marks";
+		case ANOMALY_TIMING:
+			return "a mark at an impossible time";
+	}
+
+	return "an unknown anomaly";
+
+}
+
+/*
+ * Whether a time sent by a client can be taken in, a negative second or
+ * a microsecond outside [0, 1000000) would be read back from the journal
+ * as one of its own records.
+ */
+static int valid_time(long long tv_sec, long long tv_usec) {
+
+	return tv_sec >= 0 && tv_usec >= 0 && tv_usec < 1000000;
+
+}
+
+static int handle_admin(struct as_msg *msg, int sock_fd) {
+
+	pthread_t thread;
+	struct admin_request *request;
+
+	// The admin is served in its own thread, a slow one only holds that up
+
+	// Counted before authenticating, so that connections that never answer cannot pile up threads
+	if ( __sync_add_and_fetch(&n_admin_threads, 1) > AS_MAX_ADMINS ) {
+		__sync_fetch_and_sub(&n_admin_threads, 1);
+		send_busy(sock_fd, AS_IO_TIMEOUT);
+		return -1;
+	}
+
+	if ( !(request = (struct admin_request*)malloc(sizeof(struct admin_request))) ) {
+		__sync_fetch_and_sub(&n_admin_threads, 1);
+		return -1;
+	}
+	request->sock_fd = sock_fd;
+	request->op_code = msg->request.op_code;
+	request->flags = msg->request.resp;
+	request->session_id = msg->session_id;
+	request->open_time = msg->tv_sec;
+	request->late_after = msg->roll_number;
+	request->close_time = msg->tv_usec;
+	request->cursor = msg->tv_sec;
+	request->n_marks = msg->roll_number;
+
+	if ( pthread_create(&thread, NULL, serve_admin, request) != 0 ) {
+		__sync_fetch_and_sub(&n_admin_threads, 1);
+		free(request);
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return CONN_DETACHED;
+
+}
+
+/* Whether an admin request changes sessions, rather than only reading them */
+static int admin_mutates(int op_code) {
+
+	return op_code == OP_CLOSE || op_code == OP_OPEN || op_code == OP_EXPIRE
+		|| op_code == OP_SCHEDULE || op_code == OP_MARK_BATCH;
+
+}
+
+static void *serve_admin(void *arg) {
+
+	struct admin_request *request = (struct admin_request*)arg;
+	int sock_fd = request->sock_fd, mutates = admin_mutates(request->op_code), status;
+
+	status = authenticate(sock_fd);
+
+	/* Sessions are left alone while being handed over to a new binary */
+	if ( status > 0 && mutates && admission_admin_begin() < 0 ) {
+		send_busy(sock_fd, AS_ADMIN_TIMEOUT);
+		status = 0;
+	}
+
+	if ( status > 0 ) {
+
+		switch ( request->op_code ) {
+
+			case OP_CLOSE:
+				admin_close(sock_fd, request->session_id, request->flags);
+				break;
+
+			case OP_OPEN:
+				admin_open(sock_fd, request->session_id);
+				break;
+
+			case OP_EXPIRE:
+				admin_expire(sock_fd, request->session_id);
+				break;
+
+			case OP_SCHEDULE:
+				admin_schedule(sock_fd, request);
+				break;
+
+			case OP_SYNC:
+				admin_sync(sock_fd, request->session_id, request->cursor, request->flags);
+				break;
+
+			case OP_SUBSCRIBE:
+				admin_subscribe(sock_fd, request->session_id, request->flags);
+				break;
+
+			case OP_EXPORT:
+				admin_export(sock_fd, request->session_id, request->flags);
+				break;
+
+			case OP_MARK_BATCH:
+				admin_mark_batch(sock_fd, request->session_id, request->n_marks);
+				break;
+
+		}
+
+		if ( mutates )
+			admission_admin_end();
+
+	}
+
+	close(sock_fd);
+	free(request);
+
+	__sync_fetch_and_sub(&n_admin_threads, 1);
+
+	return NULL;
+
+}
+
+static int authenticate(int sock_fd) {
 
 	struct as_msg msg;
-	struct timeval tv;
 	unsigned chal, resp;
-	int n_records_sent, db_resp;
 
 	chal = gen_random_u32();
 	resp = compute_resp(chal);
@@ -247,10 +805,10 @@ static int handle_close(int sock_fd) {
 	msg.reply.status = CHALLENGE;
 	msg.reply.chal = chal;
 
-	if ( send_msg(sock_fd, &msg) < 0 )
+	if ( send_msg(sock_fd, &msg, AS_ADMIN_TIMEOUT) < 0 )
 		return -1;
 
-	if ( recv_msg(sock_fd, &msg) < 0 )
+	if ( recv_msg(sock_fd, &msg, AS_ADMIN_TIMEOUT) < 0 )
 		return -1;
 
 	if ( msg.request.op_code != OP_AUTH )
@@ -258,66 +816,484 @@ static int handle_close(int sock_fd) {
 
 	if ( msg.request.resp != resp ) {
 
-		memset(&msg, 0, sizeof(msg));
-		msg.reply.status = DENY;
-
-		if ( send_msg(sock_fd, &msg) < 0 )
+		if ( send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT) < 0 )
 			return -1;
 
 		return 0;
 
 	}
 
-	/* Authentication succeeded at this point */
+	return 1;
+
+}
+
+static int admin_open(int sock_fd, int session_id) {
+
+	struct session *session;
+
+	if ( !(session = session_open(session_id)) )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	session_put(session);
+
+	printf("Opened session %d.\n", session_id);
+
+	return send_status(sock_fd, DONE, AS_ADMIN_TIMEOUT);
+
+}
+
+static int admin_expire(int sock_fd, int session_id) {
+
+	if ( session_expire(session_id) < 0 )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	printf("Expired session %d.\n", session_id);
+
+	return send_status(sock_fd, DONE, AS_ADMIN_TIMEOUT);
+
+}
+
+static int admin_schedule(int sock_fd, struct admin_request *request) {
+
+	int id = request->session_id;
+	time_t now = time(NULL);
+
+	if ( request->close_time <= request->open_time || request->late_after < 0 )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	// A new schedule replaces what is left of the last one
+	sched_cancel(id, EVENTS_SCHEDULED);
+
+	if ( request->open_time <= now ) {
+
+		struct session *session;
+
+		// Open right away, unless the session is already open
+		if ( !(session = session_get(id)) || !session->open ) {
+			if ( session )
+				session_put(session);
+			if ( !(session = session_open(id)) )
+				return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+		}
+		session_put(session);
+
+	} else if ( sched_add(request->open_time, EVENT_OPEN, id) < 0 ) {
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+	}
+
+	if ( request->late_after > 0 && request->open_time + request->late_after < request->close_time )
+		sched_add(request->open_time + request->late_after, EVENT_LATE, id);
+
+	if ( sched_add(request->close_time, EVENT_CLOSE, id) < 0 )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	replica_log(REPL_SCHEDULE, id, 0, request->late_after, request->open_time, request->close_time);
+
+	printf("Scheduled session %d from %lld to %lld.\n", id, request->open_time, request->close_time);
+
+	return send_status(sock_fd, DONE, AS_ADMIN_TIMEOUT);
+
+}
+
+static void run_event(int event, int session_id, time_t when) {
+
+	struct session *session;
+
+	if ( event == EVENT_EXPIRE ) {
+		sessions_sweep();
+		return;
+	}
+
+	/*
+	 * The primary sends the events it runs while we stand by. Those due
+	 * after it was last heard from may never have run, and are held
+	 * until it is heard from again or we take over.
+	 */
+	if ( replica_following() ) {
+		if ( when > replica_last_heard() )
+			sched_add(when, event, session_id);
+		return;
+	}
+
+	if ( event == EVENT_OPEN ) {
+		if ( (session = session_open(session_id)) ) {
+			printf("Opened session %d.\n", session_id);
+			session_put(session);
+		}
+		return;
+	}
 
-	gettimeofday(&tv, NULL);
+	if ( !(session = session_get(session_id)) )
+		return;
+
+	if ( event == EVENT_LATE && session->open ) {
+		session_late(session);
+		printf("Session %d is now marking students late.\n", session_id);
+	}
+
+	if ( event == EVENT_CLOSE && session->open ) {
+		session_close(session);
+		sched_add(session->close_time.tv_sec + AS_SESSION_TTL, EVENT_EXPIRE, session_id);
+		printf("Closed session %d.\n", session_id);
+	}
+
+	session_put(session);
+
+	return;
+
+}
+
+/* Expire the sessions recovered closed when they would have expired had we kept running */
+static void schedule_expiries(void) {
+
+	struct session *session;
+	int i, n_ids, ids[AS_MAX_SESSIONS];
+
+	n_ids = sessions_list(ids, AS_MAX_SESSIONS);
+
+	for (i = 0; i < n_ids; i++) {
+		if ( !(session = session_get(ids[i])) )
+			continue;
+		if ( !session->open )
+			sched_add(session->close_time.tv_sec + AS_SESSION_TTL, EVENT_EXPIRE, ids[i]);
+		session_put(session);
+	}
+
+	return;
+
+}
+
+static int admin_close(int sock_fd, int session_id, unsigned flags) {
+
+	struct as_msg msg;
+	struct db_conn *db_conn;
+	struct session *session;
+	struct close_stream *stream;
+	int n_records_sent, n_expected, db_resp = DB_CONN_FAILED;
+
+	if ( !(session = session_get(session_id)) )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	// Marks are no longer recorded, so the records can be streamed without locks
+
+	/*
+	 * Closing by hand ends the schedule that opened the session, so
+	 * none of it fires against a later opening. A schedule yet to open
+	 * the session is left alone.
+	 */
+	if ( session->open ) {
+		if ( !sched_pending(session_id, 1 << EVENT_OPEN) )
+			sched_cancel(session_id, EVENTS_SCHEDULED);
+		session_close(session);
+		sched_add(session->close_time.tv_sec + AS_SESSION_TTL, EVENT_EXPIRE, session_id);
+	}
 
 	memset(&msg, 0, sizeof(msg));
 	msg.reply.status = TIME;
-	msg.tv_sec = tv.tv_sec;
-	msg.tv_usec = tv.tv_usec;
+	msg.tv_sec = session->close_time.tv_sec;
+	msg.tv_usec = session->close_time.tv_usec;
 
-	if ( send_msg(sock_fd, &msg) < 0 )
+	if ( send_msg(sock_fd, &msg, AS_ADMIN_TIMEOUT) < 0 || !(stream = (struct close_stream*)malloc(sizeof(struct close_stream))) ) {
+		session_put(session);
 		return -1;
+	}
+
+	stream->sock_fd = sock_fd;
+	stream->flags = flags;
+	stream->timeout = AS_ADMIN_TIMEOUT;
+	stream->n_batched = 0;
+
+	n_expected = session_count(session);
 
-	n_records_sent =
-		arecord_list_foreach(arecords, send_record, &sock_fd);
+	if ( roster_size() > 0 )
+		printf("Closing session %d: %d present, %d absent.\n", session_id, n_expected, roster_size() - n_expected);
 
-	if ( n_records_sent < arecords->n_arecords )
+	n_records_sent = session_foreach(session, send_mark, stream);
+
+	if ( n_records_sent < n_expected || flush_stream(stream) < 0 ) {
+		free(stream);
+		session_put(session);
 		return -1;
+	}
 
-	memset(&msg, 0, sizeof(msg));
-	msg.reply.status = END_DATA;
+	free(stream);
 
-	if ( send_msg(sock_fd, &msg) < 0 )
+	if ( send_status(sock_fd, END_DATA, AS_ADMIN_TIMEOUT) < 0 ) {
+		session_put(session);
 		return -1;
+	}
 
-	// Commit the database transactions and mark the server closed
+	// Commit the database transactions and end the session
 
-	server_open = 0;
+	session_commit(session);
+	session_put(session);
 
-	if ( (db_resp = db_commit_all(DB_SERVER_IP, DB_SERVER_PORT)) != DB_OP_SUCCESS )
+	if ( (db_conn = dbpool_get()) ) {
+		db_resp = db_conn_commit_all(db_conn);
+		dbpool_put(db_conn);
+	}
+	if ( db_resp != DB_OP_SUCCESS )
 		printf("Warning, database commit failed with exit code %d.\n", db_resp);
 
 	return 0;
 
 }
 
+static int admin_sync(int sock_fd, int session_id, long long cursor, unsigned flags) {
+
+	struct as_msg msg;
+	struct timeval now;
+	struct session *session;
+	struct close_stream *stream;
+	struct markpack_mark marks[AS_BATCH_RECORDS];
+	long long last_seq;
+	int i, n_marks = 0;
+
+	if ( !(session = session_get(session_id)) )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	// Only the marks accepted by now are sent, so a busy session cannot keep the stream going
+	last_seq = session_last_seq(session);
+
+	if ( cursor < 0 || cursor > last_seq ) {
+		session_put(session);
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+	}
+
+	gettimeofday(&now, NULL);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = TIME;
+	msg.tv_sec = now.tv_sec;
+	msg.tv_usec = now.tv_usec;
+	msg.roll_number = last_seq - cursor;
+
+	if ( send_msg(sock_fd, &msg, AS_ADMIN_TIMEOUT) < 0 || !(stream = (struct close_stream*)malloc(sizeof(struct close_stream))) ) {
+		session_put(session);
+		return -1;
+	}
+
+	stream->sock_fd = sock_fd;
+	stream->flags = flags;
+	stream->timeout = AS_ADMIN_TIMEOUT;
+	stream->n_batched = 0;
+
+	while ( cursor < last_seq && n_marks >= 0 ) {
+
+		int max_marks = last_seq - cursor < AS_BATCH_RECORDS ? (int)(last_seq - cursor) : AS_BATCH_RECORDS;
+
+		// Copy a batch out of the log, sending it without holding the log lock
+		if ( (n_marks = session_read(session, cursor, marks, max_marks)) < 0 )
+			break;
+
+		for (i = 0; i < n_marks; i++)
+			if ( stream_mark(stream, marks[i].roll_number, marks[i].tv_sec, marks[i].tv_usec) < 0 ) {
+				n_marks = -1;
+				break;
+			}
+
+		cursor += i;
+
+	}
+
+	session_put(session);
+
+	if ( n_marks < 0 || flush_stream(stream) < 0 ) {
+		free(stream);
+		return -1;
+	}
+
+	free(stream);
+
+	// The admin resumes from the last mark sent
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = END_DATA;
+	msg.tv_sec = cursor;
+
+	return send_msg(sock_fd, &msg, AS_ADMIN_TIMEOUT);
+
+}
+
+/*
+ * Stream a point-in-time copy of the marks of a session without
+ * closing it. Marks are only ever appended to the session's log, so
+ * the marks up to the last one accepted when the export starts are a
+ * snapshot that needs no copying and no locks beyond those taken to
+ * read the log in batches, and marking carries on meanwhile. The time
+ * message carries the size of the snapshot and END_DATA its sequence
+ * number, from which OP_SYNC can follow the session.
+ */
+static int admin_export(int sock_fd, int session_id, unsigned flags) {
+
+	return admin_sync(sock_fd, session_id, 0, flags);
+
+}
+
+/*
+ * Push the marks of a session to an admin as they are accepted, or
+ * the anomalies flagged in them if the admin asked for those. The
+ * admin is sent the time whenever nothing came for a while, which
+ * also notices admins that went away. An admin that fell so far
+ * behind that the feed dropped marks it had not read yet is sent
+ * END_DATA and disconnected, it can catch up with OP_SYNC.
+ */
+static int admin_subscribe(int sock_fd, int session_id, unsigned flags) {
+
+	struct as_msg msg;
+	struct timeval now;
+	struct close_stream *stream;
+	struct feed_entry entries[AS_BATCH_RECORDS];
+	long long cursor;
+	int i, n_entries, status = 0, anomalies = (flags & SUBSCRIBE_ANOMALIES) != 0;
+
+	if ( feed_subscribe(&cursor) < 0 )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	if ( !(stream = (struct close_stream*)malloc(sizeof(struct close_stream))) ) {
+		feed_unsubscribe();
+		return -1;
+	}
+
+	stream->sock_fd = sock_fd;
+	stream->flags = flags;
+	// An admin that stops reading is given up on as soon as one that reads slowly
+	stream->timeout = AS_FEED_HEARTBEAT;
+	stream->n_batched = 0;
+
+	for ( n_entries = 0; status == 0; ) {
+
+		if ( n_entries == 0 ) {
+
+			gettimeofday(&now, NULL);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.reply.status = TIME;
+			msg.tv_sec = now.tv_sec;
+			msg.tv_usec = now.tv_usec;
+
+			if ( send_msg(sock_fd, &msg, AS_FEED_HEARTBEAT) < 0 ) {
+				status = -1;
+				break;
+			}
+
+		}
+
+		n_entries = feed_wait(&cursor, session_id, anomalies, entries, AS_BATCH_RECORDS, AS_FEED_HEARTBEAT);
+		if ( n_entries == FEED_LAGGED ) {
+			printf("Dropped a subscriber to session %d that fell behind.\n", session_id);
+			status = send_status(sock_fd, END_DATA, AS_FEED_HEARTBEAT);
+			break;
+		}
+
+		for (i = 0; i < n_entries && status == 0; i++)
+			if ( anomalies )
+				status = send_anomaly(sock_fd, &entries[i]);
+			else
+				status = stream_mark(stream, entries[i].mark.roll_number, entries[i].mark.tv_sec,
+					entries[i].mark.tv_usec);
+
+		if ( status == 0 )
+			status = flush_stream(stream);
+
+	}
+
+	feed_unsubscribe();
+	free(stream);
+
+	return status;
+
+}
+
+/*
+ * Mark a list of students in one request, as an admin entering late
+ * arrivals does. The marks follow the authentication, and are answered
+ * with DONE followed by the status of each mark as an int, in order.
+ * Marks without a time are taken as made now.
+ */
+static int admin_mark_batch(int sock_fd, int session_id, int n_marks) {
+
+	struct as_msg msg;
+	struct timeval now;
+	struct iovec iov[2];
+	struct session *session;
+	struct as_msg_data records[AS_BATCH_RECORDS];
+	struct markpack_mark marks[AS_BATCH_RECORDS];
+	int i, statuses[AS_BATCH_RECORDS];
+
+	if ( n_marks <= 0 || n_marks > AS_BATCH_RECORDS )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	if ( sockio_recv(sock_fd, records, n_marks * sizeof(struct as_msg_data), AS_ADMIN_TIMEOUT * 1000) < 0 )
+		return -1;
+
+	gettimeofday(&now, NULL);
+
+	for (i = 0; i < n_marks; i++) {
+		marks[i].roll_number = ntohl(records[i].roll_number);
+		marks[i].tv_sec = be64toh(records[i].tv_sec);
+		marks[i].tv_usec = be64toh(records[i].tv_usec);
+		if ( marks[i].tv_sec == 0 ) {
+			marks[i].tv_sec = now.tv_sec;
+			marks[i].tv_usec = now.tv_usec;
+		}
+		// One bad mark turns the whole batch away, none of it is taken
+		if ( !valid_time(marks[i].tv_sec, marks[i].tv_usec) )
+			return send_status(sock_fd, BAD_REQUEST, AS_ADMIN_TIMEOUT);
+	}
+
+	if ( !(session = session_get(session_id)) )
+		return send_status(sock_fd, DENY, AS_ADMIN_TIMEOUT);
+
+	session_mark_batch(session, marks, n_marks, statuses);
+	session_put(session);
+
+	printf("Marked %d students in session %d for an admin.\n", n_marks, session_id);
+
+	for (i = 0; i < n_marks; i++)
+		statuses[i] = htonl(statuses[i]);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = DONE;
+	msg.roll_number = n_marks;
+	htonmsg(&msg);
+
+	// The reply and the statuses go out in a single call
+	iov[0].iov_base = &msg;
+	iov[0].iov_len = sizeof(msg);
+	iov[1].iov_base = statuses;
+	iov[1].iov_len = n_marks * sizeof(int);
+
+	return sockio_sendv(sock_fd, iov, 2, AS_ADMIN_TIMEOUT * 1000);
+
+}
+
 static int attendance_server_handle_msg(struct as_msg *msg, int sock_fd) {
 
 	int status = 0;
 
-	struct as_msg_data *data =
-		(struct as_msg_data*)(((char*)msg) + sizeof(struct as_msg_hdr));
-
 	switch ( msg->request.op_code ) {
 
 		case OP_MARK:
-			status = handle_mark(data, sock_fd);
+			status = handle_mark(msg, sock_fd);
+			break;
+
+		case OP_MARK_MAC:
+			status = handle_mark_mac(msg, sock_fd);
+			break;
+
+		case OP_INVALIDATE:
+			status = handle_invalidate(sock_fd);
 			break;
 
 		case OP_CLOSE:
-			status = handle_close(sock_fd);
+		case OP_OPEN:
+		case OP_EXPIRE:
+		case OP_SCHEDULE:
+		case OP_SYNC:
+		case OP_SUBSCRIBE:
+		case OP_EXPORT:
+		case OP_MARK_BATCH:
+			status = handle_admin(msg, sock_fd);
 			break;
 
 		default:
@@ -333,7 +1309,7 @@ static int attendance_server_handle_msg(struct as_msg *msg, int sock_fd) {
 
 static int server_socket_new(char *port) {
 
-	int server_sockfd;
+	int server_sockfd, reuse = 1;
 	struct sockaddr_in server_addr;
 
 	server_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -342,6 +1318,9 @@ static int server_socket_new(char *port) {
 		return -1;
 	}
 
+	// A standby taking over binds the port its primary was just using
+	setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
 	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;
 	server_addr.sin_port = htons(atoi(port));
@@ -361,47 +1340,62 @@ static int server_socket_new(char *port) {
 
 }
 
-static int recv_data(int sock_fd, char *recv_buf, int recv_len) {
+static int send_status(int sock_fd, int status, int timeout) {
 
-	while ( recv_len ) {
+	struct as_msg msg;
 
-		int n_received;
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = status;
 
-		n_received = recv(sock_fd, recv_buf, recv_len, 0);
+	return send_msg(sock_fd, &msg, timeout);
 
-		if ( n_received < 0 ) {
-			perror("recv() failed");
-			return -1;
-		}
+}
 
-		recv_buf += n_received;
-		recv_len -= n_received;
+static int send_busy(int sock_fd, int timeout) {
 
-	}
+	struct as_msg msg;
+	long long retry_after = admission_retry_after();
 
-	return 0;
+	memset(&msg, 0, sizeof(msg));
+	msg.reply.status = BUSY;
+	msg.tv_sec = retry_after / 1000000;
+	msg.tv_usec = retry_after % 1000000;
+
+	return send_msg(sock_fd, &msg, timeout);
 
 }
 
-static int send_data(int sock_fd, char *send_buf, int send_len) {
+/*
+ * Tell a client to retry later and close the connection. Whatever
+ * the client sent is read first, as closing with unread data would
+ * reset the connection before the client sees the reply.
+ */
+static void turn_away(int sock_fd) {
 
-	while ( send_len ) {
+	char discard[sizeof(struct as_msg) + sizeof(struct as_msg_mac)];
 
-		int n_sent;
+	while ( recv(sock_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0 )
+		;
 
-		n_sent = send(sock_fd, send_buf, send_len, 0);
+	// Sent only if it goes out at once, this runs on the thread accepting connections
+	send_busy(sock_fd, 0);
+	close(sock_fd);
 
-		if ( n_sent < 0 ) {
-			perror("send() failed");
-			return -1;
-		}
+	return;
+
+}
 
-		send_buf += n_sent;
-		send_len -= n_sent;
+/* Log a client dropped for stalling, with the timeouts counted so far */
+static void report_stall(void) {
 
-	}
+	struct sockio_stats stats;
 
-	return 0;
+	sockio_stats(&stats);
+
+	printf("Dropped a client that took over %d s to send its request, %lld timeouts so far.\n",
+		AS_IO_TIMEOUT, stats.n_timeouts);
+
+	return;
 
 }
 
@@ -413,6 +1407,7 @@ static void htonmsg(struct as_msg *msg) {
 	msg->tv_sec = htobe64(msg->tv_sec);
 	msg->tv_usec = htobe64(msg->tv_usec);
 	msg->roll_number = htonl(msg->roll_number);
+	msg->session_id = htonl(msg->session_id);
 
 	return;
 
@@ -426,17 +1421,22 @@ static void ntohmsg(struct as_msg *msg) {
 	msg->tv_sec = be64toh(msg->tv_sec);
 	msg->tv_usec = be64toh(msg->tv_usec);
 	msg->roll_number = ntohl(msg->roll_number);
+	msg->session_id = ntohl(msg->session_id);
 
 	return;
 
 }
 
-static int recv_msg(int sock_fd, struct as_msg *msg) {
+/*
+ * Messages are received and sent with a timeout in seconds, which bounds
+ * the whole message. Failures return the result of sockio.
+ */
+static int recv_msg(int sock_fd, struct as_msg *msg, int timeout) {
 
-	int ret;
+	int status;
 
-	if ( recv_data(sock_fd, (char*)msg, sizeof(struct as_msg)) < 0 )
-		return -1;
+	if ( (status = sockio_recv(sock_fd, msg, sizeof(struct as_msg), timeout * 1000)) < 0 )
+		return status;
 
 	ntohmsg(msg);
 
@@ -444,16 +1444,11 @@ static int recv_msg(int sock_fd, struct as_msg *msg) {
 
 }
 
-static int send_msg(int sock_fd, struct as_msg *msg) {
-
-	int ret;
+static int send_msg(int sock_fd, struct as_msg *msg, int timeout) {
 
 	htonmsg(msg);
 
-	if ( send_data(sock_fd, (char*)msg, sizeof(struct as_msg)) < 0 )
-		return -1;
-
-	return 0;
+	return sockio_send(sock_fd, msg, sizeof(struct as_msg), timeout * 1000);
 
 }
 
@@ -463,3 +1458,4 @@ static int send_msg(int sock_fd, struct as_msg *msg) {
 
 
 
+
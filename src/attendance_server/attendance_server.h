@@ -8,11 +8,79 @@
 #define AUTH_KEY	0x13243546
 #define DB_SERVER_IP	"127.0.0.1"
 #define DB_SERVER_PORT	2345
+#define AS_DB_CONNECTIONS	2	/* Connections to the database server kept open */
+#define AS_JOURNAL_DIR	"/root/attendance-tools-servers"
+#define AS_JOURNAL_NAME	"attendance.%d.journal"	/* Journal of each session, by session ID */
+#define AS_WORKER_THREADS	8	/* Threads accepting and serving connections */
+#define AS_MARK_STRIPES		64	/* Locks guarding the mark table, power of 2 */
+#define AS_IO_TIMEOUT		2	/* Seconds a client may take to send a request or read the reply */
+#define AS_ADMIN_TIMEOUT	30	/* Seconds an admin may stall the close stream */
+#define AS_MAX_ADMINS		32	/* Most admin connections served at once, subscribers included, more are told to retry */
+#define AS_BATCH_RECORDS	256	/* Most records in a DATA_BATCH frame */
+#define AS_MAX_SESSIONS		64	/* Most sessions held at once */
+#define AS_SESSION_TTL		3600	/* Seconds a closed session is kept before it expires */
+#define AS_DEFAULT_SESSION	0	/* Session opened on startup */
+#define AS_IDENTITY_TTL		600	/* Seconds the cached device registry is trusted */
+#define AS_IDENTITY_RETRY	5	/* Least seconds between fetches of the registry for unknown devices, or after one failed */
+#define AS_QUEUE_LEN		1024	/* Most accepted connections waiting for a worker */
+#define AS_QUEUE_TARGET		20	/* Milliseconds connections may wait for a worker before marks are shed */
+#define AS_QUEUE_INTERVAL	100	/* Milliseconds the wait must stay above target before shedding starts */
+#define AS_RETRY_MIN		50	/* Least milliseconds a shed client is told to wait */
+#define AS_RETRY_MAX		2000	/* Most milliseconds a shed client is told to wait */
+#define AS_FEED_SLOTS		4096	/* Marks buffered for subscribers, a subscriber further behind is dropped */
+#define AS_MAX_SUBSCRIBERS	16	/* Most admins subscribed at once */
+#define AS_FEED_HEARTBEAT	5	/* Seconds without marks after which a subscriber is sent the time */
+#define AS_STANDBY_JOURNAL_NAME	"standby.%d.journal"	/* Journal of each session on a standby */
+#define AS_REPL_QUEUE		8192	/* Events waiting for the standby, more and it is sent a new snapshot */
+#define AS_REPL_BATCH		256	/* Most events sent to the standby in one write */
+#define AS_REPL_HEARTBEAT	1	/* Seconds without events after which the standby is sent a heartbeat */
+#define AS_REPL_TIMEOUT		3	/* Seconds the other server may stay silent or stall before it is given up on */
+#define AS_REPL_RETRY		1	/* Seconds between attempts to reach the standby */
+#define AS_REPL_GRACE		3	/* Seconds a standby waits for a lost primary before taking over */
+#define AS_UPGRADE_NAME	"as-server.%s.upgrade"	/* Socket in AS_JOURNAL_DIR a new binary takes over through, by port */
+#define AS_UPGRADE_TIMEOUT	10	/* Seconds either side of an upgrade waits for the other */
+#define AS_DRAIN_TIMEOUT	5	/* Seconds a handover waits for connections and admins being served, under AS_UPGRADE_TIMEOUT */
+#define AS_ANOMALY_DEVICES	1024	/* Devices each session tracks for anomalies, power of 2 */
+#define AS_ANOMALY_WINDOW	10	/* Seconds over which the marks of a device are counted */
+#define AS_ANOMALY_BURST	3	/* Most marks a device may make within the window */
+#define AS_ANOMALY_RATE_SPAN	60	/* Seconds over which the usual rate of marks is averaged */
+#define AS_ANOMALY_RATE_MIN	10	/* Least marks in a second that can be a spike */
+#define AS_ANOMALY_SPIKE	5	/* Times the usual rate of marks that is a spike */
+#define AS_ANOMALY_SKEW		60	/* Most seconds the time of a mark may be off the server's */
+
+/* Scheduled session events */
+#define EVENT_OPEN	0x00 /* Open the session */
+#define EVENT_LATE	0x01 /* Mark students late from now on */
+#define EVENT_CLOSE	0x02 /* Close the session */
+#define EVENT_EXPIRE	0x03 /* Reclaim expired sessions */
+
+/// Events of a schedule set with OP_SCHEDULE, as a mask for sched_cancel
+#define EVENTS_SCHEDULED	((1 << EVENT_OPEN) | (1 << EVENT_LATE) | (1 << EVENT_CLOSE))
+
+/* Anomalies flagged in marks, in the challenge field of ANOMALY */
+#define ANOMALY_DEVICE_ROLLS	0x01 /* A device marked a roll number other than the one it marked first */
+#define ANOMALY_DEVICE_BURST	0x02 /* A device marked more than AS_ANOMALY_BURST times within AS_ANOMALY_WINDOW seconds */
+#define ANOMALY_RATE_SPIKE	0x04 /* Marks arrived at AS_ANOMALY_SPIKE times the usual rate */
+#define ANOMALY_TIMING		0x08 /* A mark claimed a time far off the server's, or before the last mark of its device */
 
 /* Operation codes */
 #define OP_MARK		0x00 /* Mark someone's attendance */
 #define OP_CLOSE	0x01 /* Close the attendance server */
 #define OP_AUTH		0x02 /* Verify the challenge response for authentication */
+#define OP_OPEN		0x03 /* Open a new session */
+#define OP_EXPIRE	0x04 /* Drop a session and its records */
+#define OP_SCHEDULE	0x05 /* Open, mark late and close a session at tv_sec, tv_sec + roll_number and tv_usec, replacing any earlier schedule */
+#define OP_SYNC		0x06 /* Stream the marks after sequence number tv_sec, leaving the session open */
+#define OP_MARK_MAC	0x07 /* Mark the student a device is registered to, followed by struct as_msg_mac */
+#define OP_INVALIDATE	0x08 /* Fetch the registered devices again before the next OP_MARK_MAC */
+#define OP_SUBSCRIBE	0x09 /* Stream the marks of a session as they are accepted, until the admin disconnects */
+#define OP_EXPORT	0x0A /* Stream the marks of a session accepted so far, leaving the session open */
+#define OP_MARK_BATCH	0x0B /* Mark roll_number students, sent as struct as_msg_data after authenticating, a zero time is now */
+
+/* Flags of OP_CLOSE, OP_SYNC, OP_SUBSCRIBE and OP_EXPORT, in the response field */
+#define CLOSE_BATCH	0x01 /* Stream records in DATA_BATCH frames */
+#define CLOSE_COMPACT	0x02 /* Stream records in DATA_COMPACT frames */
+#define SUBSCRIBE_ANOMALIES	0x04 /* Stream the anomalies flagged in the session instead of its marks, OP_SUBSCRIBE only */
 
 /* Response codes */
 #define PRESENT		0x00 /* Marked present */
@@ -23,6 +91,13 @@
 #define TIME		0x05 /* Sent the current time for synchronization */
 #define DATA		0x06 /* Payload contains data */
 #define END_DATA	0x07 /* End of data stream - no data in the payload */
+#define DATA_BATCH	0x08 /* Followed by roll_number records as struct as_msg_data */
+#define DATA_COMPACT	0x09 /* Followed by roll_number records packed in tv_sec bytes, tv_usec is their CRC-32 */
+#define DONE		0x0A /* The requested operation succeeded */
+#define UNREGISTERED	0x0B /* The device is not registered */
+#define BUSY		0x0C /* Overloaded, retry after tv_sec seconds and tv_usec microseconds */
+#define ANOMALY		0x0D /* Anomaly chal raised by a mark of roll_number at tv_sec and tv_usec, followed by struct as_msg_mac */
+#define BAD_REQUEST	0x0E /* The request carried a time out of range */
 
 
 
@@ -55,6 +130,12 @@ struct as_msg_data {
 
 } __attribute__((packed));
 
+struct as_msg_mac {
+
+	unsigned char mac_addr[6];
+
+} __attribute__((packed));
+
 struct as_msg {
 
 	union {
@@ -76,6 +157,8 @@ struct as_msg {
 
 	int roll_number;
 
+	int session_id;
+
 } __attribute__((packed));
 
 
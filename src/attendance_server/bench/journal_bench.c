@@ -0,0 +1,177 @@
+
+
+
+/*
+ *
+ * Measures how long the attendance server takes to recover a
+ * session from its mark journal after a restart.
+ *
+ * Writes a journal of a lecture with the given number of marks,
+ * every student marking once in random order, then replays it into
+ * a record list and markset as the server does on startup.
+ *
+ */
+
+
+
+#include <time.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "journal.h"
+#include "markset.h"
+#include "arecord_list.h"
+
+
+
+/* Where the benchmark journal is written */
+#define JOURNAL_FILE	"/tmp/mark-bench.journal"
+
+/* Marks appended between syncs while writing the journal */
+#define SYNC_BATCH	64
+
+/* Repetitions of the replay, the fastest one is reported */
+#define N_RUNS		5
+
+
+
+struct replay_state {
+
+	struct arecord_list *list;
+	struct markset *set;
+
+};
+
+
+
+static int write_journal(int n_marks);
+static int replay_record(int event, int roll_number, long long tv_sec, long long tv_usec, void *cb_data);
+static double now(void);
+
+
+
+int main(int argc, char **argv) {
+
+	int r, n_marks = 10000, n_replayed = 0;
+	double start, best = 0;
+
+	if ( argc > 2 ) {
+		printf("Usage: %s [marks in the session]\n", argv[0]);
+		return -1;
+	}
+	if ( argc == 2 )
+		n_marks = atoi(argv[1]);
+
+	srand(1);
+
+	start = now();
+	if ( write_journal(n_marks) < 0 )
+		return -1;
+	printf("Wrote %d marks in %.3f ms, syncing every %d marks.\n",
+		n_marks, (now() - start) * 1e3, SYNC_BATCH);
+
+	for ( r = 0; r < N_RUNS; r++ ) {
+
+		struct replay_state state;
+		double elapsed;
+
+		state.list = arecord_list_new();
+		state.set = markset_new();
+
+		start = now();
+		n_replayed = journal_replay(JOURNAL_FILE, replay_record, &state);
+		elapsed = now() - start;
+
+		if ( r == 0 || elapsed < best )
+			best = elapsed;
+
+		markset_free(state.set);
+		arecord_list_free(state.list);
+
+	}
+
+	printf("Recovered %d marks in %.3f ms.\n", n_replayed, best * 1e3);
+
+	unlink(JOURNAL_FILE);
+
+	return 0;
+
+}
+
+
+
+static int write_journal(int n_marks) {
+
+	struct journal *journal;
+	long long seq = 0;
+	int i, *rolls;
+
+	unlink(JOURNAL_FILE);
+
+	if ( !(journal = journal_open(JOURNAL_FILE)) )
+		return -1;
+
+	if ( !(rolls = (int*)malloc(n_marks * sizeof(int))) ) {
+		journal_free(journal);
+		return -1;
+	}
+
+	for ( i = 0; i < n_marks; i++ )
+		rolls[i] = 19100001 + i;
+	for ( i = n_marks - 1; i > 0; i-- ) {
+		int j = rand() % (i + 1), tmp = rolls[i];
+		rolls[i] = rolls[j];
+		rolls[j] = tmp;
+	}
+
+	for ( i = 0; i < n_marks; i++ ) {
+		seq = journal_append(journal, rolls[i], 1500000000 + i, i % 1000000);
+		if ( seq < 0 || (i % SYNC_BATCH == SYNC_BATCH - 1 && journal_sync(journal, seq) < 0) )
+			break;
+	}
+
+	if ( seq > 0 )
+		journal_sync(journal, seq);
+
+	free(rolls);
+	journal_free(journal);
+
+	return i == n_marks ? 0 : -1;
+
+}
+
+static int replay_record(int event, int roll_number, long long tv_sec, long long tv_usec, void *cb_data) {
+
+	struct replay_state *state = (struct replay_state*)cb_data;
+	struct arecord *new_record;
+
+	// Only marks are written by the benchmark
+	if ( event != JOURNAL_MARK )
+		return 1;
+
+	if ( markset_contains(state->set, roll_number) )
+		return 1;
+
+	if ( !(new_record = arecord_new()) )
+		return 0;
+	markset_add(state->set, roll_number);
+	new_record->roll_number = roll_number;
+	new_record->tv_sec = tv_sec;
+	new_record->tv_usec = tv_usec;
+	arecord_list_insert(state->list, new_record);
+
+	return 1;
+
+}
+
+static double now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
@@ -0,0 +1,174 @@
+
+
+
+/*
+ *
+ * Microbenchmark of attendance mark throughput versus class size.
+ *
+ * Replays the entry rush of a lecture, where every student marks
+ * a few times because of page refreshes, against the duplicate
+ * check of the attendance server: once with a scan of the record
+ * list as in older releases and once with the markset.
+ *
+ */
+
+
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "markset.h"
+#include "arecord_list.h"
+
+
+
+/* Marks per student during the rush */
+#define MARKS_PER_STUDENT	3
+
+/* Repetitions of each run, the fastest one is reported */
+#define N_RUNS			5
+
+
+
+static int match_record(struct arecord *record, void *cb_data);
+static void register_scan(struct arecord_list *list, int roll_number);
+static void register_markset(struct arecord_list *list, struct markset *set, int roll_number);
+static double run(int *marks, int n_marks, int use_markset);
+static double now(void);
+
+
+
+int main(int argc, char **argv) {
+
+	int size, max_size = 3200;
+
+	if ( argc > 2 ) {
+		printf("Usage: %s [largest class size]\n", argv[0]);
+		return -1;
+	}
+	if ( argc == 2 )
+		max_size = atoi(argv[1]);
+
+	srand(1);
+
+	printf("%10s %10s %16s %16s\n", "students", "marks", "scan marks/s", "markset marks/s");
+
+	for ( size = 50; size <= max_size; size *= 2 ) {
+
+		int i, n_marks = size * MARKS_PER_STUDENT;
+		int *marks = (int*)malloc(n_marks * sizeof(int));
+		double scan_time, markset_time;
+
+		if ( !marks )
+			return -1;
+
+		/* Everyone marks a few times, in random order */
+		for ( i = 0; i < n_marks; i++ )
+			marks[i] = 19100001 + i % size;
+		for ( i = n_marks - 1; i > 0; i-- ) {
+			int j = rand() % (i + 1), tmp = marks[i];
+			marks[i] = marks[j];
+			marks[j] = tmp;
+		}
+
+		scan_time = run(marks, n_marks, 0);
+		markset_time = run(marks, n_marks, 1);
+
+		printf("%10d %10d %16.0f %16.0f\n", size, n_marks,
+			n_marks / scan_time, n_marks / markset_time);
+
+		free(marks);
+
+	}
+
+	return 0;
+
+}
+
+
+
+static int match_record(struct arecord *record, void *cb_data) {
+
+	return record->roll_number == *(int*)cb_data;
+
+}
+
+static void register_scan(struct arecord_list *list, int roll_number) {
+
+	struct arecord *new_record;
+
+	if ( arecord_list_foreach(list, match_record, &roll_number) > 0 )
+		return;
+
+	if ( !(new_record = arecord_new()) )
+		return;
+	new_record->roll_number = roll_number;
+	arecord_list_insert(list, new_record);
+
+	return;
+
+}
+
+static void register_markset(struct arecord_list *list, struct markset *set, int roll_number) {
+
+	struct arecord *new_record;
+
+	if ( markset_contains(set, roll_number) )
+		return;
+
+	if ( !(new_record = arecord_new()) )
+		return;
+	markset_add(set, roll_number);
+	new_record->roll_number = roll_number;
+	arecord_list_insert(list, new_record);
+
+	return;
+
+}
+
+static double run(int *marks, int n_marks, int use_markset) {
+
+	int i, r;
+	double best = 0;
+
+	for ( r = 0; r < N_RUNS; r++ ) {
+
+		double start, elapsed;
+		struct arecord_list *list = arecord_list_new();
+		struct markset *set = markset_new();
+
+		start = now();
+		for ( i = 0; i < n_marks; i++ ) {
+			if ( use_markset )
+				register_markset(list, set, marks[i]);
+			else
+				register_scan(list, marks[i]);
+		}
+		elapsed = now() - start;
+
+		if ( r == 0 || elapsed < best )
+			best = elapsed;
+
+		markset_free(set);
+		arecord_list_free(list);
+
+	}
+
+	return best > 0 ? best : 1e-9;
+
+}
+
+static double now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+
+
@@ -0,0 +1,117 @@
+/*!
+
+	@file dbpool.c
+
+	@brief Pool of connections from as-server to the database server.
+
+	Threads talking to the database server borrow one of
+	AS_DB_CONNECTIONS connections kept open across requests, so a
+	request costs a send and a receive rather than a new connection.
+	Connections are made on first use and remade by the database
+	client whenever the server closed them. A thread finding every
+	connection borrowed waits for one to be returned.
+
+*/
+
+
+
+#ifndef DBPOOL_C
+#define DBPOOL_C
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "dbpool.h"
+
+#include "attendance_server.h"
+
+
+
+/// Connections not borrowed, guarded by the pool lock
+static struct db_conn *idle[AS_DB_CONNECTIONS];
+static int n_idle;
+
+/// Connections made so far
+static int n_made;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t returned = PTHREAD_COND_INITIALIZER;
+
+
+
+/*!
+
+	@brief Borrow a connection to the database server.
+
+	@return The connection, to be given back with dbpool_put, or NULL
+	on failure.
+
+*/
+struct db_conn *dbpool_get(void) {
+
+	struct db_conn *conn = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+
+	while ( n_idle == 0 && n_made == AS_DB_CONNECTIONS )
+		pthread_cond_wait(&returned, &pool_lock);
+
+	if ( n_idle > 0 )
+		conn = idle[--n_idle];
+	else if ( (conn = db_conn_new(DB_SERVER_IP, DB_SERVER_PORT)) )
+		n_made++;
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return conn;
+
+}
+
+/*!
+
+	@brief Give back a connection borrowed with dbpool_get.
+
+*/
+void dbpool_put(struct db_conn *conn) {
+
+	pthread_mutex_lock(&pool_lock);
+
+	idle[n_idle++] = conn;
+	pthread_cond_signal(&returned);
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Close every connection.
+
+	Only safe once every connection was given back.
+
+*/
+void dbpool_free(void) {
+
+	pthread_mutex_lock(&pool_lock);
+
+	while ( n_idle > 0 )
+		db_conn_free(idle[--n_idle]);
+	n_made = 0;
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return;
+
+}
+
+
+
+#endif /* DBPOOL_C */
+
+
+
@@ -0,0 +1,28 @@
+/*!
+
+	@file dbpool.h
+	@brief Header file for the pool of database server connections.
+
+*/
+
+
+
+#ifndef DBPOOL_H
+#define DBPOOL_H
+
+
+
+#include "database_client.h"
+
+
+
+struct db_conn *dbpool_get(void);
+void dbpool_put(struct db_conn *conn);
+void dbpool_free(void);
+
+
+
+#endif /* DBPOOL_H */
+
+
+
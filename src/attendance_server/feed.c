@@ -0,0 +1,221 @@
+/*!
+
+	@file feed.c
+
+	@brief Feed of new marks, pushed to subscribed admins.
+
+	Marks are published to a ring buffer of AS_FEED_SLOTS entries
+	shared by every subscriber. Each subscriber keeps its own cursor
+	into the ring and copies new entries out under the feed lock,
+	then sends them without it, so publishing a mark only ever costs
+	one short critical section however many subscribers there are
+	and however slow they are. A subscriber the ring wrapped around
+	has lost marks and is dropped.
+
+	Anomalies flagged in marks go through the same ring, to the
+	subscribers that asked for them instead of marks.
+
+*/
+
+
+
+#ifndef FEED_C
+#define FEED_C
+
+
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "feed.h"
+
+#include "attendance_server.h"
+
+
+
+/// Ring of published marks and anomalies, guarded by the feed lock
+static struct feed_entry ring[AS_FEED_SLOTS];
+
+/// Number of entries ever published, the ring position of the next one
+static long long head;
+
+static int n_subscribers;
+
+static pthread_mutex_t feed_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t published = PTHREAD_COND_INITIALIZER;
+
+
+
+static void publish(const struct feed_entry *entry) {
+
+	pthread_mutex_lock(&feed_lock);
+
+	// Nobody to tell, skip the wakeup
+	if ( n_subscribers == 0 ) {
+		pthread_mutex_unlock(&feed_lock);
+		return;
+	}
+
+	ring[head % AS_FEED_SLOTS] = *entry;
+	head++;
+
+	pthread_cond_broadcast(&published);
+
+	pthread_mutex_unlock(&feed_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Publish a newly accepted mark to the subscribers.
+
+*/
+void feed_publish(int session_id, int roll_number, long long tv_sec, long long tv_usec) {
+
+	struct feed_entry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.session_id = session_id;
+	entry.mark.roll_number = roll_number;
+	entry.mark.tv_sec = tv_sec;
+	entry.mark.tv_usec = tv_usec;
+
+	publish(&entry);
+
+	return;
+
+}
+
+/*!
+
+	@brief Publish an anomaly flagged in a mark to the subscribers.
+
+	@param anomaly One of the ANOMALY_* flags.
+	@param mac_addr Device that made the mark, or NULL if unknown.
+
+*/
+void feed_flag(int session_id, int anomaly, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, long long tv_usec) {
+
+	struct feed_entry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.session_id = session_id;
+	entry.anomaly = anomaly;
+	entry.mark.roll_number = roll_number;
+	entry.mark.tv_sec = tv_sec;
+	entry.mark.tv_usec = tv_usec;
+	if ( mac_addr )
+		memcpy(entry.mac_addr, mac_addr, sizeof(entry.mac_addr));
+
+	publish(&entry);
+
+	return;
+
+}
+
+/*!
+
+	@brief Subscribe to the marks published from now on.
+
+	@param cursor Set to the position of the next mark published.
+	@return 0 on success, or -1 if there are too many subscribers.
+
+*/
+int feed_subscribe(long long *cursor) {
+
+	pthread_mutex_lock(&feed_lock);
+
+	if ( n_subscribers == AS_MAX_SUBSCRIBERS ) {
+		pthread_mutex_unlock(&feed_lock);
+		return -1;
+	}
+
+	n_subscribers++;
+	*cursor = head;
+
+	pthread_mutex_unlock(&feed_lock);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief End a subscription taken with feed_subscribe.
+
+*/
+void feed_unsubscribe(void) {
+
+	pthread_mutex_lock(&feed_lock);
+	n_subscribers--;
+	pthread_mutex_unlock(&feed_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Wait for marks or anomalies of a session published past a
+	cursor.
+
+	@param cursor Position of the next entry to read, advanced past
+	the entries read.
+	@param anomalies Set to read the anomalies of the session instead
+	of its marks.
+	@param timeout Most seconds to wait for an entry.
+	@return Number of entries copied, 0 if none came in time, or
+	FEED_LAGGED if entries past the cursor were overwritten.
+
+*/
+int feed_wait(long long *cursor, int session_id, int anomalies, struct feed_entry *entries, int max_entries,
+	int timeout) {
+
+	struct timespec deadline;
+	int n_entries = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout;
+
+	pthread_mutex_lock(&feed_lock);
+
+	while ( n_entries == 0 ) {
+
+		while ( *cursor == head )
+			if ( pthread_cond_timedwait(&published, &feed_lock, &deadline) == ETIMEDOUT ) {
+				pthread_mutex_unlock(&feed_lock);
+				return 0;
+			}
+
+		if ( head - *cursor > AS_FEED_SLOTS ) {
+			pthread_mutex_unlock(&feed_lock);
+			return FEED_LAGGED;
+		}
+
+		// Skip the entries of other sessions, and those of the other kind
+		for ( ; *cursor < head && n_entries < max_entries; (*cursor)++ ) {
+			struct feed_entry *entry = &ring[*cursor % AS_FEED_SLOTS];
+			if ( entry->session_id == session_id && !entry->anomaly == !anomalies )
+				entries[n_entries++] = *entry;
+		}
+
+	}
+
+	pthread_mutex_unlock(&feed_lock);
+
+	return n_entries;
+
+}
+
+
+
+#endif /* FEED_C */
+
+
+
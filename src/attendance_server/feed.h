@@ -0,0 +1,58 @@
+/*!
+
+	@file feed.h
+	@brief Header file for the feed of new marks to subscribers.
+
+*/
+
+
+
+#ifndef FEED_H
+#define FEED_H
+
+
+
+#include "markpack.h"
+
+
+
+/// Returned by feed_wait to a subscriber that fell behind
+#define FEED_LAGGED -1
+
+
+
+/*!
+
+	@brief A mark or an anomaly published to the feed.
+
+*/
+struct feed_entry {
+
+	int session_id;
+
+	/// Anomaly flagged in the mark, or 0 for a mark accepted
+	int anomaly;
+
+	struct markpack_mark mark;
+
+	/// Device that made the mark, zeroed if unknown
+	unsigned char mac_addr[6];
+
+};
+
+
+
+void feed_publish(int session_id, int roll_number, long long tv_sec, long long tv_usec);
+void feed_flag(int session_id, int anomaly, const unsigned char *mac_addr, int roll_number,
+	long long tv_sec, long long tv_usec);
+int feed_subscribe(long long *cursor);
+void feed_unsubscribe(void);
+int feed_wait(long long *cursor, int session_id, int anomalies, struct feed_entry *entries, int max_entries,
+	int timeout);
+
+
+
+#endif /* FEED_H */
+
+
+
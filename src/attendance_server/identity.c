@@ -0,0 +1,326 @@
+/*!
+
+	@file identity.c
+
+	@brief Cache of the devices registered with the database server.
+
+	Lets as-server mark a student by the MAC address of their device
+	without asking the database server on every mark. The whole
+	registry is fetched in one backup stream and looked up in a hash
+	map; it is fetched again once it is older than AS_IDENTITY_TTL
+	seconds, after it is invalidated, or when an unknown device shows
+	up and the map is older than AS_IDENTITY_RETRY seconds, so that
+	newly registered devices are found without a flood of unknown
+	devices turning into a flood of fetches. A fetch that fails is not
+	tried again for AS_IDENTITY_RETRY seconds either, the stale map is
+	used meanwhile, so marks do not each wait on a database that is down.
+
+	Lookups share a read lock. A fetch builds a new map without
+	holding it and swaps the map in under the write lock.
+
+*/
+
+
+
+#ifndef IDENTITY_C
+#define IDENTITY_C
+
+
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "identity.h"
+#include "database_client.h"
+
+#include "attendance_server.h"
+
+
+
+/// Number of slots of a new map
+#define IDENTITY_INITIAL_SLOTS 1024
+
+/// Marks a slot in use, above the 48 bits of the MAC address
+#define IDENTITY_USED (1ULL << 63)
+
+
+
+/// Current map, swapped under the map lock
+static struct identity_map *identities;
+static pthread_rwlock_t map_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/// Serializes fetches, so that threads finding the map stale fetch it once
+static pthread_mutex_t fetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Set by identity_invalidate, cleared by the next fetch
+static int invalidated;
+
+/// Number of fetches done, to tell if another thread fetched meanwhile
+static long long n_fetches;
+
+/// When the last fetch failed, under the fetch lock
+static time_t failed_at;
+
+
+
+static unsigned long long mac_key(const unsigned char *mac_addr) {
+
+	unsigned long long key = IDENTITY_USED;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		key |= (unsigned long long)mac_addr[i] << (8 * (5 - i));
+
+	return key;
+
+}
+
+static unsigned find_slot(unsigned long long *keys, unsigned mask, unsigned long long key) {
+
+	/* Fibonacci hashing, the vendor prefix alone would cluster badly */
+	unsigned i = (unsigned)((key * 11400714819323198485ull) >> 32) & mask;
+
+	while ( keys[i] && keys[i] != key )
+		i = (i + 1) & mask;
+
+	return i;
+
+}
+
+static void map_free(struct identity_map *map) {
+
+	free(map->keys);
+	free(map->roll_numbers);
+	free(map);
+
+	return;
+
+}
+
+static struct identity_map *map_new(unsigned n_slots) {
+
+	struct identity_map *map;
+
+	if ( !(map = (struct identity_map*)calloc(1, sizeof(struct identity_map))) ) {
+		printf("identity: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	map->keys = (unsigned long long*)calloc(n_slots, sizeof(unsigned long long));
+	map->roll_numbers = (int*)calloc(n_slots, sizeof(int));
+	if ( !map->keys || !map->roll_numbers ) {
+		printf("identity: Memory allocation failure.\n");
+		map_free(map);
+		return NULL;
+	}
+
+	map->mask = n_slots - 1;
+
+	return map;
+
+}
+
+static int map_put(struct identity_map *map, unsigned long long key, int roll_number) {
+
+	unsigned i;
+
+	if ( 2 * (map->n_devices + 1) > (int)(map->mask + 1) ) {
+
+		struct identity_map *grown;
+		unsigned j;
+
+		if ( !(grown = map_new(2 * (map->mask + 1))) )
+			return -1;
+
+		for (j = 0; j <= map->mask; j++)
+			if ( map->keys[j] ) {
+				i = find_slot(grown->keys, grown->mask, map->keys[j]);
+				grown->keys[i] = map->keys[j];
+				grown->roll_numbers[i] = map->roll_numbers[j];
+			}
+
+		free(map->keys);
+		free(map->roll_numbers);
+		map->keys = grown->keys;
+		map->roll_numbers = grown->roll_numbers;
+		map->mask = grown->mask;
+		free(grown);
+
+	}
+
+	i = find_slot(map->keys, map->mask, key);
+	if ( !map->keys[i] )
+		map->n_devices++;
+	map->keys[i] = key;
+	map->roll_numbers[i] = roll_number;
+
+	return 0;
+
+}
+
+static int add_device(struct db_msg_data *record, void *cb_data) {
+
+	if ( map_put((struct identity_map*)cb_data, mac_key(record->mac_addr), record->roll_number) < 0 )
+		return 0;
+
+	return 1;
+
+}
+
+/* Called with the fetch lock held */
+static int fetch(void) {
+
+	struct identity_map *map, *old;
+	int status;
+
+	if ( !(map = map_new(IDENTITY_INITIAL_SLOTS)) )
+		return -1;
+
+	if ( (status = db_backup(DB_SERVER_IP, DB_SERVER_PORT, add_device, map)) != DB_OP_SUCCESS ) {
+		printf("Failed to fetch the registered devices, database status %d.\n", status);
+		map_free(map);
+		return -1;
+	}
+
+	map->loaded = time(NULL);
+
+	pthread_rwlock_wrlock(&map_lock);
+	old = identities;
+	identities = map;
+	invalidated = 0;
+	n_fetches++;
+	pthread_rwlock_unlock(&map_lock);
+
+	if ( old )
+		map_free(old);
+
+	return 0;
+
+}
+
+/*
+ * Look up a device in the current map. Returns 1 if found, 0 if not,
+ * or -1 if the map should be fetched again first, in which case the
+ * number of fetches seen is left in seen.
+ */
+static int lookup(unsigned long long key, int *roll_number, int refetch_unknown, long long *seen) {
+
+	struct identity_map *map;
+	time_t now = time(NULL);
+	int found = 0;
+	unsigned i;
+
+	pthread_rwlock_rdlock(&map_lock);
+
+	*seen = n_fetches;
+
+	if ( !(map = identities) || invalidated || now - map->loaded >= AS_IDENTITY_TTL ) {
+		pthread_rwlock_unlock(&map_lock);
+		return -1;
+	}
+
+	i = find_slot(map->keys, map->mask, key);
+	if ( map->keys[i] ) {
+		*roll_number = map->roll_numbers[i];
+		found = 1;
+	} else if ( refetch_unknown && now - map->loaded >= AS_IDENTITY_RETRY ) {
+		found = -1;
+	}
+
+	pthread_rwlock_unlock(&map_lock);
+
+	return found;
+
+}
+
+
+
+/*!
+
+	@brief Find the roll number a device is registered to.
+
+	The registry is fetched from the database server first if the
+	cached copy is stale. If it cannot be fetched, the stale copy is
+	used, and no fetch is tried for AS_IDENTITY_RETRY seconds.
+
+	@param mac_addr MAC address of the device, 6 bytes.
+	@param roll_number Set to the roll number if the device is found.
+	@return 1 if the device is registered, 0 if it is not, or -1 if
+	the registry could not be fetched at all.
+
+*/
+int identity_resolve(const unsigned char *mac_addr, int *roll_number) {
+
+	unsigned long long key = mac_key(mac_addr);
+	long long seen;
+	int found;
+
+	if ( (found = lookup(key, roll_number, 1, &seen)) >= 0 )
+		return found;
+
+	pthread_mutex_lock(&fetch_lock);
+
+	// Fetch unless another thread did while this one waited for the lock, or one failed lately
+	if ( n_fetches == seen && time(NULL) - failed_at >= AS_IDENTITY_RETRY && fetch() < 0 )
+		failed_at = time(NULL);
+
+	pthread_mutex_unlock(&fetch_lock);
+
+	if ( (found = lookup(key, roll_number, 0, &seen)) >= 0 )
+		return found;
+
+	// Stale or not, the last copy fetched is the best there is
+	pthread_rwlock_rdlock(&map_lock);
+	if ( identities ) {
+		unsigned i = find_slot(identities->keys, identities->mask, key);
+		found = identities->keys[i] != 0;
+		if ( found )
+			*roll_number = identities->roll_numbers[i];
+	}
+	pthread_rwlock_unlock(&map_lock);
+
+	return found;
+
+}
+
+/*!
+
+	@brief Have the registry fetched again on the next lookup.
+
+*/
+void identity_invalidate(void) {
+
+	pthread_rwlock_wrlock(&map_lock);
+	invalidated = 1;
+	pthread_rwlock_unlock(&map_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Free the cached registry.
+
+	Only safe once no other thread looks devices up.
+
+*/
+void identity_free(void) {
+
+	if ( identities )
+		map_free(identities);
+	identities = NULL;
+
+	return;
+
+}
+
+
+
+#endif /* IDENTITY_C */
+
+
+
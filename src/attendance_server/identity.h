@@ -0,0 +1,55 @@
+/*!
+
+	@file identity.h
+	@brief Header file for the cache of registered devices.
+
+*/
+
+
+
+#ifndef IDENTITY_H
+#define IDENTITY_H
+
+
+
+#include <time.h>
+
+
+
+/*!
+
+	@brief Roll numbers of registered devices, by MAC address.
+
+	Open addressing with linear probing. Slots hold MAC addresses as
+	48-bit keys with a high bit set, so a key of 0 marks a free slot.
+
+*/
+struct identity_map {
+
+	/// Slots, a power of two in number
+	unsigned long long *keys;
+	int *roll_numbers;
+
+	/// Number of slots minus one
+	unsigned mask;
+
+	/// Number of devices in the slots
+	int n_devices;
+
+	/// Time the map was loaded from the database server
+	time_t loaded;
+
+};
+
+
+
+int identity_resolve(const unsigned char *mac_addr, int *roll_number);
+void identity_invalidate(void);
+void identity_free(void);
+
+
+
+#endif /* IDENTITY_H */
+
+
+
@@ -0,0 +1,433 @@
+/*!
+
+	@file journal.c
+
+	@brief Append-only journal of accepted attendance marks.
+
+	The journal starts with a magic number, followed by one record
+	per accepted mark: the roll number and the microseconds of its
+	timestamp as 32-bit integers and the seconds of its timestamp
+	as a 64-bit integer, all in network byte order. Records whose
+	microseconds are out of range stand for events instead: the
+	session going late at the time in the seconds, closing at the
+	time in the seconds and, in place of the roll number, the
+	microseconds, and ending.
+
+	Records are appended with a single write each. A crash can only
+	leave a partial record at the tail, which replay cuts off.
+
+*/
+
+
+
+#ifndef JOURNAL_C
+#define JOURNAL_C
+
+
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+
+
+/// Magic number at the start of a journal
+#define JOURNAL_MAGIC 0x41534a31
+
+/// Size of an encoded record
+#define JOURNAL_RECORD_LEN 16
+
+/// Microseconds fields of the event records
+#define JOURNAL_END_USEC	0xffffffffu
+#define JOURNAL_LATE_USEC	0xfffffffeu
+#define JOURNAL_CLOSE_USEC	0xfffffffdu
+
+
+
+static void encode_record(unsigned char *buf, int roll_number, long long tv_sec, unsigned tv_usec) {
+
+	unsigned roll_be = htonl((unsigned)roll_number);
+	unsigned usec_be = htonl(tv_usec);
+	unsigned long long sec_be = htobe64((unsigned long long)tv_sec);
+
+	memcpy(buf, &roll_be, 4);
+	memcpy(buf + 4, &usec_be, 4);
+	memcpy(buf + 8, &sec_be, 8);
+
+	return;
+
+}
+
+static void decode_record(const unsigned char *buf, int *roll_number, long long *tv_sec, unsigned *tv_usec) {
+
+	unsigned roll_be, usec_be;
+	unsigned long long sec_be;
+
+	memcpy(&roll_be, buf, 4);
+	memcpy(&usec_be, buf + 4, 4);
+	memcpy(&sec_be, buf + 8, 8);
+
+	*roll_number = (int)ntohl(roll_be);
+	*tv_usec = ntohl(usec_be);
+	*tv_sec = (long long)be64toh(sec_be);
+
+	return;
+
+}
+
+static int write_all(int fd, const unsigned char *buf, int len) {
+
+	while ( len ) {
+
+		int n_written = write(fd, buf, len);
+
+		if ( n_written < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		buf += n_written;
+		len -= n_written;
+
+	}
+
+	return 0;
+
+}
+
+static unsigned char *read_file(int fd, int *len) {
+
+	struct stat st;
+	unsigned char *buf;
+	int n_read = 0;
+
+	if ( fstat(fd, &st) < 0 )
+		return NULL;
+
+	if ( !(buf = (unsigned char*)malloc(st.st_size + 1)) ) {
+		printf("journal: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	while ( n_read < st.st_size ) {
+
+		int n = read(fd, buf + n_read, st.st_size - n_read);
+
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+
+		n_read += n;
+
+	}
+
+	*len = n_read;
+
+	return buf;
+
+}
+
+/*!
+
+	@brief Replay the marks and events of an unfinished session.
+
+	Calls cb on each mark and event in the journal. A journal whose session
+	was ended, or that is not a journal at all, is emptied instead
+	so that a new session can start. A partial record at the tail,
+	left by a crash during an append, is cut off.
+
+	@param journal_file Path to the journal.
+	@param cb Callback invoked on each mark and event.
+	@param cb_data Data passed to the callback.
+	@return Number of marks replayed, JOURNAL_ENDED if the session
+	was ended, or -1 on failure.
+
+*/
+int journal_replay(const char *journal_file, journal_callback cb, void *cb_data) {
+
+	unsigned char *buf;
+	unsigned magic;
+	int fd, len, offset, n_marks = 0;
+
+	if ( (fd = open(journal_file, O_RDWR)) < 0 ) {
+		if ( errno == ENOENT )
+			return 0;
+		perror("journal_replay: open() failed");
+		return -1;
+	}
+
+	if ( !(buf = read_file(fd, &len)) ) {
+		close(fd);
+		return -1;
+	}
+
+	if ( len > 0 )
+		memcpy(&magic, buf, len < 4 ? len : 4);
+
+	if ( len < 4 || ntohl(magic) != JOURNAL_MAGIC ) {
+		if ( len > 0 )
+			printf("journal_replay: %s is not a journal, discarding it.\n", journal_file);
+		goto discard;
+	}
+
+	// The session is over if it was ended, start afresh then
+	for ( offset = 4; offset + JOURNAL_RECORD_LEN <= len; offset += JOURNAL_RECORD_LEN ) {
+
+		unsigned usec_be;
+
+		memcpy(&usec_be, buf + offset + 4, 4);
+		if ( ntohl(usec_be) == JOURNAL_END_USEC )
+			goto discard;
+
+	}
+
+	for ( offset = 4; offset + JOURNAL_RECORD_LEN <= len; offset += JOURNAL_RECORD_LEN ) {
+
+		int roll_number;
+		long long tv_sec;
+		unsigned tv_usec;
+
+		decode_record(buf + offset, &roll_number, &tv_sec, &tv_usec);
+
+		if ( tv_usec == JOURNAL_LATE_USEC )
+			cb(JOURNAL_LATE, 0, tv_sec, 0, cb_data);
+		else if ( tv_usec == JOURNAL_CLOSE_USEC )
+			cb(JOURNAL_CLOSE, 0, tv_sec, (unsigned)roll_number, cb_data);
+		else {
+			cb(JOURNAL_MARK, roll_number, tv_sec, tv_usec, cb_data);
+			n_marks++;
+		}
+
+	}
+
+	if ( offset < len && ftruncate(fd, offset) < 0 )
+		perror("journal_replay: ftruncate() failed");
+
+	free(buf);
+	close(fd);
+
+	return n_marks;
+
+discard:
+
+	if ( ftruncate(fd, 0) < 0 )
+		perror("journal_replay: ftruncate() failed");
+
+	free(buf);
+	close(fd);
+
+	return JOURNAL_ENDED;
+
+}
+
+/*!
+
+	@brief Open a journal for appending, creating it if needed.
+
+	@param journal_file Path to the journal.
+	@return Pointer to the journal, or NULL on failure.
+
+*/
+struct journal *journal_open(const char *journal_file) {
+
+	struct journal *journal;
+	struct stat st;
+
+	if ( !(journal = (struct journal*)malloc(sizeof(struct journal))) ) {
+		printf("journal_open: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	if ( (journal->fd = open(journal_file, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ) {
+		perror("journal_open: open() failed");
+		free(journal);
+		return NULL;
+	}
+
+	if ( fstat(journal->fd, &st) < 0 || st.st_size == 0 ) {
+
+		unsigned magic = htonl(JOURNAL_MAGIC);
+
+		if ( write_all(journal->fd, (unsigned char*)&magic, 4) < 0 || fdatasync(journal->fd) < 0 ) {
+			perror("journal_open: Writing the journal failed");
+			close(journal->fd);
+			free(journal);
+			return NULL;
+		}
+
+	}
+
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->synced, NULL);
+	journal->n_written = 0;
+	journal->n_synced = 0;
+	journal->syncing = 0;
+	journal->n_syncs = 0;
+
+	return journal;
+
+}
+
+/*!
+
+	@brief Append a mark to the journal.
+
+	The mark is not on disk until journal_sync is called with the
+	returned sequence number.
+
+	@return Sequence number of the append, or -1 on failure.
+
+*/
+long long journal_append(struct journal *journal, int roll_number, long long tv_sec, long long tv_usec) {
+
+	unsigned char buf[JOURNAL_RECORD_LEN];
+	long long seq;
+
+	encode_record(buf, roll_number, tv_sec, (unsigned)tv_usec);
+
+	pthread_mutex_lock(&journal->lock);
+
+	if ( write_all(journal->fd, buf, JOURNAL_RECORD_LEN) < 0 ) {
+		perror("journal_append: write() failed");
+		pthread_mutex_unlock(&journal->lock);
+		return -1;
+	}
+	seq = ++journal->n_written;
+
+	pthread_mutex_unlock(&journal->lock);
+
+	return seq;
+
+}
+
+/*!
+
+	@brief Wait until an append is on disk.
+
+	Concurrent callers are batched: one of them syncs everything
+	written so far while the others wait for it.
+
+	@param seq Sequence number returned by journal_append.
+	@return 0 on success, -1 on failure.
+
+*/
+int journal_sync(struct journal *journal, long long seq) {
+
+	int status = 0;
+
+	pthread_mutex_lock(&journal->lock);
+
+	while ( journal->n_synced < seq ) {
+
+		long long target;
+
+		if ( journal->syncing ) {
+			pthread_cond_wait(&journal->synced, &journal->lock);
+			continue;
+		}
+
+		journal->syncing = 1;
+		target = journal->n_written;
+
+		pthread_mutex_unlock(&journal->lock);
+		status = fdatasync(journal->fd);
+		pthread_mutex_lock(&journal->lock);
+
+		journal->syncing = 0;
+		journal->n_syncs++;
+		if ( status == 0 )
+			journal->n_synced = target;
+
+		pthread_cond_broadcast(&journal->synced);
+
+		if ( status < 0 ) {
+			perror("journal_sync: fdatasync() failed");
+			break;
+		}
+
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+
+	return status < 0 ? -1 : 0;
+
+}
+
+/*!
+
+	@brief Record a change of state of the session and wait until it
+	is on disk.
+
+	@param event JOURNAL_LATE or JOURNAL_CLOSE.
+	@return 0 on success, -1 on failure.
+
+*/
+int journal_log_event(struct journal *journal, int event, long long tv_sec, long long tv_usec) {
+
+	long long seq;
+
+	if ( event == JOURNAL_CLOSE )
+		seq = journal_append(journal, (int)tv_usec, tv_sec, JOURNAL_CLOSE_USEC);
+	else
+		seq = journal_append(journal, 0, tv_sec, JOURNAL_LATE_USEC);
+
+	if ( seq < 0 )
+		return -1;
+
+	return journal_sync(journal, seq);
+
+}
+
+/*!
+
+	@brief Record the end of the session.
+
+	The marks in the journal will not be replayed again.
+
+	@return 0 on success, -1 on failure.
+
+*/
+int journal_end_session(struct journal *journal) {
+
+	long long seq;
+
+	if ( (seq = journal_append(journal, 0, 0, JOURNAL_END_USEC)) < 0 )
+		return -1;
+
+	return journal_sync(journal, seq);
+
+}
+
+/*!
+
+	@brief Close the journal.
+
+*/
+void journal_free(struct journal *journal) {
+
+	close(journal->fd);
+	pthread_mutex_destroy(&journal->lock);
+	pthread_cond_destroy(&journal->synced);
+	free(journal);
+
+	return;
+
+}
+
+
+
+#endif /* JOURNAL_C */
+
+
+
@@ -0,0 +1,83 @@
+/*!
+
+	@file journal.h
+	@brief Header file for the mark journal implementation.
+
+*/
+
+
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+
+
+#include <pthread.h>
+
+
+
+/// Returned by journal_replay for a journal whose session was ended
+#define JOURNAL_ENDED -2
+
+/* Events in a journal, passed to journal_callback */
+#define JOURNAL_MARK	0x00 /* A mark accepted at tv_sec and tv_usec */
+#define JOURNAL_LATE	0x01 /* Students were marked late from tv_sec on */
+#define JOURNAL_CLOSE	0x02 /* The session was closed at tv_sec and tv_usec */
+
+
+
+/*!
+
+	@brief Append-only journal of the marks accepted in a session, and
+	of its changes of state.
+
+	Appends are numbered in order. Syncs are shared: a thread waiting
+	for its append to reach the disk either finds it already synced by
+	another thread or syncs everything written so far in one call.
+
+*/
+struct journal {
+
+	int fd;
+
+	pthread_mutex_t lock;
+	pthread_cond_t synced;
+
+	/// Number of records written and number known to be on disk
+	long long n_written;
+	long long n_synced;
+
+	/// Set while a thread is syncing
+	int syncing;
+
+	/// Number of syncs issued, for diagnostics
+	long long n_syncs;
+
+};
+
+/*!
+
+	@brief Callback function type for journal_replay.
+
+	Invoked with every event in the journal, in the order the events
+	happened. The roll number is only set for JOURNAL_MARK.
+
+*/
+typedef int (*journal_callback)(int event, int roll_number, long long tv_sec, long long tv_usec, void *cb_data);
+
+
+
+int journal_replay(const char *journal_file, journal_callback cb, void *cb_data);
+struct journal *journal_open(const char *journal_file);
+long long journal_append(struct journal *journal, int roll_number, long long tv_sec, long long tv_usec);
+int journal_log_event(struct journal *journal, int event, long long tv_sec, long long tv_usec);
+int journal_sync(struct journal *journal, long long seq);
+int journal_end_session(struct journal *journal);
+void journal_free(struct journal *journal);
+
+
+
+#endif /* JOURNAL_H */
+
+
+
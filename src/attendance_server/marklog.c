@@ -0,0 +1,161 @@
+/*!
+
+	@file marklog.c
+
+	@brief Numbered log of the marks accepted in a session.
+
+	Gives every accepted mark a sequence number so that admins can
+	pull the marks made since their last pull while the session is
+	still open, at a cost proportional to the new marks only. The
+	log is an array grown by doubling, indexed by sequence number.
+
+*/
+
+
+
+#ifndef MARKLOG_C
+#define MARKLOG_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "marklog.h"
+
+
+
+/// Number of marks a new log has room for
+#define MARKLOG_INITIAL_MARKS 512
+
+
+
+/*!
+
+	@brief Allocate memory for an empty log.
+
+	@return Pointer to the created log, or NULL on failure.
+
+*/
+struct marklog *marklog_new(void) {
+
+	struct marklog *log;
+
+	if ( !(log = (struct marklog*)malloc(sizeof(struct marklog))) ) {
+		printf("marklog_new: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	if ( !(log->marks = (struct markpack_mark*)malloc(MARKLOG_INITIAL_MARKS * sizeof(struct markpack_mark))) ) {
+		printf("marklog_new: Memory allocation failure.\n");
+		free(log);
+		return NULL;
+	}
+
+	log->n_marks = 0;
+	log->capacity = MARKLOG_INITIAL_MARKS;
+
+	return log;
+
+}
+
+/*!
+
+	@brief Append a mark to the log.
+
+	@return Sequence number of the mark, or -1 on failure.
+
+*/
+long long marklog_append(struct marklog *log, int roll_number, long long tv_sec, long long tv_usec) {
+
+	struct markpack_mark *mark;
+
+	if ( log->n_marks == log->capacity ) {
+
+		struct markpack_mark *new_marks;
+
+		new_marks = (struct markpack_mark*)realloc(log->marks, 2 * log->capacity * sizeof(struct markpack_mark));
+		if ( !new_marks ) {
+			printf("marklog_append: Memory allocation failure.\n");
+			return -1;
+		}
+
+		log->marks = new_marks;
+		log->capacity *= 2;
+
+	}
+
+	mark = &log->marks[log->n_marks];
+	mark->roll_number = roll_number;
+	mark->tv_sec = tv_sec;
+	mark->tv_usec = tv_usec;
+
+	return ++log->n_marks;
+
+}
+
+/*!
+
+	@brief Take back the last mark appended.
+
+	For a mark that could not be recorded elsewhere. Its sequence
+	number is given to the next mark appended.
+
+*/
+void marklog_drop_last(struct marklog *log) {
+
+	if ( log->n_marks > 0 )
+		log->n_marks--;
+
+	return;
+
+}
+
+/*!
+
+	@brief Copy the marks following a sequence number.
+
+	@param after Sequence number of the last mark already read, or 0
+	to read from the first mark.
+	@return Number of marks copied, at most max_marks, or -1 if the
+	log has fewer than after marks.
+
+*/
+int marklog_read(struct marklog *log, long long after, struct markpack_mark *marks, int max_marks) {
+
+	long long n_marks;
+
+	if ( after < 0 || after > log->n_marks )
+		return -1;
+
+	n_marks = log->n_marks - after;
+	if ( n_marks > max_marks )
+		n_marks = max_marks;
+
+	memcpy(marks, &log->marks[after], n_marks * sizeof(struct markpack_mark));
+
+	return (int)n_marks;
+
+}
+
+/*!
+
+	@brief Destroy the log.
+
+*/
+void marklog_free(struct marklog *log) {
+
+	free(log->marks);
+	free(log);
+
+	return;
+
+}
+
+
+
+#endif /* MARKLOG_C */
+
+
+
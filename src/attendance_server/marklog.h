@@ -0,0 +1,53 @@
+/*!
+
+	@file marklog.h
+	@brief Header file for the numbered log of accepted marks.
+
+*/
+
+
+
+#ifndef MARKLOG_H
+#define MARKLOG_H
+
+
+
+#include "markpack.h"
+
+
+
+/*!
+
+	@brief Marks in the order they were accepted.
+
+	The mark at index i has sequence number i + 1, so sequence
+	numbers increase monotonically and a reader holding the last
+	one it saw finds the newer marks without a search.
+
+*/
+struct marklog {
+
+	struct markpack_mark *marks;
+
+	/// Number of marks logged, the sequence number of the last one
+	long long n_marks;
+
+	/// Number of marks the array has room for
+	long long capacity;
+
+};
+
+
+
+struct marklog *marklog_new(void);
+long long marklog_append(struct marklog *log, int roll_number, long long tv_sec, long long tv_usec);
+void marklog_drop_last(struct marklog *log);
+int marklog_read(struct marklog *log, long long after, struct markpack_mark *marks, int max_marks);
+void marklog_free(struct marklog *log);
+
+
+
+#endif /* MARKLOG_H */
+
+
+
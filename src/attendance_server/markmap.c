@@ -0,0 +1,166 @@
+/*!
+
+	@file markmap.c
+
+	@brief Dense bitmap of marks for students on a roster.
+
+	Used instead of a list node per mark when the roster is known
+	in advance. A lecture of 400 students takes 7 words of bitmap
+	and under 5 KB of timestamps, and counting or walking the marks
+	works a word at a time.
+
+*/
+
+
+
+#ifndef MARKMAP_C
+#define MARKMAP_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "markmap.h"
+
+
+
+#define WORD(pos)	((pos) / MARKMAP_WORD_BITS)
+#define BIT(pos)	(1UL << ((pos) % MARKMAP_WORD_BITS))
+
+
+
+/*!
+
+	@brief Allocate memory for a markmap with nobody marked.
+
+	@param n_students Number of students on the roster.
+
+	@return Pointer to the created markmap, or NULL on failure.
+
+*/
+struct markmap *markmap_new(int n_students) {
+
+	int n_words = WORD(n_students) + 1;
+	struct markmap *map;
+
+	if ( !(map = (struct markmap*)calloc(1, sizeof(struct markmap))) ) {
+		printf("markmap_new: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	map->n_students = n_students;
+	map->present = (unsigned long*)calloc(n_words, sizeof(unsigned long));
+	map->tv_sec = (long long*)calloc(n_students + 1, sizeof(long long));
+	map->tv_usec = (int*)calloc(n_students + 1, sizeof(int));
+
+	if ( !map->present || !map->tv_sec || !map->tv_usec ) {
+		printf("markmap_new: Memory allocation failure.\n");
+		markmap_free(map);
+		return NULL;
+	}
+
+	return map;
+
+}
+
+/*!
+
+	@brief Check if the student at a roster position is marked.
+
+*/
+int markmap_test(struct markmap *map, int pos) {
+
+	return (map->present[WORD(pos)] & BIT(pos)) != 0;
+
+}
+
+/*!
+
+	@brief Mark the student at a roster position.
+
+	@return 1 if the student was marked, 0 if they already were.
+
+*/
+int markmap_set(struct markmap *map, int pos, long long tv_sec, long long tv_usec) {
+
+	if ( markmap_test(map, pos) )
+		return 0;
+
+	map->tv_sec[pos] = tv_sec;
+	map->tv_usec[pos] = (int)tv_usec;
+	map->present[WORD(pos)] |= BIT(pos);
+
+	return 1;
+
+}
+
+/*!
+
+	@brief Number of marked students.
+
+*/
+int markmap_count(struct markmap *map) {
+
+	int i, count = 0;
+
+	for ( i = 0; i <= WORD(map->n_students); i++ )
+		count += __builtin_popcountl(map->present[i]);
+
+	return count;
+
+}
+
+/*!
+
+	@brief Invoke a callback on every marked student in roster
+	order.
+
+	Unmarked words are skipped whole.
+
+	@return Integer sum of invocation results
+
+*/
+int markmap_foreach(struct markmap *map, markmap_callback cb, void *cb_data) {
+
+	int i, sum = 0;
+
+	for ( i = 0; i <= WORD(map->n_students); i++ ) {
+
+		unsigned long word = map->present[i];
+
+		while ( word ) {
+			int pos = i * MARKMAP_WORD_BITS + __builtin_ctzl(word);
+			sum += cb(pos, map->tv_sec[pos], map->tv_usec[pos], cb_data);
+			word &= word - 1;
+		}
+
+	}
+
+	return sum;
+
+}
+
+/*!
+
+	@brief Destroy the markmap.
+
+*/
+void markmap_free(struct markmap *map) {
+
+	free(map->present);
+	free(map->tv_sec);
+	free(map->tv_usec);
+	free(map);
+
+	return;
+
+}
+
+
+
+#endif /* MARKMAP_C */
+
+
+
@@ -0,0 +1,67 @@
+/*!
+
+	@file markmap.h
+	@brief Header file for the markmap implementation.
+
+*/
+
+
+
+#ifndef MARKMAP_H
+#define MARKMAP_H
+
+
+
+/// Number of marks per bitmap word
+#define MARKMAP_WORD_BITS	(8 * (int)sizeof(unsigned long))
+
+
+
+/*!
+
+	@brief Marks of the students on a roster.
+
+	Each student is identified by their position on the roster.
+	A bit per student records whether they were marked, and the
+	time of the mark is kept in parallel arrays.
+
+*/
+struct markmap {
+
+	/// Number of students on the roster
+	int n_students;
+
+	/// One bit per student
+	unsigned long *present;
+
+	/// Time of each mark
+	long long *tv_sec;
+	int *tv_usec;
+
+};
+
+/*!
+
+	@brief Callback function type for markmap_foreach.
+
+	Invoked with the roster position and mark time of every marked
+	student.
+
+*/
+typedef int (*markmap_callback)(int pos, long long tv_sec, long long tv_usec, void *cb_data);
+
+
+
+struct markmap *markmap_new(int n_students);
+int markmap_test(struct markmap *map, int pos);
+int markmap_set(struct markmap *map, int pos, long long tv_sec, long long tv_usec);
+int markmap_count(struct markmap *map);
+int markmap_foreach(struct markmap *map, markmap_callback cb, void *cb_data);
+void markmap_free(struct markmap *map);
+
+
+
+#endif /* MARKMAP_H */
+
+
+
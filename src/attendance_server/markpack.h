@@ -0,0 +1,48 @@
+/*!
+
+	@file markpack.h
+	@brief Header file for the compact mark encoding.
+
+*/
+
+
+
+#ifndef MARKPACK_H
+#define MARKPACK_H
+
+
+
+/// Longest encoding of a single mark
+#define MARKPACK_MAX_MARK_LEN	15
+
+/// Buffer size needed to encode n marks
+#define MARKPACK_MAX_LEN(n)	((n) * MARKPACK_MAX_MARK_LEN)
+
+
+
+/*!
+
+	@brief A mark as encoded or decoded by markpack.
+
+*/
+struct markpack_mark {
+
+	int roll_number;
+
+	long long tv_sec;
+	long long tv_usec;
+
+};
+
+
+
+int markpack_encode(const struct markpack_mark *marks, int n_marks, unsigned char *buf);
+int markpack_decode(const unsigned char *buf, int len, struct markpack_mark *marks, int n_marks);
+unsigned markpack_crc32(const unsigned char *buf, int len);
+
+
+
+#endif /* MARKPACK_H */
+
+
+
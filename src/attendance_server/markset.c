@@ -0,0 +1,222 @@
+/*!
+
+	@file markset.c
+
+	@brief Hash set of marked roll numbers.
+
+	Lets the attendance server tell whether a roll number has
+	already been marked in O(1), instead of walking the list of
+	attendance records on every mark. The set is grown to keep
+	at most half of its slots in use, which keeps probe sequences
+	short.
+
+*/
+
+
+
+#ifndef MARKSET_C
+#define MARKSET_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "markset.h"
+
+
+
+/// Number of slots of a new set
+#define MARKSET_INITIAL_SLOTS 512
+
+
+
+static unsigned hash_roll_number(int roll_number) {
+
+	/* Fibonacci hashing spreads consecutive roll numbers well */
+	return (unsigned)roll_number * 2654435769u;
+
+}
+
+static int *find_slot(int *slots, unsigned mask, int roll_number) {
+
+	unsigned i = hash_roll_number(roll_number) & mask;
+
+	while ( slots[i] && slots[i] != roll_number )
+		i = (i + 1) & mask;
+
+	return &slots[i];
+
+}
+
+static int grow(struct markset *set) {
+
+	unsigned i, new_mask;
+	int *new_slots;
+
+	new_mask = 2 * (set->mask + 1) - 1;
+	if ( !(new_slots = (int*)calloc(new_mask + 1, sizeof(int))) ) {
+		printf("markset: Memory allocation failure.\n");
+		return -1;
+	}
+
+	for ( i = 0; i <= set->mask; i++ )
+		if ( set->slots[i] )
+			*find_slot(new_slots, new_mask, set->slots[i]) = set->slots[i];
+
+	free(set->slots);
+	set->slots = new_slots;
+	set->mask = new_mask;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Allocate memory for an empty markset.
+
+	@return Pointer to the created set, or NULL on failure.
+
+*/
+struct markset *markset_new(void) {
+
+	struct markset *set;
+
+	if ( !(set = (struct markset*)malloc(sizeof(struct markset))) ) {
+		printf("markset_new: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	if ( !(set->slots = (int*)calloc(MARKSET_INITIAL_SLOTS, sizeof(int))) ) {
+		printf("markset_new: Memory allocation failure.\n");
+		free(set);
+		return NULL;
+	}
+
+	set->mask = MARKSET_INITIAL_SLOTS - 1;
+	set->n_marks = 0;
+	set->has_zero = 0;
+
+	return set;
+
+}
+
+/*!
+
+	@brief Check if a roll number is in the set.
+
+	@return 1 if the roll number is in the set, 0 otherwise.
+
+*/
+int markset_contains(struct markset *set, int roll_number) {
+
+	if ( !roll_number )
+		return set->has_zero;
+
+	return *find_slot(set->slots, set->mask, roll_number) != 0;
+
+}
+
+/*!
+
+	@brief Make room for one more roll number.
+
+	A markset_add of a roll number not in the set cannot fail after
+	this, until another roll number is added.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int markset_reserve(struct markset *set) {
+
+	if ( 2 * (set->n_marks + 1) > (int)(set->mask + 1) )
+		return grow(set);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Add a roll number to the set.
+
+	@return 1 if the roll number was added, 0 if it was already in
+	the set, or -1 on failure.
+
+*/
+int markset_add(struct markset *set, int roll_number) {
+
+	int *slot;
+
+	if ( !roll_number ) {
+		if ( set->has_zero )
+			return 0;
+		set->has_zero = 1;
+		return 1;
+	}
+
+	slot = find_slot(set->slots, set->mask, roll_number);
+	if ( *slot )
+		return 0;
+
+	if ( 2 * (set->n_marks + 1) > (int)(set->mask + 1) ) {
+		if ( grow(set) < 0 )
+			return -1;
+		slot = find_slot(set->slots, set->mask, roll_number);
+	}
+
+	*slot = roll_number;
+	set->n_marks++;
+
+	return 1;
+
+}
+
+/*!
+
+	@brief Number of roll numbers in the set.
+
+*/
+int markset_size(struct markset *set) {
+
+	return set->n_marks + set->has_zero;
+
+}
+
+/*!
+
+	@brief Remove all roll numbers from the set.
+
+*/
+void markset_empty(struct markset *set) {
+
+	memset(set->slots, 0, (set->mask + 1) * sizeof(int));
+	set->n_marks = 0;
+	set->has_zero = 0;
+
+	return;
+
+}
+
+/*!
+
+	@brief Destroy the set.
+
+*/
+void markset_free(struct markset *set) {
+
+	free(set->slots);
+	free(set);
+
+	return;
+
+}
+
+
+
+#endif /* MARKSET_C */
+
+
+
@@ -0,0 +1,55 @@
+/*!
+
+	@file markset.h
+	@brief Header file for the markset implementation.
+
+*/
+
+
+
+#ifndef MARKSET_H
+#define MARKSET_H
+
+
+
+/*!
+
+	@brief Hash set of marked roll numbers.
+
+	Open addressing with linear probing. Slots hold roll numbers,
+	with 0 marking a free slot, so a marked roll number of 0 is
+	tracked separately.
+
+*/
+struct markset {
+
+	/// Slots, a power of two in number
+	int *slots;
+
+	/// Number of slots minus one
+	unsigned mask;
+
+	/// Number of roll numbers in the slots
+	int n_marks;
+
+	/// Set if roll number 0 is in the set
+	int has_zero;
+
+};
+
+
+
+struct markset *markset_new(void);
+int markset_contains(struct markset *set, int roll_number);
+int markset_reserve(struct markset *set);
+int markset_add(struct markset *set, int roll_number);
+int markset_size(struct markset *set);
+void markset_empty(struct markset *set);
+void markset_free(struct markset *set);
+
+
+
+#endif /* MARKSET_H */
+
+
+
@@ -0,0 +1,743 @@
+/*!
+
+	@file replica.c
+
+	@brief Replication of the sessions of as-server to a warm standby.
+
+	The primary queues every change to its sessions as an event:
+	sessions opening, marks, sessions turning late, closing, being
+	handed over and expiring, and schedules. Queueing is all the
+	marking path pays. A sender thread drains the queue in batches
+	over a persistent connection to the standby. Whenever it
+	(re)connects it first sends a snapshot of every session, so a
+	standby that was down or fell behind is brought back in step,
+	and only then the events queued since, numbered consecutively.
+
+	Events that the snapshot already reflects may be sent again
+	after it. Applying them twice is harmless: marks carry their
+	number within the session and are only applied in order, and
+	every mark of a session that is opened again follows the event
+	opening it. If the standby is unreachable nothing is queued,
+	and a standby that cannot keep up overflows the queue, is
+	disconnected and is sent a fresh snapshot.
+
+	The standby applies the events to its own sessions, journaling
+	the marks under AS_STANDBY_JOURNAL_NAME, and takes over serving
+	clients once the primary has been gone for AS_REPL_GRACE
+	seconds.
+
+	The same snapshot hands the sessions over to a new binary when
+	as-server is upgraded in place.
+
+*/
+
+
+
+#ifndef REPLICA_C
+#define REPLICA_C
+
+
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <endian.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "replica.h"
+#include "session.h"
+#include "scheduler.h"
+#include "sockio.h"
+
+#include "attendance_server.h"
+
+
+
+/// Events waiting for the sender, a ring guarded by the queue lock
+static struct repl_msg queue[AS_REPL_QUEUE];
+static int q_head, q_len;
+
+/// Number of the next event queued
+static long long next_seq = 1;
+
+/// Set while connected to the standby, and once the queue overflowed
+static int streaming, overflowed;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+
+static char standby_ip[INET_ADDRSTRLEN];
+static int standby_port;
+
+/// Set while following a primary
+static int following;
+
+/// Wall clock second the primary was last heard from
+static time_t last_heard;
+
+/// Set while restoring the sessions of a server being upgraded
+static int restoring;
+
+
+
+/* Networking functions */
+static void htonrepl(struct repl_msg *msg);
+static void ntohrepl(struct repl_msg *msg);
+static int send_events(int sock_fd, struct repl_msg *events, int n_events);
+
+/* Primary */
+static int connect_standby(void);
+static int push_event(int sock_fd, struct repl_msg *batch, int *n_batched, int type, int session_id,
+	long long mark_seq, int roll_number, long long tv_sec, long long tv_usec);
+static int send_snapshot(int sock_fd, long long first_seq);
+static int stream_events(int sock_fd);
+static void *run_sender(void *arg);
+
+/* Standby */
+static int apply_mark(struct repl_msg *msg);
+static int apply_event(struct repl_msg *msg);
+static int apply_stream(int sock_fd, int timeout_ms);
+
+
+
+static void htonrepl(struct repl_msg *msg) {
+
+	msg->type = htonl(msg->type);
+	msg->session_id = htonl(msg->session_id);
+	msg->seq = htobe64(msg->seq);
+	msg->mark_seq = htobe64(msg->mark_seq);
+	msg->tv_sec = htobe64(msg->tv_sec);
+	msg->tv_usec = htobe64(msg->tv_usec);
+	msg->roll_number = htonl(msg->roll_number);
+
+	return;
+
+}
+
+static void ntohrepl(struct repl_msg *msg) {
+
+	msg->type = ntohl(msg->type);
+	msg->session_id = ntohl(msg->session_id);
+	msg->seq = be64toh(msg->seq);
+	msg->mark_seq = be64toh(msg->mark_seq);
+	msg->tv_sec = be64toh(msg->tv_sec);
+	msg->tv_usec = be64toh(msg->tv_usec);
+	msg->roll_number = ntohl(msg->roll_number);
+
+	return;
+
+}
+
+/* Send a batch of events in one write, converting them in place */
+static int send_events(int sock_fd, struct repl_msg *events, int n_events) {
+
+	int i;
+
+	for (i = 0; i < n_events; i++)
+		htonrepl(&events[i]);
+
+	// A server that stops reading is given up on rather than waited for
+	return sockio_send(sock_fd, events, n_events * sizeof(struct repl_msg), AS_REPL_TIMEOUT * 1000);
+
+}
+
+
+
+static int connect_standby(void) {
+
+	struct sockaddr_in addr;
+	int sock_fd;
+
+	if ( (sock_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 )
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(standby_port);
+	addr.sin_addr.s_addr = inet_addr(standby_ip);
+
+	if ( connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ) {
+		close(sock_fd);
+		return -1;
+	}
+
+	return sock_fd;
+
+}
+
+/* Add an event to a batch, sending the batch once it is full */
+static int push_event(int sock_fd, struct repl_msg *batch, int *n_batched, int type, int session_id,
+	long long mark_seq, int roll_number, long long tv_sec, long long tv_usec) {
+
+	struct repl_msg *msg = &batch[(*n_batched)++];
+
+	memset(msg, 0, sizeof(struct repl_msg));
+	msg->type = type;
+	msg->session_id = session_id;
+	msg->mark_seq = mark_seq;
+	msg->roll_number = roll_number;
+	msg->tv_sec = tv_sec;
+	msg->tv_usec = tv_usec;
+
+	if ( *n_batched < AS_REPL_BATCH )
+		return 0;
+
+	*n_batched = 0;
+
+	return send_events(sock_fd, batch, AS_REPL_BATCH);
+
+}
+
+static int send_snapshot(int sock_fd, long long first_seq) {
+
+	struct repl_msg batch[AS_REPL_BATCH];
+	struct markpack_mark marks[AS_BATCH_RECORDS];
+	struct sched_entry *due, *next;
+	int ids[AS_MAX_SESSIONS];
+	int i, j, n_ids, n_batched = 0, status = 0;
+
+	status = push_event(sock_fd, batch, &n_batched, REPL_RESET, 0, 0, 0, 0, 0);
+
+	n_ids = sessions_list(ids, AS_MAX_SESSIONS);
+
+	for (i = 0; i < n_ids && status == 0; i++) {
+
+		struct session *session;
+		struct timeval close_time;
+		long long after = 0;
+		int open, late, committed, n_marks;
+
+		if ( !(session = session_get(ids[i])) )
+			continue;
+
+		/*
+		 * The state is taken before the marks: a session seen open may
+		 * close while its marks are read, which is then sent after the
+		 * snapshot, while one seen closed has no more marks to miss.
+		 */
+		open = session->open;
+		late = session->late;
+		close_time = session->close_time;
+		committed = session_committed(session);
+
+		status = push_event(sock_fd, batch, &n_batched, REPL_OPEN, ids[i], 0, 0, 0, 0);
+
+		while ( status == 0 && (n_marks = session_read(session, after, marks, AS_BATCH_RECORDS)) > 0 )
+			for (j = 0; j < n_marks && status == 0; j++)
+				status = push_event(sock_fd, batch, &n_batched, REPL_MARK, ids[i], ++after,
+					marks[j].roll_number, marks[j].tv_sec, marks[j].tv_usec);
+
+		if ( status == 0 && late )
+			status = push_event(sock_fd, batch, &n_batched, REPL_LATE, ids[i], 0, 0, 0, 0);
+
+		if ( status == 0 && !open )
+			status = push_event(sock_fd, batch, &n_batched, REPL_CLOSE, ids[i], 0, 0,
+				close_time.tv_sec, close_time.tv_usec);
+
+		// Collected sessions may be opened again under their ID
+		if ( status == 0 && !open && committed )
+			status = push_event(sock_fd, batch, &n_batched, REPL_COMMIT, ids[i], 0, 0, 0, 0);
+
+		session_put(session);
+
+	}
+
+	// Events still to fire, so the schedule carries over too
+	if ( status == 0 && sched_copy(&due) < 0 )
+		status = -1;
+
+	for ( ; status == 0 && due; due = next ) {
+		next = due->next;
+		status = push_event(sock_fd, batch, &n_batched, REPL_EVENT, due->session_id, 0, due->event, due->when, 0);
+		free(due);
+	}
+
+	if ( status < 0 || send_events(sock_fd, batch, n_batched) < 0 )
+		return -1;
+
+	// Tell the standby where the numbered events pick up
+	memset(&batch[0], 0, sizeof(struct repl_msg));
+	batch[0].type = REPL_SYNCED;
+	batch[0].seq = first_seq - 1;
+	batch[0].roll_number = n_ids;
+
+	return send_events(sock_fd, batch, 1);
+
+}
+
+static int stream_events(int sock_fd) {
+
+	struct repl_msg batch[AS_REPL_BATCH];
+	struct timespec deadline;
+	int i, n_events;
+
+	while ( 1 ) {
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += AS_REPL_HEARTBEAT;
+
+		pthread_mutex_lock(&queue_lock);
+
+		while ( q_len == 0 && !overflowed )
+			if ( pthread_cond_timedwait(&queued, &queue_lock, &deadline) == ETIMEDOUT )
+				break;
+
+		if ( overflowed ) {
+			pthread_mutex_unlock(&queue_lock);
+			printf("The standby fell behind, sending it a new snapshot.\n");
+			return -1;
+		}
+
+		// Copy a batch out, sending it without holding the queue lock
+		n_events = q_len < AS_REPL_BATCH ? q_len : AS_REPL_BATCH;
+		for (i = 0; i < n_events; i++)
+			batch[i] = queue[(q_head + i) % AS_REPL_QUEUE];
+		q_head = (q_head + n_events) % AS_REPL_QUEUE;
+		q_len -= n_events;
+
+		pthread_mutex_unlock(&queue_lock);
+
+		if ( n_events == 0 ) {
+			memset(&batch[0], 0, sizeof(struct repl_msg));
+			batch[0].type = REPL_HEARTBEAT;
+			n_events = 1;
+		}
+
+		if ( send_events(sock_fd, batch, n_events) < 0 )
+			return -1;
+
+	}
+
+}
+
+static void *run_sender(void *arg) {
+
+	int sock_fd, connected = 0;
+	long long first_seq;
+
+	(void)arg;
+
+	while ( 1 ) {
+
+		if ( (sock_fd = connect_standby()) < 0 ) {
+			if ( connected )
+				printf("Lost the standby at %s:%d, retrying.\n", standby_ip, standby_port);
+			connected = 0;
+			sleep(AS_REPL_RETRY);
+			continue;
+		}
+
+		// Events from here on are queued, the snapshot covers the ones before
+		pthread_mutex_lock(&queue_lock);
+		streaming = 1;
+		overflowed = 0;
+		q_head = q_len = 0;
+		first_seq = next_seq;
+		pthread_mutex_unlock(&queue_lock);
+
+		if ( send_snapshot(sock_fd, first_seq) == 0 ) {
+			if ( !connected )
+				printf("Replicating to the standby at %s:%d.\n", standby_ip, standby_port);
+			connected = 1;
+			stream_events(sock_fd);
+		}
+
+		pthread_mutex_lock(&queue_lock);
+		streaming = 0;
+		q_len = 0;
+		pthread_mutex_unlock(&queue_lock);
+
+		close(sock_fd);
+
+	}
+
+	return NULL;
+
+}
+
+/*!
+
+	@brief Start replicating to a standby.
+
+	The standby is connected to in the background, and reconnected
+	to whenever the connection is lost.
+
+	@return 0 on success, -1 on failure.
+
+*/
+int replica_start(const char *ip, int port) {
+
+	pthread_t thread;
+
+	snprintf(standby_ip, sizeof(standby_ip), "%s", ip);
+	standby_port = port;
+
+	if ( pthread_create(&thread, NULL, run_sender, NULL) != 0 ) {
+		perror("replica_start: pthread_create() failed");
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Queue an event for the standby.
+
+	Does nothing unless connected to a standby. Never blocks on the
+	standby: if the queue is full the standby is resynchronized.
+
+*/
+void replica_log(int type, int session_id, long long mark_seq, int roll_number, long long tv_sec, long long tv_usec) {
+
+	struct repl_msg *msg;
+
+	pthread_mutex_lock(&queue_lock);
+
+	if ( !streaming || overflowed ) {
+		pthread_mutex_unlock(&queue_lock);
+		return;
+	}
+
+	if ( q_len == AS_REPL_QUEUE ) {
+		overflowed = 1;
+		pthread_cond_signal(&queued);
+		pthread_mutex_unlock(&queue_lock);
+		return;
+	}
+
+	msg = &queue[(q_head + q_len++) % AS_REPL_QUEUE];
+	msg->type = type;
+	msg->session_id = session_id;
+	msg->seq = next_seq++;
+	msg->mark_seq = mark_seq;
+	msg->roll_number = roll_number;
+	msg->tv_sec = tv_sec;
+	msg->tv_usec = tv_usec;
+
+	pthread_cond_signal(&queued);
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return;
+
+}
+
+
+
+static int apply_mark(struct repl_msg *msg) {
+
+	struct session *session;
+	long long last_seq;
+	int status = 0;
+
+	if ( !(session = session_get(msg->session_id)) )
+		return -1;
+
+	last_seq = session_last_seq(session);
+
+	// Marks already applied are skipped, a missing one means we are out of step
+	if ( msg->mark_seq == last_seq + 1 ) {
+		session_mark(session, msg->roll_number, msg->tv_sec, msg->tv_usec);
+		if ( session_last_seq(session) != msg->mark_seq ) {
+			printf("Mark %lld of session %d was not accepted, is the roster the same?\n",
+				msg->mark_seq, msg->session_id);
+			status = -1;
+		}
+	} else if ( msg->mark_seq > last_seq ) {
+		status = -1;
+	}
+
+	session_put(session);
+
+	return status;
+
+}
+
+static int apply_event(struct repl_msg *msg) {
+
+	struct session *session;
+	struct timeval close_time;
+	int i, n_ids, ids[AS_MAX_SESSIONS];
+	time_t now = time(NULL);
+
+	switch ( msg->type ) {
+
+		case REPL_RESET:
+			n_ids = sessions_list(ids, AS_MAX_SESSIONS);
+			for (i = 0; i < n_ids; i++)
+				session_expire(ids[i]);
+			return 0;
+
+		case REPL_OPEN:
+			if ( restoring ) {
+				session = session_restore(msg->session_id);
+			} else {
+				session_expire(msg->session_id);
+				session = session_open(msg->session_id);
+			}
+			if ( !session )
+				return -1;
+			session_put(session);
+			return 0;
+
+		case REPL_MARK:
+			return apply_mark(msg);
+
+		case REPL_EXPIRE:
+			session_expire(msg->session_id);
+			return 0;
+
+		case REPL_SCHEDULE:
+			sched_cancel(msg->session_id, EVENTS_SCHEDULED);
+			// Only events still to come, the primary sends the ones that already happened
+			if ( msg->tv_sec > now )
+				sched_add(msg->tv_sec, EVENT_OPEN, msg->session_id);
+			if ( msg->roll_number > 0 && msg->tv_sec + msg->roll_number > now
+				&& msg->tv_sec + msg->roll_number < msg->tv_usec )
+				sched_add(msg->tv_sec + msg->roll_number, EVENT_LATE, msg->session_id);
+			if ( msg->tv_usec > now )
+				sched_add(msg->tv_usec, EVENT_CLOSE, msg->session_id);
+			return 0;
+
+		case REPL_EVENT:
+			sched_add(msg->tv_sec, msg->roll_number, msg->session_id);
+			return 0;
+
+		case REPL_SYNCED:
+		case REPL_HEARTBEAT:
+			return 0;
+
+	}
+
+	if ( !(session = session_get(msg->session_id)) )
+		return -1;
+
+	if ( msg->type == REPL_LATE )
+		session_late(session);
+
+	// What is left of a schedule is dropped like the primary does
+	if ( msg->type == REPL_CLOSE && session->open ) {
+		if ( !sched_pending(msg->session_id, 1 << EVENT_OPEN) )
+			sched_cancel(msg->session_id, EVENTS_SCHEDULED);
+		close_time.tv_sec = msg->tv_sec;
+		close_time.tv_usec = msg->tv_usec;
+		session_close_at(session, &close_time);
+		sched_add(close_time.tv_sec + AS_SESSION_TTL, EVENT_EXPIRE, msg->session_id);
+	}
+
+	if ( msg->type == REPL_COMMIT )
+		session_commit(session);
+
+	session_put(session);
+
+	return 0;
+
+}
+
+/* Apply events until the primary goes away or we are out of step */
+static int apply_stream(int sock_fd, int timeout_ms) {
+
+	struct repl_msg batch[AS_REPL_BATCH];
+	struct sockio_part part;
+	long long expected = 0;
+	int i, n_events, status;
+
+	memset(&part, 0, sizeof(part));
+
+	while ( 1 ) {
+
+		// Wait for the next event, which may have partly arrived already
+		if ( sockio_recv(sock_fd, (char*)batch + part.n_received, sizeof(struct repl_msg) - part.n_received, timeout_ms) < 0 )
+			return -1;
+		part.n_received = 0;
+		last_heard = time(NULL);
+
+		// Then take the rest of the batch it came in, without waiting for more
+		n_events = 1;
+		while ( n_events < AS_REPL_BATCH
+			&& (status = sockio_recv_part(sock_fd, &batch[n_events], sizeof(struct repl_msg), &part, timeout_ms)) > 0 )
+			n_events++;
+
+		for (i = 0; i < n_events; i++) {
+
+			struct repl_msg *msg = &batch[i];
+
+			ntohrepl(msg);
+
+			// A handover ends with the snapshot
+			if ( msg->type == REPL_SYNCED && restoring )
+				return 0;
+
+			if ( msg->type == REPL_SYNCED ) {
+				printf("In step with the primary, %d sessions.\n", msg->roll_number);
+				expected = msg->seq + 1;
+			} else if ( msg->seq != 0 ) {
+				if ( expected == 0 || msg->seq != expected ) {
+					printf("Missed events from the primary, %lld came after %lld.\n", msg->seq, expected - 1);
+					return -1;
+				}
+				expected++;
+			}
+
+			if ( apply_event(msg) < 0 ) {
+				printf("Failed to apply event %lld from the primary.\n", msg->seq);
+				return -1;
+			}
+
+		}
+
+		// Events received before the stream failed are applied all the same
+		if ( n_events < AS_REPL_BATCH && status < 0 )
+			return -1;
+
+		// Keep a partly received event for the next wait
+		memmove(batch, &batch[n_events], part.n_received);
+
+	}
+
+}
+
+/*!
+
+	@brief Follow a primary as its standby.
+
+	Listens for the primary on a port and applies its events until
+	it has been gone for AS_REPL_GRACE seconds. Scheduled events
+	only fire once this returns, as the primary sends those that
+	happen while it is up. Those due since it was last heard from are
+	held until then.
+
+	@return 0 once the primary is gone, or -1 on failure.
+
+*/
+int replica_follow(const char *port) {
+
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	int listen_fd, sock_fd, reuse = 1, n_follows = 0;
+
+	if ( (listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 ) {
+		perror("replica_follow: socket() failed");
+		return -1;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port));
+	addr.sin_addr.s_addr = INADDR_ANY;
+
+	if ( bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0 ) {
+		perror("replica_follow: bind() failed");
+		close(listen_fd);
+		return -1;
+	}
+
+	following = 1;
+	printf("Standing by for a primary on port %s.\n", port);
+
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+
+	// Wait for the first primary as long as it takes, and a grace period for it to come back
+	while ( poll(&pfd, 1, n_follows ? AS_REPL_GRACE * 1000 : -1) > 0 ) {
+
+		if ( (sock_fd = accept(listen_fd, NULL, NULL)) < 0 )
+			continue;
+
+		// The primary sends heartbeats, silence means it is gone
+		n_follows++;
+		apply_stream(sock_fd, AS_REPL_TIMEOUT * 1000);
+		close(sock_fd);
+
+		printf("Lost the primary, waiting %d seconds for it.\n", AS_REPL_GRACE);
+
+	}
+
+	close(listen_fd);
+	following = 0;
+
+	printf("Taking over from the primary.\n");
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Send a snapshot of the sessions to the server taking over.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int replica_handoff(int sock_fd) {
+
+	return send_snapshot(sock_fd, 1);
+
+}
+
+/*!
+
+	@brief Restore the sessions from the snapshot of the server being upgraded.
+
+	Restored sessions have no journal until sessions_reopen_journals.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int replica_restore(int sock_fd) {
+
+	int status;
+
+	restoring = 1;
+	status = apply_stream(sock_fd, AS_UPGRADE_TIMEOUT * 1000);
+	restoring = 0;
+
+	return status;
+
+}
+
+/*!
+
+	@brief Wall clock second a standby last heard from its primary.
+
+	The primary sends a heartbeat every AS_REPL_HEARTBEAT seconds,
+	so an event due by the second it was last heard from was run by
+	the primary, which fires events at the start of their second.
+
+*/
+time_t replica_last_heard(void) {
+
+	return last_heard;
+
+}
+
+/*!
+
+	@brief Check if this server is a standby following a primary.
+
+*/
+int replica_following(void) {
+
+	return following;
+
+}
+
+
+
+#endif /* REPLICA_C */
+
+
+
@@ -0,0 +1,72 @@
+/*!
+
+	@file replica.h
+	@brief Header file for replication of sessions to a standby server.
+
+*/
+
+
+
+#ifndef REPLICA_H
+#define REPLICA_H
+
+
+
+#include <time.h>
+
+
+
+/* Replicated events */
+#define REPL_RESET	0x00 /* Drop every session, a snapshot follows */
+#define REPL_OPEN	0x01 /* Open the session afresh */
+#define REPL_MARK	0x02 /* Mark number mark_seq of the session */
+#define REPL_LATE	0x03 /* Mark students late from now on */
+#define REPL_CLOSE	0x04 /* Close the session at tv_sec and tv_usec */
+#define REPL_COMMIT	0x05 /* The marks of the session were handed over */
+#define REPL_EXPIRE	0x06 /* Drop the session */
+#define REPL_SCHEDULE	0x07 /* Open, mark late and close at tv_sec, tv_sec + roll_number and tv_usec */
+#define REPL_SYNCED	0x08 /* End of the snapshot, events from seq + 1 follow */
+#define REPL_HEARTBEAT	0x09 /* Nothing happened for a while */
+#define REPL_EVENT	0x0A /* Scheduled event roll_number of the session is due at tv_sec */
+
+
+
+/*!
+
+	@brief An event in the replication stream.
+
+	Events after the snapshot are numbered consecutively, so a
+	standby notices any it missed. Snapshot events have seq 0.
+
+*/
+struct repl_msg {
+
+	int type;
+	int session_id;
+
+	long long seq;
+	long long mark_seq;
+
+	long long tv_sec;
+	long long tv_usec;
+
+	int roll_number;
+
+} __attribute__((packed));
+
+
+
+int replica_start(const char *standby_ip, int standby_port);
+void replica_log(int type, int session_id, long long mark_seq, int roll_number, long long tv_sec, long long tv_usec);
+int replica_follow(const char *port);
+int replica_following(void);
+time_t replica_last_heard(void);
+int replica_handoff(int sock_fd);
+int replica_restore(int sock_fd);
+
+
+
+#endif /* REPLICA_H */
+
+
+
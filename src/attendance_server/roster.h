@@ -0,0 +1,26 @@
+/*!
+
+	@file roster.h
+	@brief Header file for the enrollment roster.
+
+*/
+
+
+
+#ifndef ROSTER_H
+#define ROSTER_H
+
+
+
+int roster_load(const char *file_name);
+int roster_size(void);
+int roster_find(int roll_number);
+int roster_roll_number(int pos);
+void roster_free(void);
+
+
+
+#endif /* ROSTER_H */
+
+
+
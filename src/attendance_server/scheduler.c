@@ -0,0 +1,386 @@
+/*!
+
+	@file scheduler.c
+
+	@brief Timer wheel firing session events at their second.
+
+	Events are hashed by their time into SCHED_SLOTS slots of one
+	second each, so adding one is O(1) regardless of how far ahead
+	it is. A timerfd wakes the scheduler thread on every whole
+	second of the wall clock, and the thread fires the events of
+	that second's slot; events further ahead stay in the slot for a
+	later turn of the wheel. Seconds missed while the thread was not
+	scheduled are caught up.
+
+*/
+
+
+
+#ifndef SCHEDULER_C
+#define SCHEDULER_C
+
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <sys/timerfd.h>
+
+#include "scheduler.h"
+
+
+
+/// Events by slot, guarded by the wheel lock
+static struct sched_entry *slots[SCHED_SLOTS];
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Last second whose slot was fired
+static time_t last_tick;
+
+static sched_callback fire;
+static int timer_fd = -1;
+
+/// Set while events are held back, the fire lock is held while firing
+static int suspended;
+static pthread_mutex_t fire_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/*!
+
+	@brief Current second of the wall clock.
+
+	time() may read a coarse clock that still shows the previous
+	second right when the timer fires.
+
+*/
+static time_t wall_clock(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ts.tv_sec;
+
+}
+
+/*!
+
+	@brief Take the events due at a second out of its slot.
+
+	@return List of the due events.
+
+*/
+static struct sched_entry *take_due(time_t now) {
+
+	struct sched_entry **link, *due = NULL;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	link = &slots[now % SCHED_SLOTS];
+	while ( *link ) {
+
+		struct sched_entry *entry = *link;
+
+		if ( entry->when <= now ) {
+			*link = entry->next;
+			entry->next = due;
+			due = entry;
+		} else {
+			link = &entry->next;
+		}
+
+	}
+
+	last_tick = now;
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	return due;
+
+}
+
+/* Count the pending events of a session, taking them off the wheel if asked to */
+static int find_events(int session_id, unsigned events, int cancel) {
+
+	struct sched_entry **link, *entry;
+	int i, n_found = 0;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	for (i = 0; i < SCHED_SLOTS; i++)
+		for ( link = &slots[i]; (entry = *link); ) {
+
+			if ( entry->session_id != session_id || !(events & (1u << entry->event)) ) {
+				link = &entry->next;
+				continue;
+			}
+
+			n_found++;
+
+			if ( cancel ) {
+				*link = entry->next;
+				free(entry);
+			} else {
+				link = &entry->next;
+			}
+
+		}
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	return n_found;
+
+}
+
+static void *run_wheel(void *arg) {
+
+	(void)arg;
+
+	while ( 1 ) {
+
+		uint64_t n_expirations;
+		time_t now, tick;
+
+		if ( read(timer_fd, &n_expirations, sizeof(n_expirations)) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("scheduler: read() failed");
+			break;
+		}
+
+		pthread_mutex_lock(&fire_lock);
+
+		// Seconds passed while suspended are caught up once resumed
+		if ( suspended ) {
+			pthread_mutex_unlock(&fire_lock);
+			continue;
+		}
+
+		now = wall_clock();
+
+		// Catch up on missed seconds, up to a full turn of the wheel
+		tick = now - last_tick > SCHED_SLOTS ? now - SCHED_SLOTS : last_tick;
+
+		while ( tick < now ) {
+
+			struct sched_entry *due = take_due(++tick);
+
+			while ( due ) {
+				struct sched_entry *next = due->next;
+				fire(due->event, due->session_id, due->when);
+				free(due);
+				due = next;
+			}
+
+		}
+
+		pthread_mutex_unlock(&fire_lock);
+
+	}
+
+	return NULL;
+
+}
+
+/*!
+
+	@brief Start the scheduler thread.
+
+	@param cb Callback invoked for every event when it is due.
+	@return 0 on success, -1 on failure.
+
+*/
+int sched_start(sched_callback cb) {
+
+	struct itimerspec spec;
+	pthread_t thread;
+
+	fire = cb;
+	last_tick = wall_clock();
+
+	if ( (timer_fd = timerfd_create(CLOCK_REALTIME, 0)) < 0 ) {
+		perror("sched_start: timerfd_create() failed");
+		return -1;
+	}
+
+	// Tick on every whole second of the wall clock
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = last_tick + 1;
+	spec.it_interval.tv_sec = 1;
+
+	if ( timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0 ) {
+		perror("sched_start: timerfd_settime() failed");
+		close(timer_fd);
+		return -1;
+	}
+
+	if ( pthread_create(&thread, NULL, run_wheel, NULL) != 0 ) {
+		close(timer_fd);
+		return -1;
+	}
+	pthread_detach(thread);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Stop firing events.
+
+	Returns once no event is being fired. Events falling due while
+	suspended stay scheduled, to be fired once resumed, or by whoever
+	copies them with sched_copy().
+
+*/
+void sched_suspend(void) {
+
+	pthread_mutex_lock(&fire_lock);
+	suspended = 1;
+	pthread_mutex_unlock(&fire_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Fire events again after sched_suspend(), catching up on
+	those that fell due meanwhile.
+
+*/
+void sched_resume(void) {
+
+	pthread_mutex_lock(&fire_lock);
+	suspended = 0;
+	pthread_mutex_unlock(&fire_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Schedule an event.
+
+	An event due at or before the current second fires on the next
+	tick.
+
+	@param when Wall clock time of the event, in seconds.
+	@return 0 on success, -1 on failure.
+
+*/
+int sched_add(time_t when, int event, int session_id) {
+
+	struct sched_entry *entry;
+
+	if ( !(entry = (struct sched_entry*)malloc(sizeof(struct sched_entry))) ) {
+		printf("sched_add: Memory allocation failure.\n");
+		return -1;
+	}
+
+	entry->event = event;
+	entry->session_id = session_id;
+
+	entry->when = when;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	// Keeps the time it was due, for the callback
+	if ( when <= last_tick )
+		when = last_tick + 1;
+
+	entry->next = slots[when % SCHED_SLOTS];
+	slots[when % SCHED_SLOTS] = entry;
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Count the pending events of a session.
+
+	@param events Events to count, as a mask of 1 << event.
+	@return Number of events pending.
+
+*/
+int sched_pending(int session_id, unsigned events) {
+
+	return find_events(session_id, events, 0);
+
+}
+
+/*!
+
+	@brief Cancel the pending events of a session.
+
+	An event already being fired is not cancelled.
+
+	@param events Events to cancel, as a mask of 1 << event.
+	@return Number of events cancelled.
+
+*/
+int sched_cancel(int session_id, unsigned events) {
+
+	return find_events(session_id, events, 1);
+
+}
+
+/*!
+
+	@brief Copy the events still to fire.
+
+	@param entries Set to a list of copies of the pending events, to
+	be freed by the caller.
+	@return 0 on success, -1 on failure.
+
+*/
+int sched_copy(struct sched_entry **entries) {
+
+	struct sched_entry *entry, *copy;
+	int i;
+
+	*entries = NULL;
+
+	pthread_mutex_lock(&wheel_lock);
+
+	for (i = 0; i < SCHED_SLOTS; i++)
+		for ( entry = slots[i]; entry; entry = entry->next ) {
+
+			if ( !(copy = (struct sched_entry*)malloc(sizeof(struct sched_entry))) ) {
+				pthread_mutex_unlock(&wheel_lock);
+				printf("sched_copy: Memory allocation failure.\n");
+				for ( ; *entries; *entries = copy ) {
+					copy = (*entries)->next;
+					free(*entries);
+				}
+				return -1;
+			}
+
+			*copy = *entry;
+			copy->next = *entries;
+			*entries = copy;
+
+		}
+
+	pthread_mutex_unlock(&wheel_lock);
+
+	return 0;
+
+}
+
+
+
+#endif /* SCHEDULER_C */
+
+
+
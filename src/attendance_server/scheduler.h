@@ -0,0 +1,66 @@
+/*!
+
+	@file scheduler.h
+	@brief Header file for the session event scheduler.
+
+*/
+
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+
+
+#include <time.h>
+
+
+
+/// Slots of the timer wheel, one per second
+#define SCHED_SLOTS	4096
+
+
+
+/*!
+
+	@brief Callback function type for scheduled events.
+
+	Invoked from the scheduler thread with the event, session and
+	time given to sched_add, the time being when the event was due
+	rather than when it fired.
+
+*/
+typedef void (*sched_callback)(int event, int session_id, time_t when);
+
+/*!
+
+	@brief A scheduled event, in the slot of the second it fires at.
+
+*/
+struct sched_entry {
+
+	time_t when;
+
+	int event;
+	int session_id;
+
+	struct sched_entry *next;
+
+};
+
+
+
+int sched_start(sched_callback cb);
+void sched_suspend(void);
+void sched_resume(void);
+int sched_add(time_t when, int event, int session_id);
+int sched_pending(int session_id, unsigned events);
+int sched_cancel(int session_id, unsigned events);
+int sched_copy(struct sched_entry **entries);
+
+
+
+#endif /* SCHEDULER_H */
+
+
+
@@ -0,0 +1,1027 @@
+/*!
+
+	@file session.c
+
+	@brief Table of the attendance sessions served by as-server.
+
+	Each session has its own marks, journal and open or closed
+	state, so that several rooms or back-to-back lectures can be
+	served by one process. Closed sessions expire AS_SESSION_TTL
+	seconds after closing, or when an admin expires them, and their
+	memory and journal are reclaimed.
+
+*/
+
+
+
+#ifndef SESSION_C
+#define SESSION_C
+
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+#include "roster.h"
+#include "feed.h"
+#include "replica.h"
+#include "session.h"
+
+
+
+/// Sessions in the table, guarded by the table lock
+static struct session *sessions;
+static int n_sessions;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Set if marks are kept in roster bitmaps
+static int use_roster;
+
+/// Name of the journal of each session, by session ID
+static const char *journal_name = AS_JOURNAL_NAME;
+
+
+
+/*!
+
+	@brief State of session_foreach while walking the marks.
+
+*/
+struct session_walk {
+
+	session_callback cb;
+	void *cb_data;
+
+};
+
+
+
+static void journal_path(char *path, int len, int id) {
+
+	char name[64];
+
+	snprintf(name, sizeof(name), journal_name, id);
+	snprintf(path, len, "%s/%s", AS_JOURNAL_DIR, name);
+
+	return;
+
+}
+
+static int roll_stripe(int roll_number) {
+
+	// Roll numbers are mostly consecutive, so the low bits spread them well
+	return (unsigned)roll_number & (AS_MARK_STRIPES - 1);
+
+}
+
+static int roster_stripe(int pos) {
+
+	// Bits sharing a bitmap word must share a lock
+	return (pos / MARKMAP_WORD_BITS) & (AS_MARK_STRIPES - 1);
+
+}
+
+static void lock_all_stripes(struct session *session) {
+
+	int i;
+
+	for (i = 0; i < AS_MARK_STRIPES; i++)
+		pthread_mutex_lock(&session->stripe_locks[i]);
+
+	return;
+
+}
+
+static void unlock_all_stripes(struct session *session) {
+
+	int i;
+
+	for (i = AS_MARK_STRIPES - 1; i >= 0; i--)
+		pthread_mutex_unlock(&session->stripe_locks[i]);
+
+	return;
+
+}
+
+static void session_free(struct session *session) {
+
+	int i;
+
+	for (i = 0; i < AS_MARK_STRIPES; i++) {
+		if ( session->marked[i] )
+			markset_free(session->marked[i]);
+		pthread_mutex_destroy(&session->stripe_locks[i]);
+	}
+
+	if ( session->roster_marks )
+		markmap_free(session->roster_marks);
+	if ( session->journal )
+		journal_free(session->journal);
+	if ( session->log )
+		marklog_free(session->log);
+	pthread_mutex_destroy(&session->log_lock);
+
+	if ( session->anomaly )
+		anomaly_free(session->anomaly);
+
+	arecord_list_free(session->arecords);
+	pthread_mutex_destroy(&session->arecords_lock);
+
+	free(session);
+
+	return;
+
+}
+
+static struct session *session_new(int id) {
+
+	struct session *session;
+	int i;
+
+	if ( !(session = (struct session*)calloc(1, sizeof(struct session))) ) {
+		printf("session_new: Memory allocation failure.\n");
+		return NULL;
+	}
+
+	session->id = id;
+	session->open = 1;
+	session->refs = 1;
+
+	pthread_mutex_init(&session->arecords_lock, NULL);
+	pthread_mutex_init(&session->log_lock, NULL);
+	for (i = 0; i < AS_MARK_STRIPES; i++)
+		pthread_mutex_init(&session->stripe_locks[i], NULL);
+
+	if ( !(session->arecords = arecord_list_new()) ) {
+		free(session);
+		return NULL;
+	}
+
+	if ( !(session->log = marklog_new()) ) {
+		session_free(session);
+		return NULL;
+	}
+
+	if ( !(session->anomaly = anomaly_new()) ) {
+		session_free(session);
+		return NULL;
+	}
+
+	for (i = 0; i < AS_MARK_STRIPES; i++)
+		if ( !(session->marked[i] = markset_new()) ) {
+			session_free(session);
+			return NULL;
+		}
+
+	if ( use_roster && !(session->roster_marks = markmap_new(roster_size())) ) {
+		session_free(session);
+		return NULL;
+	}
+
+	return session;
+
+}
+
+static int open_journal(struct session *session) {
+
+	char path[256];
+
+	journal_path(path, sizeof(path), session->id);
+
+	if ( !(session->journal = journal_open(path)) )
+		return -1;
+
+	return 0;
+
+}
+
+static void unref(struct session *session) {
+
+	if ( --session->refs == 0 )
+		session_free(session);
+
+	return;
+
+}
+
+/* Called with the table lock held */
+static struct session *find(int id) {
+
+	struct session *session;
+
+	for ( session = sessions; session; session = session->next )
+		if ( session->id == id )
+			return session;
+
+	return NULL;
+
+}
+
+/* Called with the table lock held */
+static void insert(struct session *session) {
+
+	session->next = sessions;
+	sessions = session;
+	n_sessions++;
+
+	return;
+
+}
+
+/* Called with the table lock held */
+static void unlink_session(struct session *session) {
+
+	struct session **link;
+	char path[256];
+
+	for ( link = &sessions; *link; link = &(*link)->next )
+		if ( *link == session ) {
+			*link = session->next;
+			n_sessions--;
+			break;
+		}
+
+	journal_path(path, sizeof(path), session->id);
+	if ( unlink(path) < 0 && errno != ENOENT )
+		perror("unlink_session: unlink() failed");
+
+	unref(session);
+
+	return;
+
+}
+
+/* Called with the table lock held */
+static void sweep_expired(void) {
+
+	struct session *session, *next;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	for ( session = sessions; session; session = next ) {
+		next = session->next;
+		if ( !session->open && now.tv_sec - session->close_time.tv_sec >= AS_SESSION_TTL )
+			unlink_session(session);
+	}
+
+	return;
+
+}
+
+static int replay_event(int event, int roll_number, long long tv_sec, long long tv_usec, void *cb_data) {
+
+	struct session *session = (struct session*)cb_data;
+	struct timeval close_time;
+
+	if ( event == JOURNAL_MARK )
+		session_mark(session, roll_number, tv_sec, tv_usec);
+
+	if ( event == JOURNAL_LATE )
+		session_late(session);
+
+	if ( event == JOURNAL_CLOSE ) {
+		close_time.tv_sec = tv_sec;
+		close_time.tv_usec = tv_usec;
+		session_close_at(session, &close_time);
+	}
+
+	return 1;
+
+}
+
+static int walk_roster(int pos, long long tv_sec, long long tv_usec, void *cb_data) {
+
+	struct session_walk *walk = (struct session_walk*)cb_data;
+
+	return walk->cb(roster_roll_number(pos), tv_sec, tv_usec, walk->cb_data);
+
+}
+
+static int walk_list(struct arecord *record, void *cb_data) {
+
+	struct session_walk *walk = (struct session_walk*)cb_data;
+
+	return walk->cb(record->roll_number, record->tv_sec, record->tv_usec, walk->cb_data);
+
+}
+
+/*
+ * Number a new mark and journal it. Returns the journal sequence number
+ * to sync, 0 if there is no journal, or -1 on failure.
+ */
+static long long log_mark(struct session *session, int roll_number, long long tv_sec, long long tv_usec) {
+
+	long long seq = 0;
+
+	pthread_mutex_lock(&session->log_lock);
+
+	if ( marklog_append(session->log, roll_number, tv_sec, tv_usec) < 0 )
+		seq = -1;
+	else if ( session->journal && (seq = journal_append(session->journal, roll_number, tv_sec, tv_usec)) < 0 )
+		marklog_drop_last(session->log);
+	else
+		replica_log(REPL_MARK, session->id, session->log->n_marks, roll_number, tv_sec, tv_usec);
+
+	pthread_mutex_unlock(&session->log_lock);
+
+	return seq;
+
+}
+
+static void sync_mark(struct session *session, long long seq) {
+
+	if ( seq > 0 && journal_sync(session->journal, seq) < 0 )
+		printf("Warning, mark %lld of session %d may not survive a restart.\n", seq, session->id);
+
+	return;
+
+}
+
+/*
+ * Record a mark, leaving the journal to be synced up to seq, which is
+ * set to the sequence number of a new mark and left alone otherwise.
+ */
+static int record_mark(struct session *session, int roll_number, long long tv_sec, long long tv_usec, long long *seq) {
+
+	struct arecord *new_record = NULL;
+	int pos = 0, stripe, status = PRESENT;
+
+	if ( session->roster_marks ) {
+
+		if ( (pos = roster_find(roll_number)) < 0 )
+			// Not enrolled
+			return DENY;
+
+		stripe = roster_stripe(pos);
+
+	} else {
+
+		stripe = roll_stripe(roll_number);
+
+		// Allocate outside the lock, it is freed again if unused
+		if ( !(new_record = arecord_new()) )
+			return DENY;
+
+		new_record->tv_sec = tv_sec;
+		new_record->tv_usec = tv_usec;
+		new_record->roll_number = roll_number;
+
+	}
+
+	pthread_mutex_lock(&session->stripe_locks[stripe]);
+
+	if ( session->roster_marks ? markmap_test(session->roster_marks, pos)
+		: markset_contains(session->marked[stripe], roll_number) )
+		// Already recorded
+		status = PRESENT;
+	else if ( !session->open )
+		// Too late to be recorded, the marks were frozen for the admins at close
+		status = ABSENT;
+	else if ( !session->roster_marks && markset_reserve(session->marked[stripe]) < 0 )
+		// Only fallible step after logging, taken first so that a logged mark is always recorded
+		status = DENY;
+	else if ( (*seq = log_mark(session, roll_number, tv_sec, tv_usec)) < 0 )
+		status = DENY;
+	else if ( session->roster_marks ) {
+		markmap_set(session->roster_marks, pos, tv_sec, tv_usec);
+		status = session->late ? LATE : PRESENT;
+	} else {
+		markset_add(session->marked[stripe], roll_number);
+		pthread_mutex_lock(&session->arecords_lock);
+		arecord_list_insert(session->arecords, new_record);
+		pthread_mutex_unlock(&session->arecords_lock);
+		new_record = NULL;
+		status = session->late ? LATE : PRESENT;
+	}
+
+	pthread_mutex_unlock(&session->stripe_locks[stripe]);
+
+	free(new_record);
+
+	return status;
+
+}
+
+
+
+/*!
+
+	@brief Prepare the session table.
+
+	@param roster_mode Set if a roster is loaded and marks should be
+	kept in roster bitmaps.
+	@param standby Set on a standby, whose journals are kept apart
+	from those of a primary sharing the journal directory.
+
+*/
+void sessions_init(int roster_mode, int standby) {
+
+	use_roster = roster_mode;
+
+	if ( standby )
+		journal_name = AS_STANDBY_JOURNAL_NAME;
+
+	return;
+
+}
+
+/*!
+
+	@brief Recreate the sessions left unfinished by an earlier run.
+
+	Replays the journal of every session found in AS_JOURNAL_DIR,
+	discarding those of sessions that were ended. Sessions come back
+	late and closed as they were, with their closing time.
+
+	@return Number of sessions recovered, or -1 on failure.
+
+*/
+int sessions_recover(void) {
+
+	struct dirent *entry;
+	DIR *dir;
+	char format[64];
+	int n_recovered = 0;
+
+	snprintf(format, sizeof(format), "%s%%n", journal_name);
+
+	if ( !(dir = opendir(AS_JOURNAL_DIR)) ) {
+		perror("sessions_recover: opendir() failed");
+		return -1;
+	}
+
+	while ( (entry = readdir(dir)) ) {
+
+		struct session *session;
+		struct timeval start, end;
+		char path[256];
+		int id, n_matched = 0, n_marks;
+
+		if ( sscanf(entry->d_name, format, &id, &n_matched) != 1
+			|| n_matched == 0 || entry->d_name[n_matched] != '\0' )
+			continue;
+
+		journal_path(path, sizeof(path), id);
+
+		if ( !(session = session_new(id)) )
+			continue;
+
+		gettimeofday(&start, NULL);
+		n_marks = journal_replay(path, replay_event, session);
+		gettimeofday(&end, NULL);
+
+		if ( n_marks == JOURNAL_ENDED ) {
+			unlink(path);
+			session_free(session);
+			continue;
+		}
+
+		if ( n_marks < 0 || open_journal(session) < 0 ) {
+			session_free(session);
+			continue;
+		}
+
+		printf("Recovered %d marks of session %d from the journal in %.3f ms.\n", n_marks, id,
+			(end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) / 1e3);
+
+		pthread_mutex_lock(&table_lock);
+		insert(session);
+		pthread_mutex_unlock(&table_lock);
+
+		n_recovered++;
+
+	}
+
+	closedir(dir);
+
+	return n_recovered;
+
+}
+
+/*!
+
+	@brief Free every session.
+
+	Only safe once no other thread uses the sessions.
+
+*/
+void sessions_free(void) {
+
+	struct session *next;
+
+	pthread_mutex_lock(&table_lock);
+
+	for ( ; sessions; sessions = next ) {
+		next = sessions->next;
+		session_free(sessions);
+	}
+	n_sessions = 0;
+
+	pthread_mutex_unlock(&table_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Reclaim the sessions past their expiry.
+
+*/
+void sessions_sweep(void) {
+
+	pthread_mutex_lock(&table_lock);
+	sweep_expired();
+	pthread_mutex_unlock(&table_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief List the IDs of the sessions in the table.
+
+	@return Number of IDs stored, at most max_ids.
+
+*/
+int sessions_list(int *ids, int max_ids) {
+
+	struct session *session;
+	int n_ids = 0;
+
+	pthread_mutex_lock(&table_lock);
+
+	for ( session = sessions; session && n_ids < max_ids; session = session->next )
+		ids[n_ids++] = session->id;
+
+	pthread_mutex_unlock(&table_lock);
+
+	return n_ids;
+
+}
+
+/*!
+
+	@brief Open a new session.
+
+	A closed session with the same ID is replaced once its marks
+	were handed over. One whose marks were not has to be collected
+	or expired first, so that its marks are never dropped unseen.
+	Sessions past their expiry are reclaimed to make room.
+
+	@return The new session, referenced for the caller, or NULL if
+	a session with that ID is still open or holds marks not handed
+	over, the table is full or on failure.
+
+*/
+struct session *session_open(int id) {
+
+	struct session *session;
+
+	pthread_mutex_lock(&table_lock);
+
+	sweep_expired();
+
+	if ( (session = find(id)) ) {
+		if ( session->open ) {
+			pthread_mutex_unlock(&table_lock);
+			return NULL;
+		}
+		if ( !session->committed ) {
+			printf("session_open: Session %d was closed but its marks were not collected.\n", id);
+			pthread_mutex_unlock(&table_lock);
+			return NULL;
+		}
+		unlink_session(session);
+	}
+
+	if ( n_sessions >= AS_MAX_SESSIONS ) {
+		printf("session_open: Too many sessions.\n");
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+
+	if ( !(session = session_new(id)) ) {
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+
+	if ( open_journal(session) < 0 ) {
+		session_free(session);
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+
+	insert(session);
+	session->refs++;
+
+	replica_log(REPL_OPEN, id, 0, 0, 0, 0);
+
+	pthread_mutex_unlock(&table_lock);
+
+	return session;
+
+}
+
+/*!
+
+	@brief Recreate a session handed over by the server being upgraded.
+
+	The session has no journal until sessions_reopen_journals, so
+	its marks can be restored without writing them again.
+
+	@return The new session, referenced for the caller, or NULL if
+	a session with that ID exists, the table is full or on failure.
+
+*/
+struct session *session_restore(int id) {
+
+	struct session *session;
+
+	pthread_mutex_lock(&table_lock);
+
+	if ( find(id) || n_sessions >= AS_MAX_SESSIONS || !(session = session_new(id)) ) {
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+
+	insert(session);
+	session->refs++;
+
+	pthread_mutex_unlock(&table_lock);
+
+	return session;
+
+}
+
+/*!
+
+	@brief Resume the journals of the sessions restored by session_restore.
+
+	The journals already hold the restored marks, written by the
+	server that was upgraded, and are appended to from here on.
+
+	@return 0 on success, or -1 if a journal could not be opened.
+
+*/
+int sessions_reopen_journals(void) {
+
+	struct session *session;
+	int status = 0;
+
+	pthread_mutex_lock(&table_lock);
+
+	for ( session = sessions; session; session = session->next )
+		if ( !session->journal && open_journal(session) < 0 )
+			status = -1;
+
+	pthread_mutex_unlock(&table_lock);
+
+	return status;
+
+}
+
+/*!
+
+	@brief Look up a session.
+
+	@return The session, referenced for the caller, or NULL if there
+	is no session with that ID.
+
+*/
+struct session *session_get(int id) {
+
+	struct session *session;
+
+	pthread_mutex_lock(&table_lock);
+
+	if ( (session = find(id)) )
+		session->refs++;
+
+	pthread_mutex_unlock(&table_lock);
+
+	return session;
+
+}
+
+/*!
+
+	@brief Drop a reference taken by session_open or session_get.
+
+*/
+void session_put(struct session *session) {
+
+	pthread_mutex_lock(&table_lock);
+	unref(session);
+	pthread_mutex_unlock(&table_lock);
+
+	return;
+
+}
+
+/*!
+
+	@brief Remove a session from the table and delete its journal.
+
+	The session is freed once the last thread using it is done.
+
+	@return 0 on success, or -1 if there is no session with that ID.
+
+*/
+int session_expire(int id) {
+
+	struct session *session;
+
+	pthread_mutex_lock(&table_lock);
+
+	if ( !(session = find(id)) ) {
+		pthread_mutex_unlock(&table_lock);
+		return -1;
+	}
+
+	unlink_session(session);
+
+	replica_log(REPL_EXPIRE, id, 0, 0, 0, 0);
+
+	pthread_mutex_unlock(&table_lock);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Mark a student in a session.
+
+	The mark is journaled and on disk before this returns.
+
+	@return PRESENT if the student is marked, LATE if the student is
+	marked past the late threshold, ABSENT if the session is closed
+	and the student was not marked, or DENY if the student is not on
+	the roster or on failure.
+
+*/
+int session_mark(struct session *session, int roll_number, long long tv_sec, long long tv_usec) {
+
+	long long seq = 0;
+	int status = record_mark(session, roll_number, tv_sec, tv_usec, &seq);
+
+	// Reply only once the mark is on disk, syncing outside the stripe lock
+	sync_mark(session, seq);
+
+	// Push new marks to subscribers once they are on disk
+	if ( seq > 0 && status != DENY )
+		feed_publish(session->id, roll_number, tv_sec, tv_usec);
+
+	return status;
+
+}
+
+/*!
+
+	@brief Mark several students in a session.
+
+	The marks are journaled and on disk before this returns, with a
+	single sync of the journal for all of them.
+
+	@param n_marks Number of marks, at most AS_BATCH_RECORDS.
+	@param statuses Set to the status of each mark, as returned by
+	session_mark.
+
+*/
+void session_mark_batch(struct session *session, const struct markpack_mark *marks, int n_marks, int *statuses) {
+
+	int i, n_new = 0, new_marks[AS_BATCH_RECORDS];
+	long long seq, last_seq = 0;
+
+	for (i = 0; i < n_marks; i++) {
+
+		seq = 0;
+		statuses[i] = record_mark(session, marks[i].roll_number, marks[i].tv_sec, marks[i].tv_usec, &seq);
+
+		if ( seq > 0 && statuses[i] != DENY ) {
+			last_seq = seq;
+			new_marks[n_new++] = i;
+		}
+
+	}
+
+	// Syncing the last mark syncs those journaled before it
+	sync_mark(session, last_seq);
+
+	for (i = 0; i < n_new; i++)
+		feed_publish(session->id, marks[new_marks[i]].roll_number,
+			marks[new_marks[i]].tv_sec, marks[new_marks[i]].tv_usec);
+
+	return;
+
+}
+
+/*!
+
+	@brief Mark students late from now on.
+
+*/
+void session_late(struct session *session) {
+
+	struct timeval now;
+
+	lock_all_stripes(session);
+	session->late = 1;
+	unlock_all_stripes(session);
+
+	gettimeofday(&now, NULL);
+	if ( session->journal && journal_log_event(session->journal, JOURNAL_LATE, now.tv_sec, 0) < 0 )
+		printf("Warning, session %d may not mark students late after a restart.\n", session->id);
+
+	replica_log(REPL_LATE, session->id, 0, 0, 0, 0);
+
+	return;
+
+}
+
+/*!
+
+	@brief Stop recording marks in a session.
+
+	Closing again keeps the original closing time. Once closed, the
+	marks no longer change and can be read without locks.
+
+*/
+void session_close(struct session *session) {
+
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	session_close_at(session, &now);
+
+	return;
+
+}
+
+/*!
+
+	@brief Stop recording marks in a session, as of a given time.
+
+	Used by a standby to close a session when its primary did.
+
+*/
+void session_close_at(struct session *session, const struct timeval *close_time) {
+
+	int closed = 0;
+
+	lock_all_stripes(session);
+
+	if ( session->open ) {
+		session->open = 0;
+		session->close_time = *close_time;
+		closed = 1;
+	}
+
+	unlock_all_stripes(session);
+
+	if ( !closed )
+		return;
+
+	// Every mark accepted before the close was journaled and queued under a stripe lock
+	if ( session->journal && journal_log_event(session->journal, JOURNAL_CLOSE, close_time->tv_sec,
+		close_time->tv_usec) < 0 )
+		printf("Warning, session %d may be open again after a restart.\n", session->id);
+
+	replica_log(REPL_CLOSE, session->id, 0, 0, close_time->tv_sec, close_time->tv_usec);
+
+	return;
+
+}
+
+/*!
+
+	@brief Record that the marks of a closed session were handed over.
+
+	Ends the journal, so the session is not recovered on restart, and
+	lets session_open replace the session. A restored session has no
+	journal to end, the server it came from ended it.
+
+*/
+void session_commit(struct session *session) {
+
+	if ( session->journal && journal_end_session(session->journal) < 0 )
+		printf("Warning, the journal of session %d could not be ended, it will be replayed on restart.\n",
+			session->id);
+
+	pthread_mutex_lock(&table_lock);
+	session->committed = 1;
+	pthread_mutex_unlock(&table_lock);
+
+	replica_log(REPL_COMMIT, session->id, 0, 0, 0, 0);
+
+	return;
+
+}
+
+/*!
+
+	@brief Check if the marks of a closed session were handed over.
+
+*/
+int session_committed(struct session *session) {
+
+	int committed;
+
+	pthread_mutex_lock(&table_lock);
+	committed = session->committed;
+	pthread_mutex_unlock(&table_lock);
+
+	return committed;
+
+}
+
+/*!
+
+	@brief Number of marks in a closed session.
+
+*/
+int session_count(struct session *session) {
+
+	if ( session->roster_marks )
+		return markmap_count(session->roster_marks);
+
+	return session->arecords->n_arecords;
+
+}
+
+/*!
+
+	@brief Call cb on every mark in a closed session.
+
+	Marks are visited in roster order in roster mode, and in the
+	order they were accepted otherwise.
+
+	@return Sum of the return values of cb.
+
+*/
+int session_foreach(struct session *session, session_callback cb, void *cb_data) {
+
+	struct session_walk walk;
+
+	walk.cb = cb;
+	walk.cb_data = cb_data;
+
+	if ( session->roster_marks )
+		return markmap_foreach(session->roster_marks, walk_roster, &walk);
+
+	return arecord_list_foreach(session->arecords, walk_list, &walk);
+
+}
+/*!
+
+	@brief Sequence number of the last mark accepted in a session.
+
+*/
+long long session_last_seq(struct session *session) {
+
+	long long seq;
+
+	pthread_mutex_lock(&session->log_lock);
+	seq = session->log->n_marks;
+	pthread_mutex_unlock(&session->log_lock);
+
+	return seq;
+
+}
+
+/*!
+
+	@brief Copy the marks accepted after a sequence number.
+
+	Safe while the session is open. Marks are copied in sequence
+	order, the first one having sequence number after + 1.
+
+	@return Number of marks copied, at most max_marks, or -1 if fewer
+	than after marks were accepted.
+
+*/
+int session_read(struct session *session, long long after, struct markpack_mark *marks, int max_marks) {
+
+	int n_marks;
+
+	pthread_mutex_lock(&session->log_lock);
+	n_marks = marklog_read(session->log, after, marks, max_marks);
+	pthread_mutex_unlock(&session->log_lock);
+
+	return n_marks;
+
+}
+
+
+
+#endif /* SESSION_C */
+
+
+
@@ -0,0 +1,141 @@
+/*!
+
+	@file session.h
+	@brief Header file for the attendance session table.
+
+*/
+
+
+
+#ifndef SESSION_H
+#define SESSION_H
+
+
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "anomaly.h"
+#include "journal.h"
+#include "markmap.h"
+#include "marklog.h"
+#include "markset.h"
+#include "arecord_list.h"
+
+#include "attendance_server.h"
+
+
+
+/*!
+
+	@brief An attendance session and its marks.
+
+	Sessions are reference counted. The session table holds one
+	reference until the session expires, and every thread using a
+	session holds another, so an expired session is only freed once
+	nobody is using it.
+
+*/
+struct session {
+
+	int id;
+
+	/*
+	 * List of attendance records, in the order the marks were accepted.
+	 * Only used when no roster is loaded.
+	 */
+	struct arecord_list *arecords;
+	pthread_mutex_t arecords_lock;
+
+	/*
+	 * Roll numbers in the attendance records, for O(1) duplicate checks.
+	 * The table is split into stripes by roll number, each with its own
+	 * lock, so that workers marking different students rarely contend. A
+	 * mark is checked and added under its stripe lock and appended to the
+	 * list before that lock is released, so each roll number is recorded
+	 * exactly once and the list order matches the order of acceptance.
+	 */
+	struct markset *marked[AS_MARK_STRIPES];
+	pthread_mutex_t stripe_locks[AS_MARK_STRIPES];
+
+	/// Marks of students on the roster, used instead of the list in roster mode
+	struct markmap *roster_marks;
+
+	/// Journal of accepted marks, replayed if the server restarts mid-session
+	struct journal *journal;
+
+	/*
+	 * Marks numbered in the order they were accepted, for admins pulling
+	 * marks while the session is open. Marks are journaled under the same
+	 * lock, so the journal holds them in sequence order and replaying it
+	 * gives every mark its sequence number again.
+	 */
+	struct marklog *log;
+	pthread_mutex_t log_lock;
+
+	/// Detectors of proxy marking, fed every mark attempt made by a student
+	struct anomaly *anomaly;
+
+	/*
+	 * Flag indicating if attendances are still being recorded, and the
+	 * time the session was closed. Both only change with every stripe
+	 * lock held, after which the marks are frozen and can be read without
+	 * locks.
+	 */
+	int open;
+	struct timeval close_time;
+
+	/// Set once marks are past the late threshold, changed like the open flag
+	int late;
+
+	/// Set once the marks of the closed session were handed over, guarded by the table lock
+	int committed;
+
+	/// References held, guarded by the table lock
+	int refs;
+
+	/// Next session in the table
+	struct session *next;
+
+};
+
+/*!
+
+	@brief Callback function type for session_foreach.
+
+*/
+typedef int (*session_callback)(int roll_number, long long tv_sec, long long tv_usec, void *cb_data);
+
+
+
+void sessions_init(int roster_mode, int standby);
+int sessions_recover(void);
+void sessions_free(void);
+void sessions_sweep(void);
+int sessions_list(int *ids, int max_ids);
+
+struct session *session_open(int id);
+struct session *session_restore(int id);
+int sessions_reopen_journals(void);
+struct session *session_get(int id);
+void session_put(struct session *session);
+int session_expire(int id);
+
+int session_mark(struct session *session, int roll_number, long long tv_sec, long long tv_usec);
+void session_mark_batch(struct session *session, const struct markpack_mark *marks, int n_marks, int *statuses);
+void session_late(struct session *session);
+void session_close(struct session *session);
+void session_close_at(struct session *session, const struct timeval *close_time);
+void session_commit(struct session *session);
+int session_committed(struct session *session);
+int session_count(struct session *session);
+int session_foreach(struct session *session, session_callback cb, void *cb_data);
+long long session_last_seq(struct session *session);
+int session_read(struct session *session, long long after, struct markpack_mark *marks, int max_marks);
+
+
+
+#endif /* SESSION_H */
+
+
+
@@ -0,0 +1,75 @@
+/*!
+
+	@file sockio.h
+	@brief Header file for socket I/O with deadlines.
+
+*/
+
+
+
+#ifndef SOCKIO_H
+#define SOCKIO_H
+
+
+
+#include <sys/uio.h>
+
+
+
+/* Results of transfers, besides 0 on success */
+#define SOCKIO_ERROR	-1 /* The connection failed */
+#define SOCKIO_EOF	-2 /* The peer closed the connection */
+#define SOCKIO_TIMEOUT	-3 /* The deadline passed before the transfer was done */
+
+/// Timeout of transfers that may wait forever
+#define SOCKIO_NO_TIMEOUT	-1
+
+
+
+/*!
+
+	@brief A message received a piece at a time with sockio_recv_part.
+
+	Zero it before the first piece. The deadline is set when the
+	first piece arrives.
+
+*/
+struct sockio_part {
+
+	int n_received;
+	long long deadline;
+
+};
+
+/*!
+
+	@brief Counts of transfers that failed, since the process started.
+
+*/
+struct sockio_stats {
+
+	long long n_timeouts;
+
+	/// Peers that closed the connection, and those of them that did so mid-message
+	long long n_eofs;
+	long long n_truncated;
+
+	long long n_errors;
+
+};
+
+
+
+int sockio_recv(int sock_fd, void *buf, int len, int timeout_ms);
+int sockio_send(int sock_fd, const void *buf, int len, int timeout_ms);
+int sockio_sendv(int sock_fd, struct iovec *iov, int iov_len, int timeout_ms);
+int sockio_recv_part(int sock_fd, void *buf, int len, struct sockio_part *part, int timeout_ms);
+int sockio_part_left(const struct sockio_part *part);
+void sockio_stats(struct sockio_stats *stats);
+
+
+
+#endif /* SOCKIO_H */
+
+
+
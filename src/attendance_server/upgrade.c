@@ -0,0 +1,300 @@
+/*!
+
+	@file upgrade.c
+
+	@brief Handing as-server over to a new binary without downtime.
+
+	A running server listens on a unix socket named after its port.
+	A new binary started with -u connects to it. The running server
+	then stops accepting connections, serves those it already took,
+	and passes its listening socket to the new binary with
+	SCM_RIGHTS, followed by a snapshot of its sessions. Connections
+	arriving meanwhile wait in the listening socket's backlog, which
+	both processes share, so none is refused. The running server
+	exits once the new binary says it is serving, and carries on
+	serving if the handover fails.
+
+	The new binary restores the marks from the snapshot without
+	journaling them again, and then appends to the journals the
+	running server wrote.
+
+*/
+
+
+
+#ifndef UPGRADE_C
+#define UPGRADE_C
+
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "upgrade.h"
+#include "replica.h"
+#include "session.h"
+
+#include "attendance_server.h"
+
+
+
+static void upgrade_path(struct sockaddr_un *addr, const char *port) {
+
+	char name[64];
+
+	snprintf(name, sizeof(name), AS_UPGRADE_NAME, port);
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", AS_JOURNAL_DIR, name);
+
+	return;
+
+}
+
+static void set_timeouts(int sock_fd) {
+
+	struct timeval timeout;
+
+	timeout.tv_sec = AS_UPGRADE_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	return;
+
+}
+
+static int send_fd(int sock_fd, int fd) {
+
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte = 0, control[CMSG_SPACE(sizeof(int))];
+
+	// A byte of data has to go along with the descriptor
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if ( sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != 1 ) {
+		perror("upgrade: sendmsg() failed");
+		return -1;
+	}
+
+	return 0;
+
+}
+
+static int recv_fd(int sock_fd) {
+
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte, control[CMSG_SPACE(sizeof(int))];
+	ssize_t n_received;
+	int fd;
+
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if ( (n_received = recvmsg(sock_fd, &msg, 0)) != 1 ) {
+		if ( n_received == 0 )
+			printf("The running server turned the handover down.\n");
+		else
+			perror("upgrade: recvmsg() failed");
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ( !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS )
+		return -1;
+
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return fd;
+
+}
+
+/*!
+
+	@brief Listen for a new binary taking over the server on a port.
+
+	@return Socket that turns readable when a new binary connects, or
+	-1 if upgrades are not possible.
+
+*/
+int upgrade_listen(const char *port) {
+
+	struct sockaddr_un addr;
+	int upgrade_fd;
+
+	upgrade_path(&addr, port);
+
+	if ( (upgrade_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+		perror("upgrade_listen: socket() failed");
+		return -1;
+	}
+
+	// The socket left by the server we took over from, or by one that crashed
+	unlink(addr.sun_path);
+
+	if ( bind(upgrade_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(upgrade_fd, 1) < 0 ) {
+		perror("upgrade_listen: bind() failed");
+		close(upgrade_fd);
+		return -1;
+	}
+
+	return upgrade_fd;
+
+}
+
+/*!
+
+	@brief Hand the server over to the new binary that connected.
+
+	Call once no connections are being served.
+
+	@return 0 once the new binary is serving, or -1 if the handover
+	failed and this server should carry on.
+
+*/
+int upgrade_handoff(int upgrade_fd, int server_sockfd) {
+
+	int conn_fd;
+	char ready;
+
+	if ( (conn_fd = accept(upgrade_fd, NULL, NULL)) < 0 ) {
+		perror("upgrade_handoff: accept() failed");
+		return -1;
+	}
+
+	set_timeouts(conn_fd);
+
+	if ( send_fd(conn_fd, server_sockfd) < 0 || replica_handoff(conn_fd) < 0
+		|| recv(conn_fd, &ready, 1, 0) != 1 ) {
+		close(conn_fd);
+		return -1;
+	}
+
+	close(conn_fd);
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Turn away the new binary that connected, which then gives up.
+
+*/
+void upgrade_refuse(int upgrade_fd) {
+
+	int conn_fd;
+
+	if ( (conn_fd = accept(upgrade_fd, NULL, NULL)) < 0 ) {
+		perror("upgrade_refuse: accept() failed");
+		return;
+	}
+
+	close(conn_fd);
+
+	return;
+
+}
+
+/*!
+
+	@brief Take over from the server running on a port.
+
+	@param conn_fd Set to the connection to the running server, to be
+	passed to upgrade_ready once serving.
+	@return The listening socket of the running server, with its
+	sessions restored, or -1 on failure.
+
+*/
+int upgrade_take(const char *port, int *conn_fd) {
+
+	struct sockaddr_un addr;
+	int sock_fd, server_sockfd;
+
+	upgrade_path(&addr, port);
+
+	if ( (sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+		perror("upgrade_take: socket() failed");
+		return -1;
+	}
+
+	if ( connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ) {
+		printf("No server to take over from on port %s.\n", port);
+		close(sock_fd);
+		return -1;
+	}
+
+	set_timeouts(sock_fd);
+
+	if ( (server_sockfd = recv_fd(sock_fd)) < 0 ) {
+		close(sock_fd);
+		return -1;
+	}
+
+	if ( replica_restore(sock_fd) < 0 || sessions_reopen_journals() < 0 ) {
+		printf("Failed to restore the sessions of the running server.\n");
+		close(server_sockfd);
+		close(sock_fd);
+		return -1;
+	}
+
+	*conn_fd = sock_fd;
+
+	return server_sockfd;
+
+}
+
+/*!
+
+	@brief Tell the server taken over from that we are serving.
+
+*/
+void upgrade_ready(int conn_fd) {
+
+	char ready = 1;
+
+	if ( send(conn_fd, &ready, 1, MSG_NOSIGNAL) != 1 )
+		perror("upgrade_ready: send() failed");
+
+	close(conn_fd);
+
+	return;
+
+}
+
+
+
+#endif /* UPGRADE_C */
+
+
+
@@ -0,0 +1,26 @@
+/*!
+
+	@file upgrade.h
+	@brief Header file for handing as-server over to a new binary.
+
+*/
+
+
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+
+
+int upgrade_listen(const char *port);
+int upgrade_handoff(int upgrade_fd, int server_sockfd);
+void upgrade_refuse(int upgrade_fd);
+int upgrade_take(const char *port, int *conn_fd);
+void upgrade_ready(int conn_fd);
+
+
+
+#endif /* UPGRADE_H */
+
+
+
@@ -0,0 +1,284 @@
+/*!
+
+	@file archive.c
+
+	@brief Attendance archives in the checksummed segment format.
+
+	Each record is stored as its roll number, the seconds of its
+	timestamp and the microseconds of its timestamp, all in network
+	byte order, in segments of up to SEGMENT_MAX_RECORDS records
+	keyed by roll number.
+
+*/
+
+
+
+#ifndef ARCHIVE_C
+#define ARCHIVE_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "segment.h"
+#include "arecord_list.h"
+#include "archive.h"
+
+
+
+/// Size of an encoded record
+#define ARCHIVE_RECORD_LEN 16
+
+
+
+/*!
+
+	@brief State of archive_save while packing records into
+	segments.
+
+*/
+struct archive_encoder {
+
+	unsigned char *buf;
+	int len;
+
+	/// Offset of the segment being filled
+	int segment_start;
+
+	/// Records in the segment being filled and their key range
+	int n_records;
+	int min_key;
+	int max_key;
+
+};
+
+
+
+static void seal_segment(struct archive_encoder *encoder) {
+
+	unsigned payload_len;
+
+	if ( encoder->n_records == 0 )
+		return;
+
+	payload_len = encoder->len - encoder->segment_start - sizeof(struct segment_hdr);
+	segment_seal(encoder->buf + encoder->segment_start, payload_len,
+		encoder->n_records, encoder->min_key, encoder->max_key);
+
+	encoder->segment_start = encoder->len;
+	encoder->n_records = 0;
+
+	return;
+
+}
+
+static int encode_arecord(struct arecord *arecord, void *cb_data) {
+
+	int roll_number, tv_usec;
+	long long tv_sec;
+	struct archive_encoder *encoder = (struct archive_encoder*)cb_data;
+	unsigned char *record;
+
+	if ( encoder->n_records == 0 ) {
+		encoder->len += sizeof(struct segment_hdr);
+		encoder->min_key = encoder->max_key = arecord->roll_number;
+	}
+
+	record = encoder->buf + encoder->len;
+	roll_number = htonl(arecord->roll_number);
+	tv_sec = htobe64(arecord->tv_sec);
+	tv_usec = htonl((int)arecord->tv_usec);
+	memcpy(record, &roll_number, 4);
+	memcpy(record + 4, &tv_sec, 8);
+	memcpy(record + 12, &tv_usec, 4);
+	encoder->len += ARCHIVE_RECORD_LEN;
+
+	if ( arecord->roll_number < encoder->min_key )
+		encoder->min_key = arecord->roll_number;
+	if ( arecord->roll_number > encoder->max_key )
+		encoder->max_key = arecord->roll_number;
+
+	if ( ++encoder->n_records == SEGMENT_MAX_RECORDS )
+		seal_segment(encoder);
+
+	return 1;
+
+}
+
+static int decode_arecords(const struct segment *segment, void *out) {
+
+	unsigned i;
+	struct arecord_list *list;
+
+	if ( segment->hdr.payload_len != segment->hdr.n_records * ARCHIVE_RECORD_LEN )
+		return -1;
+
+	if ( !(list = arecord_list_new()) )
+		return -1;
+
+	for ( i = 0; i < segment->hdr.n_records; i++ ) {
+
+		int roll_number, tv_usec;
+		long long tv_sec;
+		struct arecord *arecord;
+		const unsigned char *record = segment->payload + i * ARCHIVE_RECORD_LEN;
+
+		if ( !(arecord = arecord_new()) ) {
+			arecord_list_free(list);
+			return -1;
+		}
+
+		memcpy(&roll_number, record, 4);
+		memcpy(&tv_sec, record + 4, 8);
+		memcpy(&tv_usec, record + 12, 4);
+		arecord->roll_number = ntohl(roll_number);
+		arecord->tv_sec = be64toh(tv_sec);
+		arecord->tv_usec = ntohl(tv_usec);
+
+		arecord_list_insert(list, arecord);
+
+	}
+
+	*(struct arecord_list**)out = list;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Write a list of attendance records to an archive.
+
+	The archive is written under a temporary name and renamed into
+	place once complete.
+
+	@param list Pointer to an arecord_list struct
+	@param file_name C string containing absolute or relative path
+	to the archive.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int archive_save(struct arecord_list *list, const char *file_name) {
+
+	FILE *fd;
+	int n_segments, ret;
+	char tmp_file[256];
+	struct archive_encoder encoder;
+
+	n_segments = (list->n_arecords + SEGMENT_MAX_RECORDS - 1) / SEGMENT_MAX_RECORDS;
+
+	memset(&encoder, 0, sizeof(encoder));
+	encoder.buf = (unsigned char*)malloc(n_segments * sizeof(struct segment_hdr) +
+		list->n_arecords * ARCHIVE_RECORD_LEN + 1);
+	if ( !encoder.buf ) {
+		printf("archive_save: Memory allocation failure.\n");
+		return -1;
+	}
+
+	arecord_list_foreach(list, encode_arecord, &encoder);
+	seal_segment(&encoder);
+
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", file_name);
+
+	ret = 0;
+	if ( !(fd = fopen(tmp_file, "wb")) ||
+		fwrite(encoder.buf, 1, encoder.len, fd) != (size_t)encoder.len ) {
+		printf("Failed to write file \"%s\"\n", tmp_file);
+		ret = -1;
+	}
+	if ( fd && fclose(fd) != 0 )
+		ret = -1;
+
+	if ( ret == 0 && rename(tmp_file, file_name) < 0 )
+		ret = -1;
+
+	free(encoder.buf);
+
+	return ret;
+
+}
+
+/*!
+
+	@brief Allocate memory for an arecord list and initialize from
+	an archive.
+
+	Segments are verified and decoded in parallel. Damaged segments
+	are reported and skipped.
+
+	@param file_name C string containing absolute or relative path
+	to the archive.
+
+	@return Pointer to created arecord_list, or NULL on failure.
+
+*/
+struct arecord_list *archive_load(const char *file_name) {
+
+	int i, n_valid;
+	struct segment_file file;
+	struct arecord_list *list, **lists;
+
+	if ( segment_file_open(file_name, &file) < 0 )
+		return NULL;
+
+	if ( !(list = arecord_list_new()) ) {
+		segment_file_close(&file);
+		return NULL;
+	}
+
+	if ( file.n_segments == 0 ) {
+		segment_file_close(&file);
+		return list;
+	}
+
+	if ( !(lists = (struct arecord_list**)calloc(file.n_segments, sizeof(*lists))) ) {
+		printf("archive_load: Memory allocation failure.\n");
+		segment_file_close(&file);
+		arecord_list_free(list);
+		return NULL;
+	}
+
+	n_valid = segment_file_decode(&file, decode_arecords, lists, sizeof(*lists));
+	if ( n_valid < file.n_segments || file.n_skipped )
+		printf("Skipped %d damaged segments (%ld stray bytes) in \"%s\"\n",
+			file.n_segments - n_valid, file.n_skipped, file_name);
+
+	/* Chain the segments back together in file order */
+	for ( i = 0; i < file.n_segments; i++ ) {
+
+		if ( !lists[i] || lists[i]->n_arecords == 0 ) {
+			if ( lists[i] )
+				arecord_list_free(lists[i]);
+			continue;
+		}
+
+		if ( list->n_arecords == 0 )
+			list->head = lists[i]->head;
+		else
+			list->tail->next = lists[i]->head;
+		list->tail = lists[i]->tail;
+		list->n_arecords += lists[i]->n_arecords;
+
+		free(lists[i]);
+
+	}
+
+	free(lists);
+	segment_file_close(&file);
+
+	return list;
+
+}
+
+
+
+#endif /* ARCHIVE_C */
+
+
+
@@ -0,0 +1,27 @@
+/*!
+
+	@file archive.h
+	@brief Header file for attendance archives in the segment format.
+
+*/
+
+
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+
+
+#include "arecord_list.h"
+
+
+
+int archive_save(struct arecord_list *list, const char *file_name);
+struct arecord_list *archive_load(const char *file_name);
+
+
+
+#endif /* ARCHIVE_H */
+
+
+
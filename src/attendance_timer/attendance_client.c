@@ -5,12 +5,31 @@
 #define ATTENDANCE_CLIENT_C
 
 /* Configuration */
-#define AUTH_KEY	0x13243546
+#define AUTH_KEY		0x13243546
+#define AS_BATCH_RECORDS	256	/* Most records in a DATA_BATCH frame */
+#define AS_RETRY_BUDGET		30	/* Seconds a mark is retried while the server is busy */
+#define AS_BACKOFF_START	50	/* Milliseconds of the first backoff, doubled on every retry */
+#define AS_MARK_TIMEOUT		5	/* Seconds the server may take to answer a mark */
+#define AS_IO_TIMEOUT		30	/* Seconds the server may take over each message of other requests */
 
 /* Operation codes */
 #define OP_MARK		0x00 /* Mark someone's attendance */
 #define OP_CLOSE	0x01 /* Close the attendance server */
 #define OP_AUTH		0x02 /* Verify the challenge response for authentication */
+#define OP_OPEN		0x03 /* Open a new session */
+#define OP_EXPIRE	0x04 /* Drop a session and its records */
+#define OP_SCHEDULE	0x05 /* Open, mark late and close a session at tv_sec, tv_sec + roll_number and tv_usec, replacing any earlier schedule */
+#define OP_SYNC		0x06 /* Stream the marks after sequence number tv_sec, leaving the session open */
+#define OP_MARK_MAC	0x07 /* Mark the student a device is registered to, followed by struct as_msg_mac */
+#define OP_INVALIDATE	0x08 /* Fetch the registered devices again before the next OP_MARK_MAC */
+#define OP_SUBSCRIBE	0x09 /* Stream the marks of a session as they are accepted, until the admin disconnects */
+#define OP_EXPORT	0x0A /* Stream the marks of a session accepted so far, leaving the session open */
+#define OP_MARK_BATCH	0x0B /* Mark roll_number students, sent as struct as_msg_data after authenticating, a zero time is now */
+
+/* Flags of OP_CLOSE, OP_SYNC, OP_SUBSCRIBE and OP_EXPORT, in the response field */
+#define CLOSE_BATCH	0x01 /* Stream records in DATA_BATCH frames */
+#define CLOSE_COMPACT	0x02 /* Stream records in DATA_COMPACT frames */
+#define SUBSCRIBE_ANOMALIES	0x04 /* Stream the anomalies flagged in the session instead of its marks, OP_SUBSCRIBE only */
 
 /* Response codes */
 #define PRESENT		0x00 /* Marked present */
@@ -21,14 +40,23 @@
 #define TIME		0x05 /* Sent the current time for synchronization */
 #define DATA		0x06 /* Payload contains data */
 #define END_DATA	0x07 /* End of data stream - no data in the payload */
+#define DATA_BATCH	0x08 /* Followed by roll_number records as struct as_msg_data */
+#define DATA_COMPACT	0x09 /* Followed by roll_number records packed in tv_sec bytes, tv_usec is their CRC-32 */
+#define DONE		0x0A /* The requested operation succeeded */
+#define UNREGISTERED	0x0B /* The device is not registered */
+#define BUSY		0x0C /* Overloaded, retry after tv_sec seconds and tv_usec microseconds */
+#define ANOMALY		0x0D /* Anomaly chal raised by a mark of roll_number at tv_sec and tv_usec, followed by struct as_msg_mac */
+#define BAD_REQUEST	0x0E /* The request carried a time out of range */
 
 
 
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
+#include <endian.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
@@ -36,6 +64,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include "sockio.h"
+#include "markpack.h"
 #include "arecord_list.h"
 #include "attendance_client.h"
 
@@ -68,6 +98,12 @@ struct as_msg_data {
 
 } __attribute__((packed));
 
+struct as_msg_mac {
+
+	unsigned char mac_addr[6];
+
+} __attribute__((packed));
+
 struct as_msg {
 
 	union {
@@ -89,29 +125,56 @@ struct as_msg {
 
 	int roll_number;
 
+	int session_id;
+
 } __attribute__((packed));
 
 
 
 static unsigned compute_resp(unsigned challenge);
+static int mark_status(int status);
+static int send_mark(char *client_ip, char *server_ip, int server_port, char *send_buf, int send_len);
+static int mark_batch(char *client_ip, char *server_ip, int server_port, int session_id,
+	struct as_batch_entry *entries, int n_entries);
 static struct timeval correct_tv(struct timeval tv, struct timeval bad_tv, struct timeval good_tv);
+static int add_record(struct arecord_list *list, int roll_number, long long tv_sec, long long tv_usec,
+	struct timeval as_tv, struct timeval ref_tv);
+static int recv_batch(int sock_fd, int n_records, struct arecord_list *list,
+	struct timeval as_tv, struct timeval ref_tv);
+static int recv_compact(int sock_fd, struct as_msg *hdr, struct arecord_list *list,
+	struct timeval as_tv, struct timeval ref_tv);
+static int recv_stream(int sock_fd, struct arecord_list *list, struct timeval as_tv, struct timeval ref_tv,
+	struct as_msg *end);
 static int ipport2addr(char *ip, int port, struct sockaddr_in *addr);
+static int as_connect(char *client_ip, char *server_ip, int server_port);
+static int as_authenticate(int conn_sockfd, struct as_msg *request, void *payload, int payload_len);
+static int as_admin_request(char *client_ip, char *server_ip, int server_port, struct as_msg *request);
+static int as_pull_marks(char *client_ip, char *server_ip, int server_port, int op_code, int session_id,
+	long long *cursor, struct arecord_list *list);
 static int client_socket_new(const char *ip);
 static void htonmsg(struct as_msg *msg);
 static void ntohmsg(struct as_msg *msg);
-static int recv_data(int sock_fd, char *recv_buf, int recv_len);
-static int send_data(int sock_fd, char *send_buf, int send_len);
-static int recv_msg(int sock_fd, struct as_msg *msg);
-static int send_msg(int sock_fd, struct as_msg *msg);
+static int recv_msg(int sock_fd, struct as_msg *msg, int timeout);
+static int send_msg(int sock_fd, struct as_msg *msg, int timeout);
 
 
 
 int as_mark_attendance(char *client_ip, char *server_ip, int server_port, int roll_number) {
 
-	int conn_sockfd;
+	return as_mark_session(client_ip, server_ip, server_port, AS_DEFAULT_SESSION, roll_number);
+
+}
+
+int as_close_attendance(char *client_ip, char *server_ip, int server_port, struct arecord_list *list) {
+
+	return as_close_session(client_ip, server_ip, server_port, AS_DEFAULT_SESSION, list);
+
+}
+
+int as_mark_session(char *client_ip, char *server_ip, int server_port, int session_id, int roll_number) {
+
 	struct timeval tv;
 	struct as_msg msg;
-	struct sockaddr_in server_addr;
 
 	gettimeofday(&tv, NULL);
 
@@ -120,139 +183,358 @@ int as_mark_attendance(char *client_ip, char *server_ip, int server_port, int ro
 	msg.tv_sec = tv.tv_sec;
 	msg.tv_usec = tv.tv_usec;
 	msg.roll_number = roll_number;
+	msg.session_id = session_id;
 
-	if ( (conn_sockfd = client_socket_new(client_ip)) < 0 )
-		return AS_CONN_FAILED;
+	htonmsg(&msg);
 
-	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 )
-		return AS_CONN_FAILED;
+	return send_mark(client_ip, server_ip, server_port, (char*)&msg, sizeof(msg));
 
-	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
-		perror("connect() failed");
-		return AS_CONN_FAILED;
-	}
+}
 
-	if ( send_msg(conn_sockfd, &msg) < 0 )
-		return AS_CONN_FAILED;
+/*
+ * Mark the student a device is registered to, in a single round trip:
+ * the server resolves the MAC address itself. A nonzero roll number is
+ * checked against the one the device is registered to.
+ */
+int as_mark_by_mac(char *client_ip, char *server_ip, int server_port, int session_id,
+	unsigned char *mac_addr, int roll_number) {
 
-	if ( recv_msg(conn_sockfd, &msg) < 0 )
-		return AS_CONN_FAILED;
+	struct timeval tv;
+	struct as_msg msg;
+	char send_buf[sizeof(struct as_msg) + sizeof(struct as_msg_mac)];
 
-	close(conn_sockfd);
+	gettimeofday(&tv, NULL);
 
-	switch ( msg.reply.status ) {
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_MARK_MAC;
+	msg.tv_sec = tv.tv_sec;
+	msg.tv_usec = tv.tv_usec;
+	msg.roll_number = roll_number;
+	msg.session_id = session_id;
 
-		case PRESENT:
-			return AS_PRESENT;
+	// The MAC address follows the message in the same send
+	htonmsg(&msg);
+	memcpy(send_buf, &msg, sizeof(msg));
+	memcpy(send_buf + sizeof(msg), mac_addr, sizeof(struct as_msg_mac));
 
-		case ABSENT:
-			return AS_ABSENT;
+	return send_mark(client_ip, server_ip, server_port, send_buf, sizeof(send_buf));
 
-		case LATE:
-			return AS_LATE;
+}
 
-		case DENY:
-			return AS_REQ_DENIED;
+/*
+ * Have the server fetch the registered devices again, after a device
+ * was registered or the registry restored.
+ */
+int as_invalidate_identities(char *client_ip, char *server_ip, int server_port) {
 
-		default:
-			/*
-			 * If the status code was not understood
-			 * assume this was a connection fault...
-			 */
-			return AS_CONN_FAILED;
+	int conn_sockfd;
+	struct as_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_INVALIDATE;
 
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+		return AS_CONN_FAILED;
+
+	if ( send_msg(conn_sockfd, &msg, AS_IO_TIMEOUT) < 0 || recv_msg(conn_sockfd, &msg, AS_IO_TIMEOUT) < 0 ) {
+		close(conn_sockfd);
+		return AS_CONN_FAILED;
 	}
 
+	close(conn_sockfd);
+
+	return msg.reply.status == DONE ? AS_SUCCESS : AS_CONN_FAILED;
+
 }
 
-int as_close_attendance(char *client_ip, char *server_ip, int server_port, struct arecord_list *list) {
+int as_close_session(char *client_ip, char *server_ip, int server_port, int session_id, struct arecord_list *list) {
 
-	int conn_sockfd;
+	int status, conn_sockfd;
 	struct as_msg msg;
-	unsigned chal, resp;
 	struct timeval ref_tv, as_tv;
-	struct sockaddr_in server_addr;
 
 	arecord_list_empty(list);
 
-	if ( (conn_sockfd = client_socket_new(client_ip)) < 0 )
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
 		return AS_CONN_FAILED;
 
-	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 )
-		return AS_CONN_FAILED;
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_CLOSE;
+	msg.request.resp = CLOSE_BATCH | CLOSE_COMPACT;
+	msg.session_id = session_id;
 
-	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
-		perror("connect() failed");
-		return AS_CONN_FAILED;
+	if ( (status = as_authenticate(conn_sockfd, &msg, NULL, 0)) != AS_SUCCESS ) {
+		close(conn_sockfd);
+		return status;
 	}
 
-	memset(&msg, 0, sizeof(msg));
-	msg.request.op_code = OP_CLOSE;
+	gettimeofday(&ref_tv, NULL);
 
-	if ( send_msg(conn_sockfd, &msg) < 0 )
-		return AS_CONN_FAILED;
+	if ( msg.reply.status != TIME ) {
+		close(conn_sockfd);
+		return AS_AUTH_FAILED;
+	}
 
-	if ( recv_msg(conn_sockfd, &msg) < 0 )
-		return AS_CONN_FAILED;
+	as_tv.tv_sec = msg.tv_sec;
+	as_tv.tv_usec = msg.tv_usec;
 
-	if ( msg.reply.status != CHALLENGE )
-		return AS_CONN_FAILED;
+	status = recv_stream(conn_sockfd, list, as_tv, ref_tv, &msg);
 
-	chal = msg.reply.chal;
-	resp = compute_resp(chal);
+	close(conn_sockfd);
 
-	printf("Received challenge: 0x%08x\n", chal);
-	printf("Computed response:  0x%08x\n", resp);
+	return status;
 
-	memset(&msg, 0, sizeof(msg));
-	msg.request.op_code = OP_AUTH;
-	msg.request.resp = resp;
+}
 
-	if ( send_msg(conn_sockfd, &msg) < 0 )
-		return AS_CONN_FAILED;
+/*
+ * Append the marks made in a session since the last sync to the list,
+ * leaving the session open. The cursor is the sequence number of the
+ * last mark received, 0 on the first sync, and is advanced past the
+ * marks received. Marks come in the order the server accepted them.
+ */
+int as_sync_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	long long *cursor, struct arecord_list *list) {
+
+	return as_pull_marks(client_ip, server_ip, server_port, OP_SYNC, session_id, cursor, list);
+
+}
+
+/*
+ * Fill the list with a snapshot of the marks made in a session so
+ * far, leaving the session open. The cursor is set to the sequence
+ * number of the snapshot, from which as_sync_session can continue.
+ */
+int as_export_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	long long *cursor, struct arecord_list *list) {
+
+	arecord_list_empty(list);
+	*cursor = 0;
+
+	return as_pull_marks(client_ip, server_ip, server_port, OP_EXPORT, session_id, cursor, list);
+
+}
+
+/*
+ * Follow the marks of a session as the server accepts them, calling cb
+ * with every mark until it returns 0. Returns AS_SUCCESS then, or
+ * AS_BUSY if the server dropped the subscription because it fell
+ * behind, in which case marks were missed and as_sync_session can
+ * fetch them.
+ */
+int as_subscribe_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	arecord_callback cb, void *cb_data) {
+
+	int status, conn_sockfd;
+	struct as_msg msg;
+	struct timeval ref_tv, as_tv;
+	struct arecord_list *list;
+	struct arecord *iter;
 
-	if ( recv_msg(conn_sockfd, &msg) < 0 )
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
 		return AS_CONN_FAILED;
 
-	gettimeofday(&ref_tv, NULL);
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_SUBSCRIBE;
+	msg.request.resp = CLOSE_BATCH | CLOSE_COMPACT;
+	msg.session_id = session_id;
 
-	if ( msg.reply.status == DENY )
-		return AS_AUTH_FAILED;
+	if ( (status = as_authenticate(conn_sockfd, &msg, NULL, 0)) != AS_SUCCESS ) {
+		close(conn_sockfd);
+		return status;
+	}
 
-	if ( msg.reply.status != TIME )
-		return AS_AUTH_FAILED;
+	if ( msg.reply.status != TIME ) {
+		close(conn_sockfd);
+		return msg.reply.status == DENY ? AS_REQ_DENIED : AS_AUTH_FAILED;
+	}
 
-	as_tv.tv_sec = msg.tv_sec;
-	as_tv.tv_usec = msg.tv_usec;
+	if ( !(list = arecord_list_new()) ) {
+		close(conn_sockfd);
+		return CLIENT_FAILURE;
+	}
 
-	while ( 1 ) {
+	for ( status = AS_SUCCESS; status == AS_SUCCESS; arecord_list_empty(list) ) {
 
-		struct arecord *new_record;
-		struct timeval tv, corrected_tv;
+		// The server sends its time whenever it has been quiet for a while
+		if ( msg.reply.status == TIME ) {
+			gettimeofday(&ref_tv, NULL);
+			as_tv.tv_sec = msg.tv_sec;
+			as_tv.tv_usec = msg.tv_usec;
+		}
 
-		if ( recv_msg(conn_sockfd, &msg) < 0 )
-			return AS_CONN_FAILED;
+		if ( recv_msg(conn_sockfd, &msg, AS_IO_TIMEOUT) < 0 ) {
+			status = AS_CONN_FAILED;
+			break;
+		}
 
-		if ( msg.reply.status == END_DATA )
+		if ( msg.reply.status == END_DATA ) {
+			status = AS_BUSY;
 			break;
+		}
 
-		if ( !(new_record = arecord_new()) )
-			return CLIENT_FAILURE;
+		if ( msg.reply.status == DATA_COMPACT )
+			status = recv_compact(conn_sockfd, &msg, list, as_tv, ref_tv);
+		else if ( msg.reply.status == DATA_BATCH )
+			status = recv_batch(conn_sockfd, msg.roll_number, list, as_tv, ref_tv);
+		else if ( msg.reply.status == DATA )
+			status = add_record(list, msg.roll_number, msg.tv_sec, msg.tv_usec, as_tv, ref_tv);
 
-		tv.tv_sec = msg.tv_sec;
-		tv.tv_usec = msg.tv_usec;
-		corrected_tv = correct_tv(tv, as_tv, ref_tv);
+		for (iter = list->head; iter && status == AS_SUCCESS; iter = iter->next)
+			if ( cb(iter, cb_data) == 0 )
+				break;
 
-		new_record->tv_sec = corrected_tv.tv_sec;
-		new_record->tv_usec = corrected_tv.tv_usec;
-		new_record->roll_number = msg.roll_number;
+		if ( iter )
+			break;
 
-		arecord_list_insert(list, new_record);
+	}
 
-	};
+	arecord_list_free(list);
+	close(conn_sockfd);
+
+	return status;
+
+}
+
+/*
+ * Follow the anomalies the server flags in the marks of a session,
+ * calling cb with every one until it returns 0. Returns AS_SUCCESS
+ * then, or AS_BUSY if the server dropped the subscription because it
+ * fell behind.
+ */
+int as_watch_anomalies(char *client_ip, char *server_ip, int server_port, int session_id,
+	as_anomaly_callback cb, void *cb_data) {
+
+	int status, conn_sockfd;
+	struct as_msg msg;
+	struct as_msg_mac mac;
+	struct as_anomaly anomaly;
+
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+		return AS_CONN_FAILED;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_SUBSCRIBE;
+	msg.request.resp = SUBSCRIBE_ANOMALIES;
+	msg.session_id = session_id;
+
+	if ( (status = as_authenticate(conn_sockfd, &msg, NULL, 0)) != AS_SUCCESS ) {
+		close(conn_sockfd);
+		return status;
+	}
+
+	if ( msg.reply.status != TIME ) {
+		close(conn_sockfd);
+		return msg.reply.status == DENY ? AS_REQ_DENIED : AS_AUTH_FAILED;
+	}
+
+	while ( 1 ) {
+
+		if ( recv_msg(conn_sockfd, &msg, AS_IO_TIMEOUT) < 0 ) {
+			status = AS_CONN_FAILED;
+			break;
+		}
+
+		if ( msg.reply.status == END_DATA ) {
+			status = AS_BUSY;
+			break;
+		}
+
+		// The server sends its time whenever it has been quiet for a while
+		if ( msg.reply.status != ANOMALY )
+			continue;
+
+		if ( sockio_recv(conn_sockfd, &mac, sizeof(mac), AS_IO_TIMEOUT * 1000) < 0 ) {
+			status = AS_CONN_FAILED;
+			break;
+		}
+
+		anomaly.type = msg.reply.chal;
+		anomaly.roll_number = msg.roll_number;
+		anomaly.tv_sec = msg.tv_sec;
+		anomaly.tv_usec = msg.tv_usec;
+		memcpy(anomaly.mac_addr, mac.mac_addr, sizeof(anomaly.mac_addr));
+
+		if ( cb(&anomaly, cb_data) == 0 ) {
+			status = AS_SUCCESS;
+			break;
+		}
+
+	}
 
 	close(conn_sockfd);
 
+	return status;
+
+}
+
+int as_open_session(char *client_ip, char *server_ip, int server_port, int session_id) {
+
+	struct as_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_OPEN;
+	msg.session_id = session_id;
+
+	return as_admin_request(client_ip, server_ip, server_port, &msg);
+
+}
+
+int as_expire_session(char *client_ip, char *server_ip, int server_port, int session_id) {
+
+	struct as_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_EXPIRE;
+	msg.session_id = session_id;
+
+	return as_admin_request(client_ip, server_ip, server_port, &msg);
+
+}
+
+/*
+ * Have the server open the session at open_time, mark students late
+ * from late_time and close it at close_time. A late_time outside the
+ * session means students are never marked late.
+ */
+int as_schedule_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	time_t open_time, time_t late_time, time_t close_time) {
+
+	struct as_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_SCHEDULE;
+	msg.session_id = session_id;
+	msg.tv_sec = open_time;
+	msg.tv_usec = close_time;
+	if ( late_time > open_time && late_time < close_time )
+		msg.roll_number = late_time - open_time;
+
+	return as_admin_request(client_ip, server_ip, server_port, &msg);
+
+}
+
+/*
+ * Mark a list of students, as an admin entering late arrivals does,
+ * in one request for every AS_BATCH_RECORDS of them. Entries without a
+ * time are marked at the time the server receives them. The status of
+ * each mark is left in its entry.
+ */
+int as_mark_batch(char *client_ip, char *server_ip, int server_port, int session_id,
+	struct as_batch_entry *entries, int n_entries) {
+
+	int i, status;
+
+	for (i = 0; i < n_entries; i += AS_BATCH_RECORDS) {
+
+		int n_batched = n_entries - i < AS_BATCH_RECORDS ? n_entries - i : AS_BATCH_RECORDS;
+
+		status = mark_batch(client_ip, server_ip, server_port, session_id, entries + i, n_batched);
+
+		if ( status != AS_SUCCESS )
+			return status;
+
+	}
+
 	return AS_SUCCESS;
 
 }
@@ -284,6 +566,12 @@ void as_status_print(int status) {
 		case AS_SUCCESS:
 			printf("The operation was successful.\n");
 			break;
+		case AS_UNREGISTERED:
+			printf("The device is not registered.\n");
+			break;
+		case AS_BUSY:
+			printf("The server is too busy, try again later.\n");
+			break;
 		default:
 			printf("Unrecognized server response.\n");
 			break;
@@ -307,6 +595,108 @@ static int ipport2addr(char *ip, int port, struct sockaddr_in *addr) {
 
 }
 
+static int as_connect(char *client_ip, char *server_ip, int server_port) {
+
+	int conn_sockfd;
+	struct sockaddr_in server_addr;
+
+	if ( (conn_sockfd = client_socket_new(client_ip)) < 0 )
+		return -1;
+
+	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 ) {
+		close(conn_sockfd);
+		return -1;
+	}
+
+	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
+		perror("connect() failed");
+		close(conn_sockfd);
+		return -1;
+	}
+
+	return conn_sockfd;
+
+}
+
+/*
+ * Send an admin request and answer the challenge that follows, along
+ * with the payload of the request if it has one. On success the
+ * server's reply to the request is left in the request.
+ */
+static int as_authenticate(int conn_sockfd, struct as_msg *request, void *payload, int payload_len) {
+
+	unsigned chal, resp;
+	struct iovec iov[2];
+
+	if ( send_msg(conn_sockfd, request, AS_IO_TIMEOUT) < 0 )
+		return AS_CONN_FAILED;
+
+	if ( recv_msg(conn_sockfd, request, AS_IO_TIMEOUT) < 0 )
+		return AS_CONN_FAILED;
+
+	// The server is serving as many admins as it can
+	if ( request->reply.status == BUSY )
+		return AS_BUSY;
+
+	if ( request->reply.status != CHALLENGE )
+		return AS_CONN_FAILED;
+
+	chal = request->reply.chal;
+	resp = compute_resp(chal);
+
+	printf("Received challenge: 0x%08x\n", chal);
+	printf("Computed response:  0x%08x\n", resp);
+
+	memset(request, 0, sizeof(struct as_msg));
+	request->request.op_code = OP_AUTH;
+	request->request.resp = resp;
+
+	htonmsg(request);
+
+	iov[0].iov_base = request;
+	iov[0].iov_len = sizeof(struct as_msg);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = payload_len;
+
+	if ( sockio_sendv(conn_sockfd, iov, payload_len > 0 ? 2 : 1, AS_IO_TIMEOUT * 1000) < 0 )
+		return AS_CONN_FAILED;
+
+	if ( recv_msg(conn_sockfd, request, AS_IO_TIMEOUT) < 0 )
+		return AS_CONN_FAILED;
+
+	return AS_SUCCESS;
+
+}
+
+static int as_admin_request(char *client_ip, char *server_ip, int server_port, struct as_msg *request) {
+
+	int status, conn_sockfd;
+
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+		return AS_CONN_FAILED;
+
+	status = as_authenticate(conn_sockfd, request, NULL, 0);
+
+	close(conn_sockfd);
+
+	if ( status != AS_SUCCESS )
+		return status;
+
+	switch ( request->reply.status ) {
+
+		case DONE:
+			return AS_SUCCESS;
+
+		case DENY:
+			return AS_REQ_DENIED;
+
+		default:
+			return AS_CONN_FAILED;
+
+	}
+
+}
+
 static int client_socket_new(const char *ip) {
 
 	int sock_fd;
@@ -354,6 +744,148 @@ static unsigned compute_resp(unsigned challenge) {
 
 }
 
+/*
+ * Send a mark request, already in network byte order, and return the
+ * status of the mark. While the server is busy the mark is sent again
+ * after the time it asks for, or after an exponential backoff once
+ * that is longer, with jitter so that clients turned away together do
+ * not come back together. The backoff only overrides the server once a
+ * client was turned away several times, as waiting longer than the
+ * server asks leaves it idle. The mark keeps the time it was first
+ * made at.
+ */
+static int send_mark(char *client_ip, char *server_ip, int server_port, char *send_buf, int send_len) {
+
+	static int seeded;
+	long long backoff = 0, waited = 0;
+	struct as_msg msg;
+
+	if ( !seeded ) {
+		srand(time(NULL) ^ getpid());
+		seeded = 1;
+	}
+
+	while ( 1 ) {
+
+		struct timeval delay_tv;
+		long long retry_after, delay;
+		int conn_sockfd;
+
+		if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+			return AS_CONN_FAILED;
+
+		if ( sockio_send(conn_sockfd, send_buf, send_len, AS_MARK_TIMEOUT * 1000) < 0
+			|| recv_msg(conn_sockfd, &msg, AS_MARK_TIMEOUT) < 0 ) {
+			close(conn_sockfd);
+			return AS_CONN_FAILED;
+		}
+
+		close(conn_sockfd);
+
+		if ( msg.reply.status != BUSY )
+			return mark_status(msg.reply.status);
+
+		backoff = backoff ? 2 * backoff : AS_BACKOFF_START * 1000LL;
+		retry_after = msg.tv_sec * 1000000 + msg.tv_usec;
+		if ( retry_after < backoff )
+			retry_after = backoff;
+
+		// Anywhere from half to one and a half times that
+		delay = retry_after / 2 + (long long)((double)rand() / RAND_MAX * retry_after);
+
+		if ( waited + delay > AS_RETRY_BUDGET * 1000000LL )
+			return AS_BUSY;
+
+		delay_tv.tv_sec = delay / 1000000;
+		delay_tv.tv_usec = delay % 1000000;
+		select(0, NULL, NULL, NULL, &delay_tv);
+
+		waited += delay;
+
+	}
+
+}
+
+static int mark_batch(char *client_ip, char *server_ip, int server_port, int session_id,
+	struct as_batch_entry *entries, int n_entries) {
+
+	int i, status, conn_sockfd, statuses[AS_BATCH_RECORDS];
+	struct as_msg_data records[AS_BATCH_RECORDS];
+	struct as_msg msg;
+
+	for (i = 0; i < n_entries; i++) {
+		records[i].tv_sec = htobe64(entries[i].tv_sec);
+		records[i].tv_usec = htobe64(entries[i].tv_usec);
+		records[i].roll_number = htonl(entries[i].roll_number);
+	}
+
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+		return AS_CONN_FAILED;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = OP_MARK_BATCH;
+	msg.roll_number = n_entries;
+	msg.session_id = session_id;
+
+	if ( (status = as_authenticate(conn_sockfd, &msg, records, n_entries * sizeof(struct as_msg_data))) != AS_SUCCESS ) {
+		close(conn_sockfd);
+		return status;
+	}
+
+	if ( msg.reply.status != DONE || msg.roll_number != n_entries ) {
+		close(conn_sockfd);
+		return msg.reply.status == DENY ? AS_REQ_DENIED : AS_AUTH_FAILED;
+	}
+
+	// The status of every mark follows the reply
+	if ( sockio_recv(conn_sockfd, statuses, n_entries * sizeof(int), AS_IO_TIMEOUT * 1000) < 0 ) {
+		close(conn_sockfd);
+		return AS_CONN_FAILED;
+	}
+
+	close(conn_sockfd);
+
+	for (i = 0; i < n_entries; i++)
+		entries[i].status = mark_status(ntohl(statuses[i]));
+
+	return AS_SUCCESS;
+
+}
+
+static int mark_status(int status) {
+
+	switch ( status ) {
+
+		case PRESENT:
+			return AS_PRESENT;
+
+		case ABSENT:
+			return AS_ABSENT;
+
+		case LATE:
+			return AS_LATE;
+
+		case DENY:
+			return AS_REQ_DENIED;
+
+		case UNREGISTERED:
+			return AS_UNREGISTERED;
+
+		case BAD_REQUEST:
+			// The time sent was out of range, a fault of this client
+			return CLIENT_FAILURE;
+
+		default:
+			/*
+			 * If the status code was not understood
+			 * assume this was a connection fault...
+			 */
+			return AS_CONN_FAILED;
+
+	}
+
+}
+
 static struct timeval correct_tv(struct timeval tv, struct timeval bad_tv, struct timeval good_tv) {
 
 	struct timeval correct_timeval;
@@ -372,47 +904,167 @@ static struct timeval correct_tv(struct timeval tv, struct timeval bad_tv, struc
 
 }
 
-static int recv_data(int sock_fd, char *recv_buf, int recv_len) {
+static int add_record(struct arecord_list *list, int roll_number, long long tv_sec, long long tv_usec,
+	struct timeval as_tv, struct timeval ref_tv) {
 
-	while ( recv_len ) {
+	struct arecord *new_record;
+	struct timeval tv, corrected_tv;
 
-		int n_received;
+	if ( !(new_record = arecord_new()) )
+		return CLIENT_FAILURE;
 
-		n_received = recv(sock_fd, recv_buf, recv_len, 0);
+	tv.tv_sec = tv_sec;
+	tv.tv_usec = tv_usec;
+	corrected_tv = correct_tv(tv, as_tv, ref_tv);
 
-		if ( n_received < 0 ) {
-			perror("recv() failed");
-			return -1;
-		}
+	new_record->tv_sec = corrected_tv.tv_sec;
+	new_record->tv_usec = corrected_tv.tv_usec;
+	new_record->roll_number = roll_number;
+
+	arecord_list_insert(list, new_record);
+
+	return AS_SUCCESS;
+
+}
+
+static int recv_batch(int sock_fd, int n_records, struct arecord_list *list,
+	struct timeval as_tv, struct timeval ref_tv) {
 
-		recv_buf += n_received;
-		recv_len -= n_received;
+	struct as_msg_data records[AS_BATCH_RECORDS];
+	int i, status;
+
+	if ( n_records <= 0 || n_records > AS_BATCH_RECORDS )
+		return AS_CONN_FAILED;
+
+	// Read the whole frame at once, then decode it in a single pass
+	if ( sockio_recv(sock_fd, records, n_records * sizeof(struct as_msg_data), AS_IO_TIMEOUT * 1000) < 0 )
+		return AS_CONN_FAILED;
+
+	for (i = 0; i < n_records; i++) {
+
+		status = add_record(list, ntohl(records[i].roll_number),
+			be64toh(records[i].tv_sec), be64toh(records[i].tv_usec), as_tv, ref_tv);
+
+		if ( status != AS_SUCCESS )
+			return status;
 
 	}
 
-	return 0;
+	return AS_SUCCESS;
+
+}
+
+static int recv_compact(int sock_fd, struct as_msg *hdr, struct arecord_list *list,
+	struct timeval as_tv, struct timeval ref_tv) {
+
+	unsigned char packed[MARKPACK_MAX_LEN(AS_BATCH_RECORDS)];
+	struct markpack_mark marks[AS_BATCH_RECORDS];
+	int i, status, n_records = hdr->roll_number, len = (int)hdr->tv_sec;
+
+	if ( n_records <= 0 || n_records > AS_BATCH_RECORDS )
+		return AS_CONN_FAILED;
+	if ( len <= 0 || len > (int)sizeof(packed) )
+		return AS_CONN_FAILED;
+
+	if ( sockio_recv(sock_fd, packed, len, AS_IO_TIMEOUT * 1000) < 0 )
+		return AS_CONN_FAILED;
+
+	if ( markpack_crc32(packed, len) != (unsigned)hdr->tv_usec ) {
+		printf("Corrupt record block received.\n");
+		return AS_CONN_FAILED;
+	}
+
+	if ( markpack_decode(packed, len, marks, n_records) < 0 )
+		return AS_CONN_FAILED;
+
+	for (i = 0; i < n_records; i++) {
+
+		status = add_record(list, marks[i].roll_number,
+			marks[i].tv_sec, marks[i].tv_usec, as_tv, ref_tv);
+
+		if ( status != AS_SUCCESS )
+			return status;
+
+	}
+
+	return AS_SUCCESS;
 
 }
 
-static int send_data(int sock_fd, char *send_buf, int send_len) {
+/*
+ * Receive records until the END_DATA message, which is left in end.
+ */
+static int recv_stream(int sock_fd, struct arecord_list *list, struct timeval as_tv, struct timeval ref_tv,
+	struct as_msg *end) {
+
+	int status;
 
-	while ( send_len ) {
+	while ( 1 ) {
 
-		int n_sent;
+		if ( recv_msg(sock_fd, end, AS_IO_TIMEOUT) < 0 )
+			return AS_CONN_FAILED;
 
-		n_sent = send(sock_fd, send_buf, send_len, 0);
+		if ( end->reply.status == END_DATA )
+			return AS_SUCCESS;
 
-		if ( n_sent < 0 ) {
-			perror("send() failed");
-			return -1;
-		}
+		if ( end->reply.status == DATA_COMPACT )
+			status = recv_compact(sock_fd, end, list, as_tv, ref_tv);
+		else if ( end->reply.status == DATA_BATCH )
+			status = recv_batch(sock_fd, end->roll_number, list, as_tv, ref_tv);
+		else
+			status = add_record(list, end->roll_number, end->tv_sec, end->tv_usec, as_tv, ref_tv);
 
-		send_buf += n_sent;
-		send_len -= n_sent;
+		if ( status != AS_SUCCESS )
+			return status;
 
 	}
 
-	return 0;
+}
+
+/*
+ * Pull the marks of a session after the cursor with OP_SYNC or OP_EXPORT.
+ */
+static int as_pull_marks(char *client_ip, char *server_ip, int server_port, int op_code, int session_id,
+	long long *cursor, struct arecord_list *list) {
+
+	int status, conn_sockfd;
+	struct as_msg msg;
+	struct timeval ref_tv, as_tv;
+
+	if ( (conn_sockfd = as_connect(client_ip, server_ip, server_port)) < 0 )
+		return AS_CONN_FAILED;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.request.op_code = op_code;
+	msg.request.resp = CLOSE_BATCH | CLOSE_COMPACT;
+	msg.tv_sec = *cursor;
+	msg.session_id = session_id;
+
+	if ( (status = as_authenticate(conn_sockfd, &msg, NULL, 0)) != AS_SUCCESS ) {
+		close(conn_sockfd);
+		return status;
+	}
+
+	gettimeofday(&ref_tv, NULL);
+
+	if ( msg.reply.status != TIME ) {
+		close(conn_sockfd);
+		return msg.reply.status == DENY ? AS_REQ_DENIED : AS_AUTH_FAILED;
+	}
+
+	as_tv.tv_sec = msg.tv_sec;
+	as_tv.tv_usec = msg.tv_usec;
+
+	status = recv_stream(conn_sockfd, list, as_tv, ref_tv, &msg);
+
+	close(conn_sockfd);
+
+	if ( status != AS_SUCCESS )
+		return status;
+
+	*cursor = msg.tv_sec;
+
+	return AS_SUCCESS;
 
 }
 
@@ -424,6 +1076,7 @@ static void htonmsg(struct as_msg *msg) {
 	msg->tv_sec = htobe64(msg->tv_sec);
 	msg->tv_usec = htobe64(msg->tv_usec);
 	msg->roll_number = htonl(msg->roll_number);
+	msg->session_id = htonl(msg->session_id);
 
 	return;
 
@@ -437,16 +1090,19 @@ static void ntohmsg(struct as_msg *msg) {
 	msg->tv_sec = be64toh(msg->tv_sec);
 	msg->tv_usec = be64toh(msg->tv_usec);
 	msg->roll_number = ntohl(msg->roll_number);
+	msg->session_id = ntohl(msg->session_id);
 
 	return;
 
 }
 
-static int recv_msg(int sock_fd, struct as_msg *msg) {
-
-	int ret;
+/*
+ * Messages are received and sent with a timeout in seconds, which bounds
+ * the whole message. A server that closed the connection fails them too.
+ */
+static int recv_msg(int sock_fd, struct as_msg *msg, int timeout) {
 
-	if ( recv_data(sock_fd, (char*)msg, sizeof(struct as_msg)) < 0 )
+	if ( sockio_recv(sock_fd, msg, sizeof(struct as_msg), timeout * 1000) < 0 )
 		return -1;
 
 	ntohmsg(msg);
@@ -455,13 +1111,11 @@ static int recv_msg(int sock_fd, struct as_msg *msg) {
 
 }
 
-static int send_msg(int sock_fd, struct as_msg *msg) {
-
-	int ret;
+static int send_msg(int sock_fd, struct as_msg *msg, int timeout) {
 
 	htonmsg(msg);
 
-	if ( send_data(sock_fd, (char*)msg, sizeof(struct as_msg)) < 0 )
+	if ( sockio_send(sock_fd, msg, sizeof(struct as_msg), timeout * 1000) < 0 )
 		return -1;
 
 	return 0;
@@ -12,27 +12,50 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include "archive.h"
 #include "arecord_list.h"
 #include "attendance_client.h"
 
 /* Configuration */
 #define SERVER_IP	"192.168.52.1"
 #define SERVER_PORT	5432
+#define SYNC_INTERVAL	5	/* Seconds between pulls of new marks in watch mode */
 
-void output_filename(char *filename) {
+void output_filename(char *filename, const char *extension) {
 
+	char format[64];
 	time_t nowtime;
 	struct tm *nowtm;
 
 	nowtime = time(NULL);
 	nowtm = localtime(&nowtime);
 
-	strftime(filename, 64, "%Y_%B_%d_attendance.txt", nowtm);
+	snprintf(format, sizeof(format), "%%Y_%%B_%%d_attendance.%s", extension);
+	strftime(filename, 64, format, nowtm);
 
 	return;
 
 }
 
+int print_archive(char *archive_file) {
+
+	struct arecord_list *list;
+
+	if ( !(list = archive_load(archive_file)) ) {
+		printf("Failed to load %s\n\n", archive_file);
+		return -1;
+	}
+
+	printf("Printing %d records from %s...\n", list->n_arecords, archive_file);
+	arecord_list_print(list);
+	printf("\n");
+
+	arecord_list_free(list);
+
+	return 0;
+
+}
+
 int get_own_ip(char *ip) {
 
 	unsigned ref_ip = inet_addr(SERVER_IP);
@@ -105,6 +128,242 @@ void print_status_code(int code) {
 
 }
 
+time_t get_time_today(char *timestr) {
+
+	long int h = 0, m = 0;
+	time_t nowtime;
+	struct tm *nowtm;
+
+	sscanf(timestr, "%ld:%02ld", &h, &m);
+	nowtime = time(NULL);
+	nowtm = localtime(&nowtime);
+	nowtm->tm_hour = h;
+	nowtm->tm_min = m;
+	nowtm->tm_sec = 0;
+
+	return mktime(nowtm);
+
+}
+
+int schedule_session(char *own_ip, char *server_ip, int port, int argc, char **argv) {
+
+	int status_code, session_id = AS_DEFAULT_SESSION;
+
+	if ( argc == 6 )
+		session_id = atoi(argv[5]);
+
+	status_code = as_schedule_session(own_ip, server_ip, port, session_id,
+		get_time_today(argv[2]), get_time_today(argv[3]), get_time_today(argv[4]));
+	print_status_code(status_code);
+
+	if ( status_code != AS_SUCCESS )
+		return -1;
+
+	printf("Session %d will open at %s, mark students late from %s and close at %s.\n"
+		"Run %s <time> %d at any time after closing to collect the records.\n\n",
+		session_id, argv[2], argv[3], argv[4], argv[0], session_id);
+
+	return 0;
+
+}
+
+int watch_session(char *own_ip, char *server_ip, int port, int session_id) {
+
+	int status_code;
+	long long cursor = 0;
+	struct arecord_list *list;
+
+	if ( !(list = arecord_list_new()) )
+		return -1;
+
+	printf("Watching session %d, new marks are printed every %d seconds...\n\n", session_id, SYNC_INTERVAL);
+
+	/* Only the marks since the last pull are sent each time */
+	while ( (status_code = as_sync_session(own_ip, server_ip, port, session_id, &cursor, list)) == AS_SUCCESS ) {
+
+		if ( list->n_arecords > 0 ) {
+			arecord_list_print(list);
+			arecord_list_empty(list);
+		}
+
+		sleep(SYNC_INTERVAL);
+
+	}
+
+	print_status_code(status_code);
+	printf("%lld marks received.\n\n", cursor);
+
+	arecord_list_free(list);
+
+	return -1;
+
+}
+
+int export_session(char *own_ip, char *server_ip, int port, int session_id) {
+
+	int status_code;
+	long long cursor;
+	struct arecord_list *list;
+
+	if ( !(list = arecord_list_new()) )
+		return -1;
+
+	/* Attendance stays open, the snapshot is of the marks so far */
+	status_code = as_export_session(own_ip, server_ip, port, session_id, &cursor, list);
+	print_status_code(status_code);
+
+	if ( status_code != AS_SUCCESS ) {
+		arecord_list_free(list);
+		return -1;
+	}
+
+	printf("\nPrinting record list...\n");
+	arecord_list_print(list);
+	printf("\nHeadcount of session %d so far: %d\n\n", session_id, list->n_arecords);
+
+	arecord_list_free(list);
+
+	return 0;
+
+}
+
+int print_arrival(struct arecord *record, void *cb_data) {
+
+	char timestr[16];
+	time_t tv_sec = record->tv_sec;
+
+	(void)cb_data;
+
+	strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&tv_sec));
+	printf("%s  %d\n", timestr, record->roll_number);
+	fflush(stdout);
+
+	return 1;
+
+}
+
+int follow_session(char *own_ip, char *server_ip, int port, int session_id) {
+
+	int status_code;
+
+	printf("Following session %d, marks are printed as they arrive...\n\n", session_id);
+
+	/* The server pushes every mark, until we fall too far behind */
+	status_code = as_subscribe_session(own_ip, server_ip, port, session_id, print_arrival, NULL);
+	print_status_code(status_code);
+
+	if ( status_code == AS_BUSY )
+		printf("Fell behind and missed marks, use -w %d to catch up.\n", session_id);
+	printf("\n");
+
+	return -1;
+
+}
+
+int print_anomaly(struct as_anomaly *anomaly, void *cb_data) {
+
+	char timestr[16];
+	time_t tv_sec = anomaly->tv_sec;
+	unsigned char *mac = anomaly->mac_addr;
+
+	(void)cb_data;
+
+	strftime(timestr, sizeof(timestr), "%H:%M:%S", localtime(&tv_sec));
+	printf("%s  %d  %02x:%02x:%02x:%02x:%02x:%02x  ", timestr, anomaly->roll_number,
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	switch ( anomaly->type ) {
+		case AS_ANOMALY_DEVICE_ROLLS:
+			printf("Device marked several roll numbers\n");
+			break;
+		case AS_ANOMALY_DEVICE_BURST:
+			printf("Burst of marks from one device\n");
+			break;
+		case AS_ANOMALY_RATE_SPIKE:
+			printf("Spike in the rate of marks\n");
+			break;
+		case AS_ANOMALY_TIMING:
+			printf("Mark at an impossible time\n");
+			break;
+		default:
+			printf("Unknown anomaly\n");
+	}
+	fflush(stdout);
+
+	return 1;
+
+}
+
+int watch_anomalies(char *own_ip, char *server_ip, int port, int session_id) {
+
+	int status_code;
+
+	printf("Watching session %d for proxy marking, anomalies are printed as they are flagged...\n\n", session_id);
+
+	status_code = as_watch_anomalies(own_ip, server_ip, port, session_id, print_anomaly, NULL);
+	print_status_code(status_code);
+	printf("\n");
+
+	return -1;
+
+}
+
+int mark_students(char *own_ip, char *server_ip, int port, int session_id) {
+
+	char line[64], timestr[16];
+	int i, status_code, n_entries = 0, max_entries = 0;
+	struct as_batch_entry entry, *entries = NULL, *grown;
+
+	printf("Reading students to mark in session %d, one roll number per line"
+		" with an optional HH:MM...\n\n", session_id);
+
+	while ( fgets(line, sizeof(line), stdin) ) {
+
+		int n_fields;
+
+		memset(&entry, 0, sizeof(entry));
+		if ( (n_fields = sscanf(line, "%d %15s", &entry.roll_number, timestr)) < 1 )
+			continue;
+		if ( n_fields == 2 )
+			entry.tv_sec = get_time_today(timestr);
+
+		if ( n_entries == max_entries ) {
+			max_entries = max_entries ? 2 * max_entries : 64;
+			if ( !(grown = (struct as_batch_entry*)realloc(entries, max_entries * sizeof(entry))) ) {
+				free(entries);
+				return -1;
+			}
+			entries = grown;
+		}
+		entries[n_entries++] = entry;
+
+	}
+
+	if ( n_entries == 0 ) {
+		printf("No students to mark.\n\n");
+		free(entries);
+		return -1;
+	}
+
+	/* The whole list is marked in a single request */
+	status_code = as_mark_batch(own_ip, server_ip, port, session_id, entries, n_entries);
+	print_status_code(status_code);
+
+	if ( status_code == AS_SUCCESS ) {
+		printf("\n");
+		for (i = 0; i < n_entries; i++) {
+			printf("%d: ", entries[i].roll_number);
+			as_status_print(entries[i].status);
+		}
+	}
+	printf("\n");
+
+	free(entries);
+
+	return status_code == AS_SUCCESS ? 0 : -1;
+
+}
+
 struct timeval get_remaining_tv(char *timestr) {
 
 	long int h = 0, m = 0, s = 0;
@@ -140,29 +399,57 @@ int main(int argc, char **argv) {
 	int status_code;
 	struct timeval tv_limit;
 	char output_file[64];
+	char archive_file[64];
 	struct arecord_list *list;
 	int port = SERVER_PORT;
+	int session_id = AS_DEFAULT_SESSION;
 	char own_ip[INET_ADDRSTRLEN];
 	char server_ip[INET_ADDRSTRLEN] = SERVER_IP;
 
 	printf("\n");
 
-	if ( argc != 2 ) {
-		printf("Usage: %s <attendance closing time>\n\n", argv[0]);
+	if ( argc == 3 && strcmp(argv[1], "-l") == 0 )
+		return print_archive(argv[2]);
+
+	if ( argc != 2 && argc != 3 && !((argc == 5 || argc == 6) && strcmp(argv[1], "-s") == 0) ) {
+		printf("Usage: %s <attendance closing time> [session]\n", argv[0]);
+		printf("       %s -s <opening time> <late time> <closing time> [session]\n", argv[0]);
+		printf("       %s -w [session]\n", argv[0]);
+		printf("       %s -f [session]\n", argv[0]);
+		printf("       %s -a [session]\n", argv[0]);
+		printf("       %s -e [session]\n", argv[0]);
+		printf("       %s -m [session] < <roll numbers>\n", argv[0]);
+		printf("       %s -l <attendance archive>\n\n", argv[0]);
 		return -1;
 	}
+	if ( argc == 3 )
+		session_id = atoi(argv[2]);
 
 	if ( get_own_ip(own_ip) < 0 ) {
 		printf("Couldn't find a valid interface."
 			" Are you connected to the device?\n");
 		return -1;
 	}
+
+	/* The server opens and closes the session by itself */
+	if ( strcmp(argv[1], "-s") == 0 )
+		return schedule_session(own_ip, server_ip, port, argc, argv);
+	if ( strcmp(argv[1], "-w") == 0 )
+		return watch_session(own_ip, server_ip, port, session_id);
+	if ( strcmp(argv[1], "-f") == 0 )
+		return follow_session(own_ip, server_ip, port, session_id);
+	if ( strcmp(argv[1], "-a") == 0 )
+		return watch_anomalies(own_ip, server_ip, port, session_id);
+	if ( strcmp(argv[1], "-e") == 0 )
+		return export_session(own_ip, server_ip, port, session_id);
+	if ( strcmp(argv[1], "-m") == 0 )
+		return mark_students(own_ip, server_ip, port, session_id);
 	list = arecord_list_new();
 	tv_limit = get_remaining_tv(argv[1]);
 
 	select(0, NULL, NULL, NULL, &tv_limit);
 
-	status_code = as_close_attendance(own_ip, server_ip, port, list);
+	status_code = as_close_session(own_ip, server_ip, port, session_id, list);
 	print_status_code(status_code);
 
 	if ( status_code != AS_SUCCESS ) {
@@ -171,7 +458,8 @@ int main(int argc, char **argv) {
 		return -1;
 	}
 
-	output_filename(output_file);
+	output_filename(output_file, "txt");
+	output_filename(archive_file, "seg");
 
 	printf("\nPrinting record list...\n");
 	arecord_list_print(list);
@@ -180,6 +468,10 @@ int main(int argc, char **argv) {
 		printf("Failed to write to %s\n", output_file);
 	else
 		printf("Written to %s\n", output_file);
+	if ( archive_save(list, archive_file) < 0 )
+		printf("Failed to write to %s\n", archive_file);
+	else
+		printf("Archived to %s\n", archive_file);
 	printf("\n");
 
 	arecord_list_free(list);
@@ -0,0 +1,117 @@
+/*!
+
+	@file segment.h
+	@brief Header file for the checksummed segment file format.
+
+*/
+
+
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+
+
+/// Marks the start of a segment ("ATSG")
+#define SEGMENT_MAGIC		0x41545347
+
+/// Maximum number of records to pack into a single segment
+#define SEGMENT_MAX_RECORDS	256
+
+/// Maximum number of threads to decode segments with
+#define SEGMENT_MAX_THREADS	8
+
+
+
+/*!
+
+	@brief Header preceding the payload of every segment.
+
+	All fields are stored in network byte order. The checksum covers
+	the fields following it as well as the payload.
+
+*/
+struct segment_hdr {
+
+	/// SEGMENT_MAGIC
+	unsigned magic;
+
+	/// CRC-32 of the rest of the header and the payload
+	unsigned crc;
+
+	/// Number of records in the payload
+	unsigned n_records;
+
+	/// Smallest and largest key of the records in the payload
+	int min_key;
+	int max_key;
+
+	/// Size of the payload in bytes
+	unsigned payload_len;
+
+} __attribute__((packed));
+
+/*!
+
+	@brief Segment found in a segment file.
+
+*/
+struct segment {
+
+	/// Header in host byte order
+	struct segment_hdr hdr;
+
+	/// Payload inside the file buffer
+	const unsigned char *payload;
+
+	/// Set if the checksum matched, cleared by segment_file_decode if the payload failed to decode
+	int valid;
+
+};
+
+/*!
+
+	@brief Segment file read into memory.
+
+*/
+struct segment_file {
+
+	unsigned char *data;
+	long len;
+
+	int n_segments;
+	struct segment *segments;
+
+	/// Number of segments there is room for
+	int capacity;
+
+	/// Number of bytes that could not be attributed to any segment
+	long n_skipped;
+
+};
+
+/*!
+
+	@brief Callback function type for segment_file_decode.
+
+	Decodes the payload of a verified segment into out. Must be
+	safe to call concurrently for different segments.
+
+*/
+typedef int (*segment_decode)(const struct segment *segment, void *out);
+
+
+
+unsigned segment_crc32(unsigned crc, const unsigned char *buf, unsigned len);
+int segment_seal(unsigned char *segment, unsigned payload_len,
+	unsigned n_records, int min_key, int max_key);
+int segment_file_open(const char *file_name, struct segment_file *file);
+int segment_file_decode(struct segment_file *file, segment_decode decode, void *outs, int out_size);
+void segment_file_close(struct segment_file *file);
+
+
+
+#endif /* SEGMENT_H */
+
+
+
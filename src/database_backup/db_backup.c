@@ -0,0 +1,160 @@
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "segment.h"
+#include "srecord_list.h"
+#include "database_client.h"
+
+/* Configuration */
+#define MAXNAMESZ	64
+
+
+
+int add_record(struct db_msg_data *record, void *cb_data);
+int next_record(struct db_msg_data *record, void *cb_data);
+int save_backup(char *server_ip, int server_port, char *backup_file);
+int restore_backup(char *server_ip, int server_port, char *backup_file);
+
+
+
+int main(int argc, char **argv) {
+
+	if ( argc != 5 ) {
+		printf("Usage: %s save <IP> <PORT> <backup file>\n", argv[0]);
+		printf("       %s restore <IP> <PORT> <backup file>\n", argv[0]);
+		return -1;
+	}
+
+	if ( strcmp(argv[1], "save") == 0 )
+		return save_backup(argv[2], atoi(argv[3]), argv[4]);
+
+	if ( strcmp(argv[1], "restore") == 0 )
+		return restore_backup(argv[2], atoi(argv[3]), argv[4]);
+
+	printf("Unknown command \"%s\"\n", argv[1]);
+
+	return -1;
+
+}
+
+
+
+// Collect a record of the backup stream
+int add_record(struct db_msg_data *record, void *cb_data) {
+
+	struct srecord_list *list = (struct srecord_list*)cb_data;
+	struct srecord *srecord;
+
+	if ( !(srecord = srecord_new()) )
+		return 0;
+
+	srecord->roll_number = record->roll_number;
+	memcpy(srecord->mac_addr, record->mac_addr, 6);
+	if ( !(srecord->name = strdup(record->name)) ) {
+		free(srecord);
+		return 0;
+	}
+
+	srecord_list_insert(list, srecord);
+
+	return 1;
+
+}
+
+// Feed the next record of the backup to the restore stream
+int next_record(struct db_msg_data *record, void *cb_data) {
+
+	struct srecord **iter = (struct srecord**)cb_data;
+
+	if ( !*iter )
+		return 0;
+
+	record->roll_number = (*iter)->roll_number;
+	memcpy(record->mac_addr, (*iter)->mac_addr, 6);
+	strncpy(record->name, (*iter)->name, MAXNAMESZ - 1);
+
+	*iter = (*iter)->next;
+
+	return 1;
+
+}
+
+int save_backup(char *server_ip, int server_port, char *backup_file) {
+
+	FILE *fd;
+	int status, len;
+	char tmp_file[256];
+	unsigned char *buf;
+	struct srecord_list *list;
+
+	if ( !(list = srecord_list_new()) )
+		return -1;
+
+	status = db_backup(server_ip, server_port, add_record, list);
+	if ( status != DB_OP_SUCCESS ) {
+		printf("Backup failed: ");
+		db_status_print(status);
+		srecord_list_free(list);
+		return -1;
+	}
+
+	if ( srecord_list_encode(list, &buf, &len) < 0 ) {
+		srecord_list_free(list);
+		return -1;
+	}
+
+	/* Only replace an older backup once the new one is complete */
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", backup_file);
+	if ( !(fd = fopen(tmp_file, "wb")) || fwrite(buf, 1, len, fd) != (size_t)len ||
+		fflush(fd) != 0 || fsync(fileno(fd)) < 0 || rename(tmp_file, backup_file) < 0 ) {
+		printf("Failed to write %s\n", backup_file);
+		if ( fd )
+			fclose(fd);
+		free(buf);
+		srecord_list_free(list);
+		return -1;
+	}
+	fclose(fd);
+
+	printf("Saved %d records to %s\n", list->n_srecords, backup_file);
+
+	free(buf);
+	srecord_list_free(list);
+
+	return 0;
+
+}
+
+int restore_backup(char *server_ip, int server_port, char *backup_file) {
+
+	int status, n_restored;
+	struct srecord *iter;
+	struct srecord_list *list;
+
+	if ( !(list = srecord_list_load_segments(backup_file)) )
+		return -1;
+
+	iter = list->head;
+	status = db_restore(server_ip, server_port, next_record, &iter, &n_restored);
+	if ( status != DB_OP_SUCCESS && status != DB_OP_PARTIAL ) {
+		printf("Restore failed: ");
+		db_status_print(status);
+		srecord_list_free(list);
+		return -1;
+	}
+
+	printf("Restored %d of %d records from %s\n", n_restored, list->n_srecords, backup_file);
+
+	srecord_list_free(list);
+
+	return 0;
+
+}
+
+
+
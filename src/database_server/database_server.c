@@ -6,17 +6,25 @@
 
 
 
+#include <time.h>
 #include <errno.h>
 #include <stdio.h>
+#include <signal.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include <poll.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include "stage.h"
+#include "sockio.h"
+#include "roster.h"
+#include "name_index.h"
 #include "srecord_list.h"
 
 #include "database_server.h"
@@ -29,34 +37,78 @@ static struct srecord_list *loaded_records;
 /* New records to be stored to the database file */
 static struct srecord_list *new_records;
 
+/* Time at which the oldest of the new records was staged */
+static time_t staged_since;
+
+/* Listening socket, closed by forked backup processes */
+static int database_sockfd;
+
+/*
+ * Connections held open by clients between requests, with the part of
+ * the next request received so far. Requests are taken a piece at a
+ * time as they arrive, so a client that sends half a request does not
+ * hold up the others, and it is dropped once the request has taken
+ * longer than DB_IO_TIMEOUT.
+ */
+struct db_client {
+
+	int sock_fd;
+
+	struct sockio_part part;
+	unsigned char recv_buf[MSG_LEN];
+
+	/* Set while receiving a restore stream, with its records received and restored */
+	int restoring;
+	int n_received, n_restored;
+
+};
+
+static struct db_client clients[DB_MAX_CLIENTS];
+static int n_clients;
+
 /* Networking functions */
 static int db_socket_new(char *ip, char *port);
 static void htonmsg(struct db_message *msg);
 static void ntohmsg(struct db_message *msg);
-static int recv_data(int sock_fd, char *recv_buf, int recv_len);
-static int send_data(int sock_fd, char *send_buf, int send_len);
-static int recv_msg(int sock_fd, struct db_message *msg);
 static int send_msg(int sock_fd, struct db_message *msg);
 
 /* srecord_list callback functions */
 static int db_find_record(struct srecord *record, void *cb_data);
-static int db_commit_record(struct srecord *record, void *cb_data);
+static int db_match_roll_number(struct srecord *record, void *cb_data);
+static int db_index_record(struct srecord *record);
+static int db_restage_record(struct srecord *record);
+static int db_send_record(struct srecord *record, void *cb_data);
+
+/* Record helpers */
+static struct srecord *copy_record(struct srecord *record);
 
 /* Database functions */
+static int is_enrolled(int roll_number);
 static int retrieve_record(struct msg_data *data);
+static int stage_record(struct msg_data *data);
 static int store_record(struct msg_data *data);
 static int commit_records(void);
+static int recover_records(void);
+static int convert_text_records(void);
+static int flush_timeout(struct timeval *tv);
+static int poll_timeout(void);
+static int backup_records(int sock_fd);
+static int search_records(struct msg_data *data, int max_results, int sock_fd);
+static int restore_record(struct db_client *client, struct db_message *msg);
 
 /* Database message handler */
 static int database_server_handle_msg(struct db_message *msg, int sock_fd);
 
+/* Client connection functions */
+static void accept_client(void);
+static int serve_client(struct db_client *client);
+
 
 
 int main(int argc, char **argv) {
 
-	struct db_message *msg;
-	unsigned char recv_buf[MSG_LEN];
-	int database_sockfd, conn_sockfd;
+	struct pollfd fds[DB_MAX_CLIENTS + 1];
+	int i, n_ready, running = 1;
 
 	if ( argc != 3 ) {
 		printf("Usage: %s <IP> <PORT>\n", argv[0]);
@@ -66,53 +118,77 @@ int main(int argc, char **argv) {
 	if ( (database_sockfd = db_socket_new(argv[1], argv[2])) < 0 )
 		return -1;
 
-	if ( !(loaded_records = srecord_list_load(DB_FILE)) ) {
-		close(database_sockfd);
-		return -1;
-	}
-	if ( !(new_records = srecord_list_new()) ) {
-		srecord_list_free(loaded_records);
+	if ( recover_records() < 0 ) {
 		close(database_sockfd);
 		return -1;
 	}
 
-	msg = (struct db_message*)recv_buf;
+	if ( roster_load(DB_ROSTER_FILE) > 0 )
+		printf("Loaded %d roll numbers from the roster.\n", roster_size());
 
-	while ( 1 ) {
+	/* Backup processes are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
 
-		struct sockaddr_in peer_addr;
-		socklen_t peer_addrlen;
+	while ( running ) {
 
-		peer_addrlen = sizeof(peer_addr);
-		conn_sockfd = accept(database_sockfd, (struct sockaddr*)&peer_addr, &peer_addrlen);
+		struct timeval tv;
+		int n_polled;
 
-		if ( conn_sockfd < 0 ) {
-			perror("accept() failed");
-			if ( errno == EBADF || errno == EINVAL || errno == ENOTSOCK ) break;
-			close(conn_sockfd);
-			continue;
+		fds[0].fd = database_sockfd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < n_clients; i++) {
+			fds[i + 1].fd = clients[i].sock_fd;
+			fds[i + 1].events = POLLIN;
 		}
+		n_polled = n_clients;
 
-		if ( recv_msg(conn_sockfd, msg) < 0 ) {
-			close(conn_sockfd);
-			continue;
-		}
+		/* Wake up to flush staged records once they are old enough, or to drop stalled clients */
+		n_ready = poll(fds, n_polled + 1, poll_timeout());
 
-		if ( msg->operation == OP_EXIT )
+		if ( n_ready < 0 ) {
+			if ( errno == EINTR ) continue;
+			perror("poll() failed");
 			break;
+		}
+
+		if ( flush_timeout(&tv) && tv.tv_sec == 0 )
+			commit_records();
+
+		/* Serve every client that sent a request, dropping those that left or stalled */
+		for (i = n_polled; i > 0; i--) {
+
+			int status;
+
+			if ( !fds[i].revents && sockio_part_left(&clients[i - 1].part) != 0 )
+				continue;
+
+			if ( (status = serve_client(&clients[i - 1])) == 0 )
+				continue;
+
+			close(fds[i].fd);
+			clients[i - 1] = clients[--n_clients];
+
+			if ( status > 0 ) {
+				running = 0;
+				break;
+			}
 
-		if ( database_server_handle_msg(msg, conn_sockfd) < 0 ) {
-			close(conn_sockfd);
-			continue;
 		}
 
-		close(conn_sockfd);
+		if ( running && (fds[0].revents & POLLIN) )
+			accept_client();
 
 	}
 
 	commit_records();
 
-	close(conn_sockfd);
+	while ( n_clients )
+		close(clients[--n_clients].sock_fd);
+
+	stage_close();
+
+	name_index_free();
+	roster_free();
 
 	srecord_list_free(new_records);
 	srecord_list_free(loaded_records);
@@ -157,33 +233,80 @@ static int db_find_record(struct srecord *record, void *cb_data) {
 
 }
 
-static int db_commit_record(struct srecord *record, void *cb_data) {
+static int db_match_roll_number(struct srecord *record, void *cb_data) {
+
+	return record->roll_number == *(int*)cb_data;
+
+}
+
+static int db_index_record(struct srecord *record) {
+
+	return name_index_insert(record) == 0;
+
+}
+
+// Queue a record recovered from the staging file unless it was already committed
+static int db_restage_record(struct srecord *record) {
+
+	struct srecord *record_copy;
+
+	if ( srecord_list_foreach(loaded_records, db_match_roll_number, &record->roll_number) > 0 )
+		return 0;
+
+	if ( !(record_copy = copy_record(record)) )
+		return 0;
+	srecord_list_insert(new_records, record_copy);
+
+	return 1;
+
+}
+
+// Send a record as part of a backup stream
+static int db_send_record(struct srecord *record, void *cb_data) {
+
+	int sock_fd = *(int*)cb_data;
+	unsigned char send_buf[MSG_LEN];
+	struct db_message *msg;
+
+	msg = (struct db_message*)send_buf;
+	memset(send_buf, 0, sizeof(send_buf));
+	msg->status = DB_DATA;
+	msg->roll_number = record->roll_number;
+	memcpy(msg->mac_addr, record->mac_addr, 6);
+	strncpy(msg->name, record->name, MSG_LEN - sizeof(struct db_message) - 1);
+
+	if ( send_msg(sock_fd, msg) < 0 )
+		return 0;
+
+	return 1;
+
+}
+
+static struct srecord *copy_record(struct srecord *record) {
 
-	FILE *db_fd;
 	struct srecord *record_copy;
 
-	// If someone is stupid enough to log in twice
 	record_copy = srecord_new();
 	if ( !record_copy )
-		return 0;
+		return NULL;
 	record_copy->roll_number = record->roll_number;
-	strncpy(record_copy->mac_addr, record->mac_addr, 6);
+	memcpy(record_copy->mac_addr, record->mac_addr, 6);
 	if ( !(record_copy->name = strdup(record->name)) ) {
 		free(record_copy);
-		return 0;
+		return NULL;
 	}
-	srecord_list_insert(loaded_records, record_copy);
 
-	// Write to database file
-	db_fd = *(FILE**)(cb_data);
-	fprintf(db_fd, "%02x:%02x:%02x:%02x:%02x:%02x|%d|%s\n",
-		record->mac_addr[0], record->mac_addr[1],
-		record->mac_addr[2], record->mac_addr[3],
-		record->mac_addr[4], record->mac_addr[5],
-		record->roll_number, record->name
-	);
+	return record_copy;
 
-	return 1;
+}
+
+// Check a roll number against the roster, if there is one
+static int is_enrolled(int roll_number) {
+
+	if ( roster_size() == 0 )
+		return 1;
+
+	return roster_find(roll_number) >= 0;
 
 }
 
@@ -202,16 +325,23 @@ static int retrieve_record(struct msg_data *data) {
 	if ( n_records_found > 0 )
 		return DB_FOUND;
 
+	// Tell registrations apart from students who are not enrolled
+	if ( data->roll_number && !is_enrolled(data->roll_number) )
+		return DB_NOT_ENROLLED;
+
 	return DB_NOT_FOUND;
 
 }
 
-// Store a record in the list of new records
-static int store_record(struct msg_data *data) {
+// Stage a record in the list of new records, leaving the flush to the caller
+static int stage_record(struct msg_data *data) {
 
 	int n_records_found;
 	struct srecord *new_record;
 
+	if ( !is_enrolled(data->roll_number) )
+		return DB_NOT_ENROLLED;
+
 	n_records_found =
 		srecord_list_foreach(loaded_records, db_find_record, (void*)data);
 	if ( n_records_found > 0 )
@@ -236,16 +366,34 @@ static int store_record(struct msg_data *data) {
 
 	srecord_list_insert(new_records, new_record);
 
+	if ( name_index_insert(new_record) < 0 )
+		printf("Index warning: Record %d is not searchable by name.\n", new_record->roll_number);
+
+	// Keep the record on tmpfs until it is flushed with the next batch
+	if ( new_records->n_srecords == 1 )
+		staged_since = time(NULL);
+	if ( stage_append(new_record) < 0 )
+		printf("Stage warning: Record %d was not staged.\n", new_record->roll_number);
+
 	return DB_OP_SUCCESS;
 
 }
 
+// Store a record in the list of new records, flushing once enough are staged
+static int store_record(struct msg_data *data) {
+
+	int status;
+
+	if ( (status = stage_record(data)) == DB_OP_SUCCESS && stage_size() >= DB_FLUSH_BYTES )
+		commit_records();
+
+	return status;
+
+}
+
 // Save the new records to the database file
 static int commit_records(void) {
 
-	FILE *db_fd;
-	int n_records_committed, ret;
-
 	/*
 	 *
 	 * Do not unnecessarily disturb
@@ -256,34 +404,339 @@ static int commit_records(void) {
 	if ( new_records->n_srecords == 0 )
 		return DB_OP_SUCCESS;
 
-	ret = DB_OP_SUCCESS;
-
-	db_fd = fopen(DB_FILE, "a");
-	if ( !db_fd ) {
-		perror("Error appending to database file");
+	/* One batched write for all staged records */
+	if ( stage_flush(new_records, DB_FILE) < 0 ) {
+		printf("Commit warning: Staged records were kept for the next flush.\n");
 		return DB_OP_FAILED;
 	}
 
-	n_records_committed =
-		srecord_list_foreach(new_records, db_commit_record, &db_fd);
+	/* The records stay where they are in the name index */
+	srecord_list_splice(loaded_records, new_records);
+
+	return DB_OP_SUCCESS;
 
-	if ( n_records_committed < new_records->n_srecords ) {
-		printf("Commit warning: Not all temporary records were committed.\n");
-		ret = DB_OP_PARTIAL;
+}
+
+// Load the database file along with records left in the staging file
+static int recover_records(void) {
+
+	struct srecord_list *staged_records;
+
+	if ( !(staged_records = stage_recover(DB_STAGE_FILE, DB_FILE)) )
+		return -1;
+
+	if ( access(DB_FILE, F_OK) < 0 && access(DB_TEXT_FILE, F_OK) == 0 ) {
+		if ( convert_text_records() < 0 ) {
+			srecord_list_free(staged_records);
+			return -1;
+		}
 	}
 
-	/*
-	 * XXX: Emptying all records even if
-	 * some were not committed.
-	 */
-	srecord_list_empty(new_records);
+	if ( !(loaded_records = srecord_list_load_segments(DB_FILE)) ) {
+		srecord_list_free(staged_records);
+		return -1;
+	}
+
+	if ( !(new_records = srecord_list_new()) ) {
+		srecord_list_free(staged_records);
+		srecord_list_free(loaded_records);
+		return -1;
+	}
+
+	srecord_list_foreach(staged_records, db_restage_record, NULL);
+	srecord_list_free(staged_records);
 
-	fclose(db_fd);
+	if ( new_records->n_srecords > 0 ) {
+		printf("Recovered %d staged records.\n", new_records->n_srecords);
+		staged_since = time(NULL);
+	}
+
+	if ( stage_open(DB_STAGE_FILE, new_records) < 0 ) {
+		srecord_list_free(new_records);
+		srecord_list_free(loaded_records);
+		return -1;
+	}
+
+	if ( srecord_list_foreach(loaded_records, db_index_record, NULL) < loaded_records->n_srecords ||
+		srecord_list_foreach(new_records, db_index_record, NULL) < new_records->n_srecords ) {
+		printf("Failed to build the name index.\n");
+		stage_close();
+		srecord_list_free(new_records);
+		srecord_list_free(loaded_records);
+		return -1;
+	}
+
+	return 0;
+
+}
+
+// Convert the text database of older releases to segments
+static int convert_text_records(void) {
+
+	FILE *db_fd;
+	int ret, batch_len;
+	unsigned char *batch;
+	struct srecord_list *text_records;
+
+	if ( !(text_records = srecord_list_load(DB_TEXT_FILE)) )
+		return -1;
+
+	if ( srecord_list_encode(text_records, &batch, &batch_len) < 0 ) {
+		srecord_list_free(text_records);
+		return -1;
+	}
+
+	ret = 0;
+	if ( !(db_fd = fopen(DB_FILE ".tmp", "wb")) ||
+		fwrite(batch, 1, batch_len, db_fd) != (size_t)batch_len ||
+		fflush(db_fd) != 0 || fsync(fileno(db_fd)) < 0 ) {
+		perror("Error converting database file");
+		ret = -1;
+	}
+	if ( db_fd )
+		fclose(db_fd);
+
+	if ( ret == 0 && rename(DB_FILE ".tmp", DB_FILE) < 0 ) {
+		perror("Error converting database file");
+		ret = -1;
+	}
+
+	if ( ret == 0 )
+		printf("Converted %d records from \"%s\".\n", text_records->n_srecords, DB_TEXT_FILE);
+
+	free(batch);
+	srecord_list_free(text_records);
 
 	return ret;
 
 }
 
+/*
+ *
+ * Stream a point-in-time snapshot of all committed and pending
+ * records. The snapshot is taken by forking: the child sees the
+ * records as they were at the fork and streams them at a low
+ * priority while the parent goes back to serving requests.
+ *
+ */
+static int backup_records(int sock_fd) {
+
+	pid_t pid;
+	int i;
+	unsigned char send_buf[MSG_LEN];
+	struct db_message *msg;
+
+	if ( (pid = fork()) < 0 ) {
+		perror("fork() failed");
+		return -1;
+	}
+
+	if ( pid > 0 )
+		// Parent, the child owns the connection now
+		return 0;
+
+	close(database_sockfd);
+	for (i = 0; i < n_clients; i++)
+		if ( clients[i].sock_fd != sock_fd )
+			close(clients[i].sock_fd);
+	if ( nice(10) < 0 )
+		perror("nice() failed");
+
+	if ( srecord_list_foreach(loaded_records, db_send_record, &sock_fd) < loaded_records->n_srecords ||
+		srecord_list_foreach(new_records, db_send_record, &sock_fd) < new_records->n_srecords )
+		_exit(1);
+
+	msg = (struct db_message*)send_buf;
+	memset(send_buf, 0, sizeof(send_buf));
+	msg->status = DB_END_DATA;
+	msg->roll_number = loaded_records->n_srecords + new_records->n_srecords;
+	if ( send_msg(sock_fd, msg) < 0 )
+		_exit(1);
+
+	close(sock_fd);
+
+	_exit(0);
+
+}
+
+/*
+ * Stream up to max_results records whose name starts with the
+ * name in the query, ignoring case, in alphabetical order.
+ */
+static int search_records(struct msg_data *data, int max_results, int sock_fd) {
+
+	int i, n_results;
+	unsigned char send_buf[MSG_LEN];
+	struct srecord *results[DB_MAX_RESULTS];
+	struct db_message *msg;
+
+	if ( max_results <= 0 || max_results > DB_MAX_RESULTS )
+		max_results = DB_MAX_RESULTS;
+
+	((char*)data)[MSG_LEN - sizeof(struct msg_hdr) - 1] = '\0';
+	n_results = name_index_search(data->name, results, max_results);
+
+	for ( i = 0; i < n_results; i++ )
+		if ( !db_send_record(results[i], &sock_fd) )
+			return -1;
+
+	msg = (struct db_message*)send_buf;
+	memset(send_buf, 0, sizeof(send_buf));
+	msg->status = DB_END_DATA;
+	msg->roll_number = n_results;
+	if ( send_msg(sock_fd, msg) < 0 )
+		return -1;
+
+	return 0;
+
+}
+
+/*
+ * Load the next message of a restore stream. The stream is taken a
+ * message at a time through the poll loop like any request, so a
+ * client trickling its records does not hold up the others. Returns 0
+ * to wait for more of the stream, or -1 once it ended and the
+ * connection is to be closed.
+ */
+static int restore_record(struct db_client *client, struct db_message *msg) {
+
+	struct msg_data *data = (struct msg_data*)(client->recv_buf + sizeof(struct msg_hdr));
+
+	if ( msg->status == DB_DATA ) {
+		/* Records that already exist are left alone */
+		client->recv_buf[MSG_LEN - 1] = '\0';
+		client->n_received++;
+		if ( stage_record(data) == DB_OP_SUCCESS )
+			client->n_restored++;
+	}
+
+	if ( msg->status != DB_END_DATA )
+		return 0;
+
+	/* What the flush timer left of the stream goes to flash in one batched write */
+	commit_records();
+
+	memset(client->recv_buf, 0, sizeof(client->recv_buf));
+	msg->status = client->n_restored < client->n_received ? DB_OP_PARTIAL : DB_OP_SUCCESS;
+	msg->roll_number = client->n_restored;
+	send_msg(client->sock_fd, msg);
+
+	return -1;
+
+}
+
+// Time left until staged records are due for a flush
+static int flush_timeout(struct timeval *tv) {
+
+	time_t elapsed;
+
+	if ( new_records->n_srecords == 0 )
+		return 0;
+
+	elapsed = time(NULL) - staged_since;
+
+	tv->tv_sec = elapsed < DB_FLUSH_INTERVAL ? DB_FLUSH_INTERVAL - elapsed : 0;
+	tv->tv_usec = 0;
+
+	return 1;
+
+}
+
+// Milliseconds poll may wait for, until a flush is due or a request times out
+static int poll_timeout(void) {
+
+	struct timeval tv;
+	int i, left, timeout = -1;
+
+	if ( flush_timeout(&tv) )
+		timeout = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	for (i = 0; i < n_clients; i++)
+		if ( (left = sockio_part_left(&clients[i].part)) >= 0 && (timeout < 0 || left < timeout) )
+			timeout = left;
+
+	return timeout;
+
+}
+
+static void accept_client(void) {
+
+	struct sockaddr_in peer_addr;
+	socklen_t peer_addrlen;
+	int conn_sockfd;
+
+	peer_addrlen = sizeof(peer_addr);
+	conn_sockfd = accept(database_sockfd, (struct sockaddr*)&peer_addr, &peer_addrlen);
+
+	if ( conn_sockfd < 0 ) {
+		perror("accept() failed");
+		return;
+	}
+
+	if ( n_clients == DB_MAX_CLIENTS ) {
+		printf("Too many open connections, refusing a client.\n");
+		close(conn_sockfd);
+		return;
+	}
+
+	memset(&clients[n_clients], 0, sizeof(struct db_client));
+	clients[n_clients++].sock_fd = conn_sockfd;
+
+	return;
+
+}
+
+/*
+ * Serve the next request of a client. Returns 0 to keep the connection
+ * open for more requests, -1 to close it, or 1 to close it and exit.
+ */
+static int serve_client(struct db_client *client) {
+
+	struct sockio_stats stats;
+	struct db_message *msg;
+	int status, sock_fd = client->sock_fd;
+
+	msg = (struct db_message*)client->recv_buf;
+
+	if ( (status = sockio_recv_part(sock_fd, client->recv_buf, MSG_LEN, &client->part, DB_IO_TIMEOUT * 1000)) == 0 )
+		// The rest of the request is yet to come
+		return 0;
+
+	if ( status == SOCKIO_TIMEOUT ) {
+		sockio_stats(&stats);
+		printf("Dropped a client that took over %d s to send its request, %lld timeouts so far.\n",
+			DB_IO_TIMEOUT, stats.n_timeouts);
+	}
+
+	if ( status < 0 )
+		// The client is done with the connection
+		return -1;
+
+	ntohmsg(msg);
+
+	if ( client->restoring )
+		return restore_record(client, msg);
+
+	if ( msg->operation == OP_EXIT )
+		return 1;
+
+	/* The records of a restore follow as requests of their own */
+	if ( msg->operation == OP_RESTORE ) {
+		client->restoring = 1;
+		return 0;
+	}
+
+	if ( database_server_handle_msg(msg, sock_fd) < 0 )
+		return -1;
+
+	/* Streams end with the connection, a backup process took it over */
+	if ( msg->operation == OP_BACKUP || msg->operation == OP_SEARCH )
+		return -1;
+
+	return 0;
+
+}
+
 static int database_server_handle_msg(struct db_message *msg, int sock_fd) {
 
 	int status;
@@ -291,6 +744,12 @@ static int database_server_handle_msg(struct db_message *msg, int sock_fd) {
 	struct msg_data *data =
 		(struct msg_data*)(((char*)msg) + sizeof(struct msg_hdr));
 
+	/* Streaming operations reply on their own */
+	if ( msg->operation == OP_BACKUP )
+		return backup_records(sock_fd);
+	if ( msg->operation == OP_SEARCH )
+		return search_records(data, msg->roll_number, sock_fd);
+
 	switch ( msg->operation ) {
 
 		case OP_GET:
@@ -307,6 +766,7 @@ static int database_server_handle_msg(struct db_message *msg, int sock_fd) {
 
 		default:
 			/* Bad operation, ignore */
+			status = DB_BAD_QUERY;
 			break;
 
 	}
@@ -326,7 +786,7 @@ static int database_server_handle_msg(struct db_message *msg, int sock_fd) {
 
 static int db_socket_new(char *ip, char *port) {
 
-	int database_sockfd;
+	int database_sockfd, reuse = 1;
 	struct sockaddr_in server_addr;
 
 	database_sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -335,6 +795,10 @@ static int db_socket_new(char *ip, char *port) {
 		return -1;
 	}
 
+	/* Clients keep connections open, so a restart would find the port in TIME_WAIT */
+	if ( setsockopt(database_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 )
+		perror("setsockopt() failed");
+
 	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;
 	server_addr.sin_port = htons(atoi(port));
@@ -354,53 +818,9 @@ static int db_socket_new(char *ip, char *port) {
 
 }
 
-static int recv_data(int sock_fd, char *recv_buf, int recv_len) {
-
-	while ( recv_len ) {
-
-		int n_received;
-
-		n_received = recv(sock_fd, recv_buf, recv_len, 0);
-
-		if ( n_received < 0 ) {
-			perror("recv() failed");
-			return -1;
-		}
-
-		recv_buf += n_received;
-		recv_len -= n_received;
-
-	}
-
-	return 0;
-
-}
-
-static int send_data(int sock_fd, char *send_buf, int send_len) {
-
-	while ( send_len ) {
-
-		int n_sent;
-
-		n_sent = send(sock_fd, send_buf, send_len, 0);
-
-		if ( n_sent < 0 ) {
-			perror("send() failed");
-			return -1;
-		}
-
-		send_buf += n_sent;
-		send_len -= n_sent;
-
-	}
-
-	return 0;
-
-}
-
 static void htonmsg(struct db_message *msg) {
 
-	msg->operation = htonl(msg->operation);
+	/* The operation code is a single byte and needs no conversion */
 	msg->roll_number = htonl(msg->roll_number);
 
 	return;
@@ -409,33 +829,19 @@ static void htonmsg(struct db_message *msg) {
 
 static void ntohmsg(struct db_message *msg) {
 
-	msg->operation = ntohl(msg->operation);
+	/* The operation code is a single byte and needs no conversion */
 	msg->roll_number = ntohl(msg->roll_number);
 
 	return;
 
 }
 
-static int recv_msg(int sock_fd, struct db_message *msg) {
-
-	int ret;
-
-	if ( recv_data(sock_fd, (char*)msg, MSG_LEN) < 0 )
-		return -1;
-
-	ntohmsg(msg);
-
-	return 0;
-
-}
-
 static int send_msg(int sock_fd, struct db_message *msg) {
 
-	int ret;
-
 	htonmsg(msg);
 
-	if ( send_data(sock_fd, (char*)msg, MSG_LEN) < 0 )
+	// A client that stops reading its replies is given up on rather than waited for
+	if ( sockio_send(sock_fd, msg, MSG_LEN, DB_IO_TIMEOUT * 1000) < 0 )
 		return -1;
 
 	return 0;
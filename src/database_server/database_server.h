@@ -4,12 +4,30 @@
 #ifndef DATABASE_SERVER_H
 #define DATABASE_SERVER_H
 
-#define DB_FILE		"/root/attendance-tools-servers/student_records.db"
+#define DB_FILE		"/root/attendance-tools-servers/student_records.seg"
+
+/* Text database of older releases, converted to DB_FILE on first start */
+#define DB_TEXT_FILE	"/root/attendance-tools-servers/student_records.db"
+
+/* Roll numbers allowed to register, everyone is allowed if missing */
+#define DB_ROSTER_FILE	"/root/attendance-tools-servers/roster.txt"
+
+/* Staging of new records on tmpfs before they are written to flash */
+#define DB_STAGE_FILE		"/tmp/student_records.stage"
+#define DB_FLUSH_BYTES		4096	/* Flush once a flash page worth of records is staged */
+#define DB_FLUSH_INTERVAL	60	/* Flush staged records after this many seconds */
+
+/* Clients may keep their connection open and send any number of requests on it */
+#define DB_MAX_CLIENTS		32	/* Most connections held open at once */
+#define DB_IO_TIMEOUT		2	/* Seconds a client may take to send a request or read a reply */
 
 #define OP_GET		0x00
 #define OP_PUT		0x01
 #define OP_COMMIT	0x02
 #define OP_EXIT		0x03
+#define OP_BACKUP	0x04
+#define OP_RESTORE	0x05
+#define OP_SEARCH	0x06
 
 #define DB_OP_SUCCESS	0x00
 #define DB_OP_FAILED	0x01
@@ -17,8 +35,12 @@
 #define DB_FOUND	0x03
 #define DB_NOT_FOUND	0x04
 #define DB_BAD_QUERY	0x05
+#define DB_DATA		0x07	/* Message carries a record of a backup or restore stream */
+#define DB_END_DATA	0x08	/* End of a backup or restore stream */
+#define DB_NOT_ENROLLED	0x09	/* Roll number is not on the roster */
 
 #define MAXNAMESZ	64
+#define DB_MAX_RESULTS	32	/* Most records returned by a name search */
 #define MSG_LEN		256
 
 
@@ -0,0 +1,168 @@
+/*!
+
+	@file name_index.c
+
+	@brief Case-insensitive prefix index over student names.
+
+	The index is a sorted array of pointers to srecord nodes, so
+	that all names starting with a given prefix are adjacent and
+	can be found with a binary search. Insertion is O(n) due to the
+	shift of the array tail, which is cheap compared to the network
+	round trip of a registration. The nodes are owned by the record
+	lists of the database server and must outlive the index.
+
+*/
+
+
+
+#ifndef NAME_INDEX_C
+#define NAME_INDEX_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "srecord_list.h"
+#include "name_index.h"
+
+
+
+/// Records sorted by name, ignoring case
+static struct srecord **index_records;
+
+/// Number of records in the index
+static int n_indexed;
+
+/// Number of records the index has room for
+static int index_capacity;
+
+
+
+/*!
+
+	@brief Find the first position whose name is not less than a
+	key, ignoring case.
+
+*/
+static int lower_bound(const char *key) {
+
+	int low = 0, high = n_indexed;
+
+	while ( low < high ) {
+
+		int mid = low + (high - low) / 2;
+
+		if ( strcasecmp(index_records[mid]->name, key) < 0 )
+			low = mid + 1;
+		else
+			high = mid;
+
+	}
+
+	return low;
+
+}
+
+/*!
+
+	@brief Add a record to the index.
+
+	@param srecord Pointer to the srecord node to index.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int name_index_insert(struct srecord *srecord) {
+
+	int pos;
+
+	if ( !srecord->name )
+		return -1;
+
+	if ( n_indexed == index_capacity ) {
+
+		int new_capacity = index_capacity ? 2 * index_capacity : 256;
+		struct srecord **new_records;
+
+		new_records = (struct srecord**)realloc(index_records,
+			new_capacity * sizeof(*new_records));
+		if ( !new_records ) {
+			printf("name_index_insert: Memory allocation failure.\n");
+			return -1;
+		}
+
+		index_records = new_records;
+		index_capacity = new_capacity;
+
+	}
+
+	/* Equal names keep their insertion order */
+	pos = lower_bound(srecord->name);
+	while ( pos < n_indexed && strcasecmp(index_records[pos]->name, srecord->name) == 0 )
+		pos++;
+
+	memmove(&index_records[pos + 1], &index_records[pos],
+		(n_indexed - pos) * sizeof(*index_records));
+	index_records[pos] = srecord;
+	n_indexed++;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Find the records whose name starts with a prefix,
+	ignoring case.
+
+	@param prefix C string to match names against.
+	@param results Array to store pointers to the matching records in.
+	@param max_results Size of the results array.
+
+	@return Number of matching records stored, in alphabetical order.
+
+*/
+int name_index_search(const char *prefix, struct srecord **results, int max_results) {
+
+	int pos, n_results = 0;
+	size_t prefix_len = strlen(prefix);
+
+	for ( pos = lower_bound(prefix); pos < n_indexed && n_results < max_results; pos++ ) {
+
+		if ( strncasecmp(index_records[pos]->name, prefix, prefix_len) != 0 )
+			break;
+
+		results[n_results++] = index_records[pos];
+
+	}
+
+	return n_results;
+
+}
+
+/*!
+
+	@brief Free the index. The indexed records are left alone.
+
+*/
+void name_index_free(void) {
+
+	free(index_records);
+
+	index_records = NULL;
+	n_indexed = 0;
+	index_capacity = 0;
+
+	return;
+
+}
+
+
+
+#endif /* NAME_INDEX_C */
+
+
+
@@ -0,0 +1,28 @@
+/*!
+
+	@file name_index.h
+	@brief Header file for the name prefix index.
+
+*/
+
+
+
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+
+
+#include "srecord_list.h"
+
+
+
+int name_index_insert(struct srecord *srecord);
+int name_index_search(const char *prefix, struct srecord **results, int max_results);
+void name_index_free(void);
+
+
+
+#endif /* NAME_INDEX_H */
+
+
+
@@ -0,0 +1,225 @@
+/*!
+
+	@file roster.c
+
+	@brief Enrollment roster of roll numbers.
+
+	The roster is loaded from a text file with one roll number or
+	one inclusive range of roll numbers per line, for example:
+		- 19100009
+		- 19100001-19100400
+	Empty lines and lines starting with '#' are ignored.
+
+	Roll numbers are kept in a sorted array without duplicates, so
+	a lookup is a binary search and the position of a roll number
+	in the array can double as a dense index for it.
+
+*/
+
+
+
+#ifndef ROSTER_C
+#define ROSTER_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "roster.h"
+
+
+
+/// Maximum line size to assume when loading the roster
+#define MAX_LINESZ 1024
+
+/// Largest range of roll numbers accepted on a single line
+#define MAX_RANGE 100000
+
+
+
+/// Sorted roll numbers on the roster
+static int *roster;
+
+/// Number of roll numbers on the roster
+static int n_enrolled;
+
+
+
+static int compare_roll_numbers(const void *a, const void *b) {
+
+	int x = *(const int*)a, y = *(const int*)b;
+
+	return (x > y) - (x < y);
+
+}
+
+static int roster_add(int roll_number, int *capacity) {
+
+	if ( n_enrolled == *capacity ) {
+
+		int new_capacity = *capacity ? 2 * *capacity : 1024;
+		int *new_roster = (int*)realloc(roster, new_capacity * sizeof(int));
+
+		if ( !new_roster ) {
+			printf("roster_add: Memory allocation failure.\n");
+			return -1;
+		}
+
+		roster = new_roster;
+		*capacity = new_capacity;
+
+	}
+
+	roster[n_enrolled++] = roll_number;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Load the roster from a file, replacing any loaded roster.
+
+	@param file_name C string containing absolute or relative path
+	to the roster file.
+
+	@return Number of roll numbers on the roster, or -1 if the file
+	could not be loaded.
+
+*/
+int roster_load(const char *file_name) {
+
+	FILE *fd;
+	int i, n_unique, capacity = 0;
+	char line[MAX_LINESZ];
+
+	roster_free();
+
+	if ( !(fd = fopen(file_name, "rb")) )
+		return -1;
+
+	while ( fgets(line, sizeof(line), fd) ) {
+
+		int first, last, n_parsed;
+
+		if ( line[0] == '#' || line[0] == '\n' )
+			continue;
+
+		n_parsed = sscanf(line, "%d-%d", &first, &last);
+		if ( n_parsed < 1 ) {
+			printf("Skipping malformed roster line: %s", line);
+			continue;
+		}
+		if ( n_parsed == 1 )
+			last = first;
+		if ( last < first || last - first >= MAX_RANGE ) {
+			printf("Skipping bad roster range: %s", line);
+			continue;
+		}
+
+		for ( ; first <= last; first++ ) {
+			if ( roster_add(first, &capacity) < 0 ) {
+				fclose(fd);
+				roster_free();
+				return -1;
+			}
+		}
+
+	}
+
+	fclose(fd);
+
+	if ( n_enrolled == 0 )
+		return 0;
+
+	qsort(roster, n_enrolled, sizeof(int), compare_roll_numbers);
+
+	/* Drop duplicates from overlapping lines */
+	n_unique = 1;
+	for ( i = 1; i < n_enrolled; i++ )
+		if ( roster[i] != roster[n_unique - 1] )
+			roster[n_unique++] = roster[i];
+	n_enrolled = n_unique;
+
+	return n_enrolled;
+
+}
+
+/*!
+
+	@brief Number of roll numbers on the roster.
+
+*/
+int roster_size(void) {
+
+	return n_enrolled;
+
+}
+
+/*!
+
+	@brief Look up a roll number on the roster in O(log n).
+
+	@param roll_number Roll number to look up.
+
+	@return Position of the roll number on the roster, or -1 if it
+	is not on the roster.
+
+*/
+int roster_find(int roll_number) {
+
+	int low = 0, high = n_enrolled - 1;
+
+	while ( low <= high ) {
+
+		int mid = low + (high - low) / 2;
+
+		if ( roster[mid] == roll_number )
+			return mid;
+
+		if ( roster[mid] < roll_number )
+			low = mid + 1;
+		else
+			high = mid - 1;
+
+	}
+
+	return -1;
+
+}
+
+/*!
+
+	@brief Roll number at a position on the roster.
+
+*/
+int roster_roll_number(int pos) {
+
+	return roster[pos];
+
+}
+
+/*!
+
+	@brief Free the loaded roster.
+
+*/
+void roster_free(void) {
+
+	free(roster);
+
+	roster = NULL;
+	n_enrolled = 0;
+
+	return;
+
+}
+
+
+
+#endif /* ROSTER_C */
+
+
+
@@ -0,0 +1,445 @@
+/*!
+
+	@file segment.c
+
+	@brief Checksummed segment file format.
+
+	A segment file is a sequence of segments, each made of a
+	segment_hdr followed by a payload of packed records. The payload
+	encoding is up to the user of the file. Segments are only ever
+	appended, so a torn write can only damage the last segment of a
+	batch. Such segments fail their checksum and are skipped, and
+	garbage between segments is skipped by searching for the next
+	segment magic.
+
+	The length in the header of a segment is only trusted once the
+	segment passed its checksum. A torn segment followed by later
+	appends would otherwise have its length reach into the segments
+	after it, and hide them. Segments are indexed by their headers,
+	verified in parallel, and the file is indexed again from just past
+	the first segment that fails, until every segment indexed is
+	sound. Verified segments are decoded in parallel by
+	segment_file_decode.
+
+*/
+
+
+
+#ifndef SEGMENT_C
+#define SEGMENT_C
+
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "segment.h"
+
+
+
+/*!
+
+	@brief Work shared by the decoding threads.
+
+*/
+struct decode_job {
+
+	struct segment_file *file;
+	segment_decode decode;
+	char *outs;
+	int out_size;
+
+	/// Index of the first segment for this thread
+	int first;
+
+	/// Number of threads, i.e. the stride between segments
+	int stride;
+
+};
+
+
+
+static unsigned crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+
+	unsigned i, j;
+
+	for ( i = 0; i < 256; i++ ) {
+		unsigned crc = i;
+		for ( j = 0; j < 8; j++ )
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		crc_table[i] = crc;
+	}
+
+	return;
+
+}
+
+/*!
+
+	@brief Update a CRC-32 (IEEE 802.3) with a buffer.
+
+	@param crc CRC of the preceding data, or 0 to start a new one.
+	@param buf Data to add.
+	@param len Length of the data.
+
+	@return The updated CRC.
+
+*/
+unsigned segment_crc32(unsigned crc, const unsigned char *buf, unsigned len) {
+
+	pthread_once(&crc_table_once, crc_table_init);
+
+	crc = ~crc;
+	while ( len-- )
+		crc = crc_table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+
+}
+
+static unsigned segment_checksum(const struct segment_hdr *hdr, const unsigned char *payload,
+	unsigned payload_len) {
+
+	unsigned crc;
+	const unsigned char *covered = (const unsigned char*)&hdr->n_records;
+
+	crc = segment_crc32(0, covered, sizeof(*hdr) - (covered - (const unsigned char*)hdr));
+
+	return segment_crc32(crc, payload, payload_len);
+
+}
+
+/*!
+
+	@brief Fill in the header of a segment.
+
+	The payload must already be in place right after the space for
+	the header.
+
+	@param segment Buffer holding the segment.
+	@param payload_len Length of the payload.
+	@param n_records Number of records in the payload.
+	@param min_key Smallest key in the payload.
+	@param max_key Largest key in the payload.
+
+	@return Total length of the segment.
+
+*/
+int segment_seal(unsigned char *segment, unsigned payload_len,
+	unsigned n_records, int min_key, int max_key) {
+
+	struct segment_hdr *hdr = (struct segment_hdr*)segment;
+
+	hdr->magic = htonl(SEGMENT_MAGIC);
+	hdr->n_records = htonl(n_records);
+	hdr->min_key = htonl(min_key);
+	hdr->max_key = htonl(max_key);
+	hdr->payload_len = htonl(payload_len);
+	hdr->crc = htonl(segment_checksum(hdr, segment + sizeof(*hdr), payload_len));
+
+	return sizeof(*hdr) + payload_len;
+
+}
+
+/* Checksum of a segment as indexed, with its header in host byte order */
+static unsigned indexed_checksum(const struct segment *segment) {
+
+	struct segment_hdr hdr = segment->hdr;
+
+	hdr.n_records = htonl(hdr.n_records);
+	hdr.min_key = htonl(hdr.min_key);
+	hdr.max_key = htonl(hdr.max_key);
+	hdr.payload_len = htonl(hdr.payload_len);
+
+	return segment_checksum(&hdr, segment->payload, segment->hdr.payload_len);
+
+}
+
+/* Index the segments from offset on, replacing those indexed past it */
+static int index_segments(struct segment_file *file, long offset) {
+
+	int capacity = file->capacity;
+
+	while ( offset + (long)sizeof(struct segment_hdr) <= file->len ) {
+
+		struct segment *segment;
+		struct segment_hdr hdr;
+
+		memcpy(&hdr, file->data + offset, sizeof(hdr));
+
+		if ( ntohl(hdr.magic) != SEGMENT_MAGIC ||
+			ntohl(hdr.payload_len) > file->len - offset - sizeof(hdr) ) {
+			/* Garbage or a torn segment, look for the next one */
+			offset++;
+			continue;
+		}
+
+		if ( file->n_segments == capacity ) {
+			struct segment *segments;
+			capacity = capacity ? 2 * capacity : 64;
+			segments = (struct segment*)realloc(file->segments, capacity * sizeof(*segments));
+			if ( !segments )
+				return -1;
+			file->segments = segments;
+			file->capacity = capacity;
+		}
+
+		segment = &file->segments[file->n_segments++];
+		segment->hdr.magic = SEGMENT_MAGIC;
+		segment->hdr.crc = ntohl(hdr.crc);
+		segment->hdr.n_records = ntohl(hdr.n_records);
+		segment->hdr.min_key = ntohl(hdr.min_key);
+		segment->hdr.max_key = ntohl(hdr.max_key);
+		segment->hdr.payload_len = ntohl(hdr.payload_len);
+		segment->payload = file->data + offset + sizeof(hdr);
+		segment->valid = 0;
+
+		offset += sizeof(hdr) + segment->hdr.payload_len;
+
+	}
+
+	return 0;
+
+}
+
+static void *verify_segments(void *arg) {
+
+	int i;
+	struct decode_job *job = (struct decode_job*)arg;
+	struct segment_file *file = job->file;
+
+	for ( i = job->first; i < file->n_segments; i += job->stride ) {
+		struct segment *segment = &file->segments[i];
+		segment->valid = indexed_checksum(segment) == segment->hdr.crc;
+	}
+
+	return NULL;
+
+}
+
+static void *decode_segments(void *arg) {
+
+	int i;
+	struct decode_job *job = (struct decode_job*)arg;
+	struct segment_file *file = job->file;
+
+	for ( i = job->first; i < file->n_segments; i += job->stride ) {
+
+		struct segment *segment = &file->segments[i];
+
+		if ( segment->valid && job->decode(segment, job->outs + (long)i * job->out_size) < 0 )
+			segment->valid = 0;
+
+	}
+
+	return NULL;
+
+}
+
+/*
+ * Run work over the segments from first on, spread over up to one
+ * thread per online CPU.
+ */
+static void run_parallel(struct decode_job *job, int first, void *(*work)(void*)) {
+
+	int i, n_threads, n_started;
+	pthread_t threads[SEGMENT_MAX_THREADS];
+	struct decode_job jobs[SEGMENT_MAX_THREADS];
+
+	n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ( n_threads > SEGMENT_MAX_THREADS )
+		n_threads = SEGMENT_MAX_THREADS;
+	if ( n_threads > job->file->n_segments - first )
+		n_threads = job->file->n_segments - first;
+	if ( n_threads < 1 )
+		n_threads = 1;
+
+	for ( i = 0; i < n_threads; i++ ) {
+		jobs[i] = *job;
+		jobs[i].first = first + i;
+		jobs[i].stride = n_threads;
+	}
+
+	/* The calling thread takes the first share */
+	for ( n_started = 1; n_started < n_threads; n_started++ )
+		if ( pthread_create(&threads[n_started], NULL, work, &jobs[n_started]) != 0 )
+			break;
+
+	/* ...as well as the shares of threads that failed to start */
+	work(&jobs[0]);
+	for ( i = n_started; i < n_threads; i++ )
+		work(&jobs[i]);
+
+	for ( i = 1; i < n_started; i++ )
+		pthread_join(threads[i], NULL);
+
+	return;
+
+}
+
+/* Index the file until every segment indexed passes its checksum */
+static int find_segments(struct segment_file *file) {
+
+	struct decode_job job;
+	long indexed = 0;
+	int i, first = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.file = file;
+
+	if ( index_segments(file, 0) < 0 )
+		return -1;
+
+	while ( first < file->n_segments ) {
+
+		run_parallel(&job, first, verify_segments);
+
+		for ( i = first; i < file->n_segments && file->segments[i].valid; i++ )
+			;
+		if ( i == file->n_segments )
+			break;
+
+		/* Its length cannot be trusted, resync on the byte after its start */
+		file->n_segments = i;
+		first = i;
+		if ( index_segments(file, file->segments[i].payload - file->data - sizeof(struct segment_hdr) + 1) < 0 )
+			return -1;
+
+	}
+
+	for ( i = 0; i < file->n_segments; i++ )
+		indexed += sizeof(struct segment_hdr) + file->segments[i].hdr.payload_len;
+	file->n_skipped = file->len - indexed;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Read a segment file into memory and find its segments.
+
+	A missing file is treated as an empty one.
+
+	@param file_name C string containing absolute or relative path
+	to the segment file.
+	@param file Segment file struct to initialize.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int segment_file_open(const char *file_name, struct segment_file *file) {
+
+	FILE *fd;
+	struct stat st;
+
+	memset(file, 0, sizeof(*file));
+
+	if ( !(fd = fopen(file_name, "rb")) ) {
+		if ( errno == ENOENT )
+			return 0;
+		printf("Failed to open file \"%s\"\n", file_name);
+		return -1;
+	}
+
+	if ( fstat(fileno(fd), &st) < 0 ) {
+		fclose(fd);
+		return -1;
+	}
+
+	file->len = st.st_size;
+	if ( file->len && !(file->data = (unsigned char*)malloc(file->len)) ) {
+		printf("segment_file_open: Memory allocation failure.\n");
+		fclose(fd);
+		return -1;
+	}
+
+	if ( fread(file->data, 1, file->len, fd) != (size_t)file->len ) {
+		printf("Failed to read file \"%s\"\n", file_name);
+		segment_file_close(file);
+		fclose(fd);
+		return -1;
+	}
+
+	fclose(fd);
+
+	if ( find_segments(file) < 0 ) {
+		printf("segment_file_open: Memory allocation failure.\n");
+		segment_file_close(file);
+		return -1;
+	}
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Decode all verified segments of a file in parallel.
+
+	Segments are spread over up to one thread per online CPU. The
+	output for segment i is written to the i-th element of outs.
+	Segments that fail to decode are left invalid and their output
+	is left untouched.
+
+	@param file Segment file opened with segment_file_open.
+	@param decode Callback decoding the payload of one segment.
+	@param outs Array of file->n_segments output elements.
+	@param out_size Size of each output element.
+
+	@return Number of valid segments.
+
+*/
+int segment_file_decode(struct segment_file *file, segment_decode decode, void *outs, int out_size) {
+
+	struct decode_job job;
+	int i, n_valid;
+
+	memset(&job, 0, sizeof(job));
+	job.file = file;
+	job.decode = decode;
+	job.outs = (char*)outs;
+	job.out_size = out_size;
+
+	run_parallel(&job, 0, decode_segments);
+
+	n_valid = 0;
+	for ( i = 0; i < file->n_segments; i++ )
+		n_valid += file->segments[i].valid;
+
+	return n_valid;
+
+}
+
+/*!
+
+	@brief Release the memory held by a segment file.
+
+*/
+void segment_file_close(struct segment_file *file) {
+
+	free(file->segments);
+	free(file->data);
+
+	memset(file, 0, sizeof(*file));
+
+	return;
+
+}
+
+
+
+#endif /* SEGMENT_C */
+
+
+
@@ -0,0 +1,341 @@
+/*!
+
+	@file sockio.c
+
+	@brief Socket I/O with deadlines, shared by the servers and clients.
+
+	Transfers never block in the kernel. A transfer tries the socket
+	without waiting and only polls it when the socket is not ready,
+	so a transfer that needs a single call costs a single call. The
+	timeout of a transfer bounds the whole of it rather than each
+	wait, so a peer trickling a message a byte at a time cannot hold
+	it up for longer than a peer sending nothing at all.
+
+	A peer closing the connection ends a transfer with SOCKIO_EOF,
+	whether or not part of the message arrived.
+
+	Servers serving many connections from one thread receive
+	requests with sockio_recv_part instead, which takes whatever has
+	arrived and returns, and gives up on the message once it has been
+	arriving for longer than its timeout.
+
+*/
+
+
+
+#ifndef SOCKIO_C
+#define SOCKIO_C
+
+
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "sockio.h"
+
+
+
+/// Failed transfers, updated atomically as servers transfer from many threads
+static struct sockio_stats stats;
+
+
+
+static long long now_ms(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+
+}
+
+static long long deadline_of(int timeout_ms) {
+
+	return timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+
+}
+
+/* Count a failed transfer and return its result */
+static int failed(int status, int truncated) {
+
+	if ( status == SOCKIO_TIMEOUT )
+		__sync_fetch_and_add(&stats.n_timeouts, 1);
+
+	if ( status == SOCKIO_EOF ) {
+		__sync_fetch_and_add(&stats.n_eofs, 1);
+		if ( truncated )
+			__sync_fetch_and_add(&stats.n_truncated, 1);
+	}
+
+	if ( status == SOCKIO_ERROR )
+		__sync_fetch_and_add(&stats.n_errors, 1);
+
+	return status;
+
+}
+
+/* Wait until the socket is ready or the deadline passes */
+static int wait_ready(int sock_fd, short events, long long deadline) {
+
+	struct pollfd pfd;
+
+	pfd.fd = sock_fd;
+	pfd.events = events;
+
+	while ( 1 ) {
+
+		int n_ready, wait_ms = -1;
+
+		if ( deadline >= 0 && (wait_ms = deadline - now_ms()) <= 0 )
+			return failed(SOCKIO_TIMEOUT, 0);
+
+		// Errors and hangups also end the wait, the next transfer reports them
+		if ( (n_ready = poll(&pfd, 1, wait_ms)) > 0 )
+			return 0;
+
+		if ( n_ready < 0 && errno != EINTR ) {
+			perror("poll() failed");
+			return failed(SOCKIO_ERROR, 0);
+		}
+
+	}
+
+}
+
+static int would_block(void) {
+
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+
+}
+
+/*!
+
+	@brief Receive len bytes.
+
+	@param timeout_ms Milliseconds the whole message may take, or
+	SOCKIO_NO_TIMEOUT.
+	@return 0 once every byte arrived, or SOCKIO_EOF, SOCKIO_TIMEOUT
+	or SOCKIO_ERROR.
+
+*/
+int sockio_recv(int sock_fd, void *buf, int len, int timeout_ms) {
+
+	char *recv_buf = (char*)buf;
+	long long deadline = deadline_of(timeout_ms);
+	int status, recv_len = len;
+
+	while ( recv_len ) {
+
+		ssize_t n_received = recv(sock_fd, recv_buf, recv_len, MSG_DONTWAIT);
+
+		if ( n_received > 0 ) {
+			recv_buf += n_received;
+			recv_len -= n_received;
+			continue;
+		}
+
+		if ( n_received == 0 )
+			return failed(SOCKIO_EOF, recv_len < len);
+
+		if ( errno == EINTR )
+			continue;
+
+		if ( !would_block() ) {
+			perror("recv() failed");
+			return failed(SOCKIO_ERROR, 0);
+		}
+
+		if ( (status = wait_ready(sock_fd, POLLIN, deadline)) < 0 )
+			return status;
+
+	}
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Send len bytes.
+
+	@param timeout_ms Milliseconds the whole message may take, or
+	SOCKIO_NO_TIMEOUT.
+	@return 0 once every byte was sent, or SOCKIO_TIMEOUT or
+	SOCKIO_ERROR.
+
+*/
+int sockio_send(int sock_fd, const void *buf, int len, int timeout_ms) {
+
+	struct iovec iov;
+
+	iov.iov_base = (void*)buf;
+	iov.iov_len = len;
+
+	return sockio_sendv(sock_fd, &iov, 1, timeout_ms);
+
+}
+
+/*!
+
+	@brief Send a message gathered from several buffers.
+
+	The buffers are sent in as few calls as the socket allows. The
+	iovec array is modified to track progress.
+
+	@return 0 once every byte was sent, or SOCKIO_TIMEOUT or
+	SOCKIO_ERROR.
+
+*/
+int sockio_sendv(int sock_fd, struct iovec *iov, int iov_len, int timeout_ms) {
+
+	struct msghdr msg;
+	long long deadline = deadline_of(timeout_ms);
+	int status;
+
+	memset(&msg, 0, sizeof(msg));
+
+	while ( iov_len ) {
+
+		ssize_t n_sent;
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov_len;
+
+		// A peer that went away fails the send rather than raising SIGPIPE
+		n_sent = sendmsg(sock_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if ( n_sent < 0 ) {
+
+			if ( errno == EINTR )
+				continue;
+
+			if ( !would_block() ) {
+				perror("send() failed");
+				return failed(SOCKIO_ERROR, 0);
+			}
+
+			if ( (status = wait_ready(sock_fd, POLLOUT, deadline)) < 0 )
+				return status;
+
+			continue;
+
+		}
+
+		// Skip what was sent, resuming partway into a buffer if needed
+		while ( iov_len && n_sent >= (ssize_t)iov->iov_len ) {
+			n_sent -= iov->iov_len;
+			iov++;
+			iov_len--;
+		}
+		if ( iov_len ) {
+			iov->iov_base = (char*)iov->iov_base + n_sent;
+			iov->iov_len -= n_sent;
+		}
+
+	}
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Receive whatever has arrived of a len byte message, without
+	waiting.
+
+	@param part Progress of the message, zeroed before the first call
+	and kept between calls.
+	@param timeout_ms Milliseconds the message may take from its first
+	byte, or SOCKIO_NO_TIMEOUT.
+	@return 1 once the whole message arrived, ready for the next one,
+	0 if more of it is still to come, or SOCKIO_EOF, SOCKIO_TIMEOUT or
+	SOCKIO_ERROR.
+
+*/
+int sockio_recv_part(int sock_fd, void *buf, int len, struct sockio_part *part, int timeout_ms) {
+
+	while ( part->n_received < len ) {
+
+		ssize_t n_received = recv(sock_fd, (char*)buf + part->n_received, len - part->n_received, MSG_DONTWAIT);
+
+		if ( n_received > 0 ) {
+			if ( part->n_received == 0 )
+				part->deadline = deadline_of(timeout_ms);
+			part->n_received += n_received;
+			continue;
+		}
+
+		if ( n_received == 0 )
+			return failed(SOCKIO_EOF, part->n_received > 0);
+
+		if ( errno == EINTR )
+			continue;
+
+		if ( !would_block() ) {
+			perror("recv() failed");
+			return failed(SOCKIO_ERROR, 0);
+		}
+
+		if ( part->n_received > 0 && part->deadline >= 0 && now_ms() >= part->deadline )
+			return failed(SOCKIO_TIMEOUT, 0);
+
+		return 0;
+
+	}
+
+	part->n_received = 0;
+
+	return 1;
+
+}
+
+/*!
+
+	@brief Time left to receive the rest of a message.
+
+	@return Milliseconds until the message times out, 0 if it already
+	has, or -1 if no part of it arrived yet or it may take forever.
+
+*/
+int sockio_part_left(const struct sockio_part *part) {
+
+	long long left;
+
+	if ( part->n_received == 0 || part->deadline < 0 )
+		return -1;
+
+	left = part->deadline - now_ms();
+
+	return left > 0 ? (int)left : 0;
+
+}
+
+/*!
+
+	@brief Get the counts of failed transfers.
+
+*/
+void sockio_stats(struct sockio_stats *copy) {
+
+	copy->n_timeouts = __sync_fetch_and_add(&stats.n_timeouts, 0);
+	copy->n_eofs = __sync_fetch_and_add(&stats.n_eofs, 0);
+	copy->n_truncated = __sync_fetch_and_add(&stats.n_truncated, 0);
+	copy->n_errors = __sync_fetch_and_add(&stats.n_errors, 0);
+
+	return;
+
+}
+
+
+
+#endif /* SOCKIO_C */
+
+
+
@@ -22,6 +22,9 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <arpa/inet.h>
+
+#include "segment.h"
 #include "srecord_list.h"
 
 
@@ -29,6 +32,39 @@
 /// Maximum line size to assume when loading srecord records from a file
 #define MAX_LINESZ 1024
 
+/// Maximum name size (including the terminator) of a loaded srecord
+#define MAXNAMELEN 64
+
+/// Maximum name length stored in a segment
+#define MAX_SEGMENT_NAMELEN 255
+
+
+
+/*!
+
+	@brief State of srecord_list_encode while packing records into
+	segments.
+
+*/
+struct segment_encoder {
+
+	unsigned char *buf;
+	int len;
+
+	/// Offset of the segment being filled
+	int segment_start;
+
+	/// Records in the segment being filled and their key range
+	int n_records;
+	int min_key;
+	int max_key;
+
+};
+
+
+
+static int free_srecord(struct srecord *srecord);
+
 
 
 ////////////////////////////////////////////////////////
@@ -61,11 +97,10 @@ struct srecord *srecord_new(void) {
 
 /*!
 
-	@brief Allocate memory for an srecord list and initialize from
-	a file of srecord records.
+	@brief Parse an srecord node from a line of a record file.
 
-	Each line in the record file must contain the following strings
-	(in the same order) separated by the pipe character '|':
+	The line must contain the following strings (in the same order)
+	separated by the pipe character '|':
 		- 12-digit (case-insensitive hex) colon-separated MAC address
 		- Student roll number
 		- Student name (first name only)
@@ -73,6 +108,93 @@ struct srecord *srecord_new(void) {
 	Example:
 		- C0:BD:D1:24:26:D9|19100009|Awais
 
+	@param line C string containing the line, with or without the
+	trailing newline.
+
+	@return Pointer to created srecord node, or NULL if the line
+	could not be parsed.
+
+*/
+struct srecord *srecord_parse(const char *line) {
+
+	int n_parsed;
+	unsigned mac_addr[6];
+	struct srecord *srecord;
+
+	if ( !(srecord = srecord_new()) )
+		return NULL;
+
+	if ( !(srecord->name = (char*)malloc(MAXNAMELEN)) ) {
+		free(srecord);
+		return NULL;
+	}
+
+	n_parsed = sscanf(line, "%02x:%02x:%02x:%02x:%02x:%02x|%d|%63s",
+		&(mac_addr[0]), &(mac_addr[1]),
+		&(mac_addr[2]), &(mac_addr[3]),
+		&(mac_addr[4]), &(mac_addr[5]),
+		&(srecord->roll_number), srecord->name
+	);
+	if ( n_parsed != 8 ) {
+		free_srecord(srecord);
+		return NULL;
+	}
+
+	srecord->mac_addr[0] = (char)mac_addr[0];
+	srecord->mac_addr[1] = (char)mac_addr[1];
+	srecord->mac_addr[2] = (char)mac_addr[2];
+	srecord->mac_addr[3] = (char)mac_addr[3];
+	srecord->mac_addr[4] = (char)mac_addr[4];
+	srecord->mac_addr[5] = (char)mac_addr[5];
+
+	return srecord;
+
+}
+
+/*!
+
+	@brief Format an srecord node as a line of a record file.
+
+	The line is written in the format accepted by srecord_parse,
+	terminated by a newline.
+
+	@see srecord_parse
+
+	@param srecord Pointer to the srecord node.
+	@param buf Buffer to write the line to.
+	@param buf_len Size of the buffer.
+
+	@return Length of the line, or -1 if it did not fit in the buffer.
+
+*/
+int srecord_format(struct srecord *srecord, char *buf, int buf_len) {
+
+	int len;
+
+	len = snprintf(buf, buf_len, "%02x:%02x:%02x:%02x:%02x:%02x|%d|%s\n",
+		srecord->mac_addr[0], srecord->mac_addr[1],
+		srecord->mac_addr[2], srecord->mac_addr[3],
+		srecord->mac_addr[4], srecord->mac_addr[5],
+		srecord->roll_number, srecord->name
+	);
+	if ( len < 0 || len >= buf_len )
+		return -1;
+
+	return len;
+
+}
+
+/*!
+
+	@brief Allocate memory for an srecord list and initialize from
+	a file of srecord records.
+
+	Each line in the record file must be in the format described
+	in srecord_parse. Empty lines and lines starting with '#' are
+	skipped, as are lines that fail to parse.
+
+	@see srecord_parse
+
 	@param file_name C string containing absolute or relative path
 	to record file.
 
@@ -91,30 +213,22 @@ struct srecord_list *srecord_list_load(const char *file_name) {
 		return NULL;
 	}
 
-	list = srecord_list_new();
+	if ( !(list = srecord_list_new()) ) {
+		fclose(fd);
+		return NULL;
+	}
 
 	while (fgets(line, MAX_LINESZ, fd)) {
 
 		struct srecord *srecord;
-		unsigned mac_addr[6];
-
-		srecord = srecord_new();
-
-		srecord->name = (char*)malloc(64);
-		/* Get rid of the newline */
-		line[strlen(line) - 1] = '\0';
-		sscanf(line, "%02x:%02x:%02x:%02x:%02x:%02x|%d|%s",
-			&(mac_addr[0]), &(mac_addr[1]),
-			&(mac_addr[2]), &(mac_addr[3]),
-			&(mac_addr[4]), &(mac_addr[5]),
-			&(srecord->roll_number), srecord->name
-		);
-		srecord->mac_addr[0] = (char)mac_addr[0];
-		srecord->mac_addr[1] = (char)mac_addr[1];
-		srecord->mac_addr[2] = (char)mac_addr[2];
-		srecord->mac_addr[3] = (char)mac_addr[3];
-		srecord->mac_addr[4] = (char)mac_addr[4];
-		srecord->mac_addr[5] = (char)mac_addr[5];
+
+		if ( line[0] == '#' || line[0] == '\n' )
+			continue;
+
+		if ( !(srecord = srecord_parse(line)) ) {
+			printf("Skipping malformed record: %s", line);
+			continue;
+		}
 
 		srecord_list_insert(list, srecord);
 
@@ -126,6 +240,245 @@ struct srecord_list *srecord_list_load(const char *file_name) {
 
 }
 
+/*!
+
+	@brief Close the segment being filled by a segment_encoder.
+
+*/
+static void seal_segment(struct segment_encoder *encoder) {
+
+	unsigned payload_len;
+
+	if ( encoder->n_records == 0 )
+		return;
+
+	payload_len = encoder->len - encoder->segment_start - sizeof(struct segment_hdr);
+	segment_seal(encoder->buf + encoder->segment_start, payload_len,
+		encoder->n_records, encoder->min_key, encoder->max_key);
+
+	encoder->segment_start = encoder->len;
+	encoder->n_records = 0;
+
+	return;
+
+}
+
+/*!
+
+	@brief Pack an srecord node into the current segment.
+
+	Meant to be passed to srecord_list_foreach as a callback
+	function in srecord_list_encode. Each record is stored as its
+	roll number, MAC address, name length and name.
+
+	@param srecord Pointer to the srecord node in the list.
+	@param cb_data Pointer to the segment_encoder casted to void.
+
+	@return Just 1
+
+*/
+static int encode_srecord(struct srecord *srecord, void *cb_data) {
+
+	int roll_number, name_len;
+	struct segment_encoder *encoder = (struct segment_encoder*)cb_data;
+
+	if ( encoder->n_records == 0 ) {
+		encoder->len += sizeof(struct segment_hdr);
+		encoder->min_key = encoder->max_key = srecord->roll_number;
+	}
+
+	name_len = srecord->name ? strlen(srecord->name) : 0;
+	if ( name_len > MAX_SEGMENT_NAMELEN )
+		name_len = MAX_SEGMENT_NAMELEN;
+
+	roll_number = htonl(srecord->roll_number);
+	memcpy(encoder->buf + encoder->len, &roll_number, 4);
+	memcpy(encoder->buf + encoder->len + 4, srecord->mac_addr, 6);
+	encoder->buf[encoder->len + 10] = (unsigned char)name_len;
+	memcpy(encoder->buf + encoder->len + 11, srecord->name, name_len);
+	encoder->len += 11 + name_len;
+
+	if ( srecord->roll_number < encoder->min_key )
+		encoder->min_key = srecord->roll_number;
+	if ( srecord->roll_number > encoder->max_key )
+		encoder->max_key = srecord->roll_number;
+
+	if ( ++encoder->n_records == SEGMENT_MAX_RECORDS )
+		seal_segment(encoder);
+
+	return 1;
+
+}
+
+/*!
+
+	@brief Decode the payload of a verified segment into a new
+	srecord_list.
+
+	Meant to be passed to segment_file_decode as a callback function
+	in srecord_list_load_segments.
+
+	@param segment Pointer to the segment.
+	@param out Pointer to the srecord_list pointer to set.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+static int decode_srecords(const struct segment *segment, void *out) {
+
+	unsigned i, pos = 0;
+	struct srecord_list *list;
+	const unsigned char *payload = segment->payload;
+
+	if ( !(list = srecord_list_new()) )
+		return -1;
+
+	for ( i = 0; i < segment->hdr.n_records; i++ ) {
+
+		int roll_number, name_len;
+		struct srecord *srecord;
+
+		if ( pos + 11 > segment->hdr.payload_len )
+			break;
+		name_len = payload[pos + 10];
+		if ( pos + 11 + name_len > segment->hdr.payload_len )
+			break;
+
+		if ( !(srecord = srecord_new()) )
+			break;
+		if ( !(srecord->name = (char*)malloc(name_len + 1)) ) {
+			free(srecord);
+			break;
+		}
+
+		memcpy(&roll_number, payload + pos, 4);
+		srecord->roll_number = ntohl(roll_number);
+		memcpy(srecord->mac_addr, payload + pos + 4, 6);
+		memcpy(srecord->name, payload + pos + 11, name_len);
+		srecord->name[name_len] = '\0';
+		pos += 11 + name_len;
+
+		srecord_list_insert(list, srecord);
+
+	}
+
+	if ( i < segment->hdr.n_records || pos != segment->hdr.payload_len ) {
+		srecord_list_free(list);
+		return -1;
+	}
+
+	*(struct srecord_list**)out = list;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Pack a list of srecords into segments.
+
+	The records are split into segments of up to SEGMENT_MAX_RECORDS
+	records each, laid out back to back in a single buffer that can
+	be appended to a segment file with one write.
+
+	@param list Pointer to an srecord_list struct
+	@param buf Set to the allocated buffer, to be freed by the caller
+	@param len Set to the length of the buffer
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int srecord_list_encode(struct srecord_list *list, unsigned char **buf, int *len) {
+
+	int n_segments, max_len;
+	struct segment_encoder encoder;
+
+	n_segments = (list->n_srecords + SEGMENT_MAX_RECORDS - 1) / SEGMENT_MAX_RECORDS;
+	max_len = n_segments * sizeof(struct segment_hdr) +
+		list->n_srecords * (11 + MAX_SEGMENT_NAMELEN);
+
+	memset(&encoder, 0, sizeof(encoder));
+	if ( !(encoder.buf = (unsigned char*)malloc(max_len ? max_len : 1)) ) {
+		printf("srecord_list_encode: Memory allocation failure.\n");
+		return -1;
+	}
+
+	srecord_list_foreach(list, encode_srecord, &encoder);
+	seal_segment(&encoder);
+
+	*buf = encoder.buf;
+	*len = encoder.len;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Allocate memory for an srecord list and initialize from
+	a segment file.
+
+	Segments are verified and decoded in parallel. Damaged segments
+	are reported and skipped, and a missing file yields an empty
+	list.
+
+	@see segment_file_decode
+
+	@param file_name C string containing absolute or relative path
+	to the segment file.
+
+	@return Pointer to created srecord_list, or NULL on failure.
+
+*/
+struct srecord_list *srecord_list_load_segments(const char *file_name) {
+
+	int i, n_valid;
+	struct segment_file file;
+	struct srecord_list *list, **lists;
+
+	if ( segment_file_open(file_name, &file) < 0 )
+		return NULL;
+
+	if ( !(list = srecord_list_new()) ) {
+		segment_file_close(&file);
+		return NULL;
+	}
+
+	if ( file.n_segments == 0 ) {
+		segment_file_close(&file);
+		return list;
+	}
+
+	if ( !(lists = (struct srecord_list**)calloc(file.n_segments, sizeof(*lists))) ) {
+		printf("srecord_list_load_segments: Memory allocation failure.\n");
+		segment_file_close(&file);
+		srecord_list_free(list);
+		return NULL;
+	}
+
+	n_valid = segment_file_decode(&file, decode_srecords, lists, sizeof(*lists));
+	if ( n_valid < file.n_segments || file.n_skipped )
+		printf("Skipped %d damaged segments (%ld stray bytes) in \"%s\"\n",
+			file.n_segments - n_valid, file.n_skipped, file_name);
+
+	/* Chain the segments back together in file order */
+	for ( i = 0; i < file.n_segments; i++ ) {
+
+		if ( !lists[i] )
+			continue;
+
+		srecord_list_splice(list, lists[i]);
+		srecord_list_free(lists[i]);
+
+	}
+
+	free(lists);
+	segment_file_close(&file);
+
+	return list;
+
+}
+
 /*!
 
 	@brief Free memory allocated for an srecord_list node.
@@ -469,6 +822,39 @@ int srecord_list_foreach(struct srecord_list *list, void *srecord_cb, void *cb_d
 
 }
 
+/*!
+
+	@brief Move all nodes of a list to the tail of another list.
+
+	The nodes are moved as they are, without copying, and the source
+	list is left empty.
+
+	@param list Pointer to the srecord_list struct to append to
+	@param other Pointer to the srecord_list struct to take nodes from
+
+*/
+void srecord_list_splice(struct srecord_list *list, struct srecord_list *other) {
+
+	if (other->n_srecords == 0)
+		return;
+
+	if (list->n_srecords == 0)
+		list->head = other->head;
+	else
+		list->tail->next = other->head;
+
+	list->tail = other->tail;
+	list->n_srecords += other->n_srecords;
+
+	other->n_srecords = 0;
+
+	other->head = NULL;
+	other->tail = NULL;
+
+	return;
+
+}
+
 /*!
 
 	@brief Destroy all nodes and empty the list.
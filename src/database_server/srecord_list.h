@@ -10,6 +10,11 @@
 
 
 
+#ifndef SRECORD_LIST_H
+#define SRECORD_LIST_H
+
+
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -90,11 +95,20 @@ struct srecord *srecord_list_top(struct srecord_list *list); // Head
 int srecord_list_pop_front(struct srecord_list *list); // Head
 int srecord_list_pop(struct srecord_list *list); // Head
 int srecord_list_foreach(struct srecord_list *list, void *srecord_cb, void *cb_data);
+void srecord_list_splice(struct srecord_list *list, struct srecord_list *other);
 void srecord_list_empty(struct srecord_list *list);
 void srecord_list_free(struct srecord_list *list);
 void srecord_list_print(struct srecord_list *list);
+struct srecord *srecord_parse(const char *line);
+int srecord_format(struct srecord *srecord, char *buf, int buf_len);
 struct srecord_list *srecord_list_load(const char *file_name);
+int srecord_list_encode(struct srecord_list *list, unsigned char **buf, int *len);
+struct srecord_list *srecord_list_load_segments(const char *file_name);
 void srecord_list_test(char *file_name);
 
 
 
+#endif /* SRECORD_LIST_H */
+
+
+
@@ -0,0 +1,391 @@
+/*!
+
+	@file stage.c
+
+	@brief Staging layer for records waiting to be written to flash.
+
+	Stored records are appended to a staging file on tmpfs right
+	away, so they survive a restart of the server without wearing
+	the flash. stage_flush then packs all pending records into
+	segments and appends them to the database file with a single
+	write, and brackets that write with
+	markers in the staging file:
+		- "#flush <size>" before the write, where size is the size
+		  of the database file before the batch
+		- "#done" once the batch has been synced to flash
+	On startup, stage_recover uses these markers to cut a torn batch
+	off the database file and to find the records that still need
+	to be flushed.
+
+*/
+
+
+
+#ifndef STAGE_C
+#define STAGE_C
+
+
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "srecord_list.h"
+#include "stage.h"
+
+
+
+/// Maximum line size to assume for a staged record
+#define MAX_LINESZ 1024
+
+
+
+/// Descriptor of the open staging file
+static int stage_fd = -1;
+
+/// Number of record bytes in the staging file since the last flush
+static int staged_bytes;
+
+/*!
+
+	@brief Growable buffer holding a batch of formatted records.
+
+*/
+struct batch {
+
+	char *data;
+	int len;
+	int size;
+
+};
+
+
+
+static int write_all(int fd, const char *buf, int len) {
+
+	while ( len ) {
+
+		int n_written;
+
+		n_written = write(fd, buf, len);
+
+		if ( n_written < 0 ) {
+			perror("write() failed");
+			return -1;
+		}
+
+		buf += n_written;
+		len -= n_written;
+
+	}
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Append an srecord node to a batch.
+
+	Meant to be passed to srecord_list_foreach as a callback
+	function in stage_flush.
+
+	@param srecord Pointer to the srecord node in the list.
+	@param cb_data Pointer to the batch casted to void.
+
+	@return 1 if the record was added to the batch, 0 otherwise.
+
+*/
+static int batch_record(struct srecord *srecord, void *cb_data) {
+
+	int len;
+	char line[MAX_LINESZ];
+	struct batch *batch = (struct batch*)cb_data;
+
+	if ( (len = srecord_format(srecord, line, sizeof(line))) < 0 )
+		return 0;
+
+	if ( batch->len + len > batch->size ) {
+
+		int new_size = 2 * batch->size + len;
+		char *new_data = (char*)realloc(batch->data, new_size);
+
+		if ( !new_data )
+			return 0;
+
+		batch->data = new_data;
+		batch->size = new_size;
+
+	}
+
+	memcpy(batch->data + batch->len, line, len);
+	batch->len += len;
+
+	return 1;
+
+}
+
+/*!
+
+	@brief Write a list of records to a new staging file and keep it
+	open for appending.
+
+	The file is written under a temporary name and renamed over the
+	old staging file, so the previous contents stay intact until the
+	new ones are complete.
+
+	@param stage_file Path to the staging file, which should be on
+	tmpfs.
+	@param list Records to stage, usually those returned by
+	stage_recover.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int stage_open(const char *stage_file, struct srecord_list *list) {
+
+	int fd;
+	struct batch batch;
+	char tmp_file[MAX_LINESZ];
+
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", stage_file);
+
+	memset(&batch, 0, sizeof(batch));
+	if ( srecord_list_foreach(list, batch_record, &batch) < list->n_srecords ) {
+		free(batch.data);
+		return -1;
+	}
+
+	if ( (fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0 ) {
+		perror("Error creating staging file");
+		free(batch.data);
+		return -1;
+	}
+
+	if ( write_all(fd, batch.data, batch.len) < 0 || rename(tmp_file, stage_file) < 0 ) {
+		perror("Error writing staging file");
+		free(batch.data);
+		close(fd);
+		unlink(tmp_file);
+		return -1;
+	}
+
+	free(batch.data);
+
+	stage_fd = fd;
+	staged_bytes = batch.len;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Append a record to the staging file.
+
+	@param srecord Pointer to the srecord to stage.
+
+	@return 0 on success, or -1 on failure.
+
+*/
+int stage_append(struct srecord *srecord) {
+
+	int len;
+	char line[MAX_LINESZ];
+
+	if ( (len = srecord_format(srecord, line, sizeof(line))) < 0 )
+		return -1;
+
+	if ( write_all(stage_fd, line, len) < 0 )
+		return -1;
+
+	staged_bytes += len;
+
+	return 0;
+
+}
+
+/*!
+
+	@brief Number of record bytes staged since the last flush.
+
+*/
+int stage_size(void) {
+
+	return staged_bytes;
+
+}
+
+/*!
+
+	@brief Write a batch of records to the database file.
+
+	All records are packed into segments in one buffer and appended
+	with a single write, followed by an fsync. The staging file is emptied
+	once the batch is on flash. If the write fails, the database file
+	is cut back to its old size and the records stay staged.
+
+	@param list Records to write, normally all staged records.
+	@param db_file Path to the database file.
+
+	@return Number of records written, or -1 on failure.
+
+*/
+int stage_flush(struct srecord_list *list, const char *db_file) {
+
+	int db_fd, batch_len;
+	struct stat st;
+	char marker[64];
+	unsigned char *batch;
+
+	if ( list->n_srecords == 0 )
+		return 0;
+
+	if ( srecord_list_encode(list, &batch, &batch_len) < 0 )
+		return -1;
+
+	if ( (db_fd = open(db_file, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ) {
+		perror("Error appending to database file");
+		free(batch);
+		return -1;
+	}
+
+	if ( fstat(db_fd, &st) < 0 ) {
+		perror("fstat() failed");
+		free(batch);
+		close(db_fd);
+		return -1;
+	}
+
+	snprintf(marker, sizeof(marker), "#flush %lld\n", (long long)st.st_size);
+	if ( write_all(stage_fd, marker, strlen(marker)) < 0 ) {
+		free(batch);
+		close(db_fd);
+		return -1;
+	}
+
+	if ( write_all(db_fd, (char*)batch, batch_len) < 0 || fsync(db_fd) < 0 ) {
+		perror("Error writing batch to database file");
+		if ( ftruncate(db_fd, st.st_size) < 0 )
+			perror("ftruncate() failed");
+		free(batch);
+		close(db_fd);
+		return -1;
+	}
+
+	free(batch);
+	close(db_fd);
+
+	if ( write_all(stage_fd, "#done\n", 6) < 0 )
+		return -1;
+	if ( ftruncate(stage_fd, 0) < 0 )
+		perror("ftruncate() failed");
+	staged_bytes = 0;
+
+	return list->n_srecords;
+
+}
+
+/*!
+
+	@brief Reconcile the database file with a staging file left
+	behind by a previous run.
+
+	Must be called before the database file is loaded. If the
+	staging file shows a batch that was started but never finished,
+	the database file is cut back to its size before that batch.
+	Records that were staged after the last finished batch are
+	returned so that they can be staged again.
+
+	@param stage_file Path to the staging file.
+	@param db_file Path to the database file.
+
+	@return List of records still to be flushed, or NULL on failure.
+
+*/
+struct srecord_list *stage_recover(const char *stage_file, const char *db_file) {
+
+	FILE *fd;
+	int torn = 0;
+	long long db_size = 0;
+	char line[MAX_LINESZ];
+	struct srecord_list *list;
+
+	if ( !(list = srecord_list_new()) )
+		return NULL;
+
+	/* Nothing was staged */
+	if ( !(fd = fopen(stage_file, "rb")) )
+		return list;
+
+	while ( fgets(line, sizeof(line), fd) ) {
+
+		struct srecord *srecord;
+
+		if ( sscanf(line, "#flush %lld", &db_size) == 1 ) {
+			torn = 1;
+			continue;
+		}
+
+		if ( strcmp(line, "#done\n") == 0 ) {
+			/* Everything staged so far made it to flash */
+			srecord_list_empty(list);
+			torn = 0;
+			continue;
+		}
+
+		if ( !(srecord = srecord_parse(line)) ) {
+			/* A torn append, the record never got a response */
+			printf("stage_recover: Skipping malformed record: %s", line);
+			continue;
+		}
+
+		srecord_list_insert(list, srecord);
+
+	}
+
+	fclose(fd);
+
+	if ( torn ) {
+		printf("stage_recover: Rolling back unfinished batch at %lld bytes.\n", db_size);
+		if ( truncate(db_file, db_size) < 0 ) {
+			perror("truncate() failed");
+			srecord_list_free(list);
+			return NULL;
+		}
+	}
+
+	return list;
+
+}
+
+/*!
+
+	@brief Close the staging file.
+
+	The file itself is left in place. It is empty if everything
+	was flushed.
+
+*/
+void stage_close(void) {
+
+	if ( stage_fd >= 0 )
+		close(stage_fd);
+
+	stage_fd = -1;
+
+	return;
+
+}
+
+
+
+#endif /* STAGE_C */
+
+
+
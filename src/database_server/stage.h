@@ -0,0 +1,31 @@
+/*!
+
+	@file stage.h
+	@brief Header file for the record staging layer.
+
+*/
+
+
+
+#ifndef STAGE_H
+#define STAGE_H
+
+
+
+#include "srecord_list.h"
+
+
+
+int stage_open(const char *stage_file, struct srecord_list *list);
+int stage_append(struct srecord *srecord);
+int stage_size(void);
+int stage_flush(struct srecord_list *list, const char *db_file);
+struct srecord_list *stage_recover(const char *stage_file, const char *db_file);
+void stage_close(void);
+
+
+
+#endif /* STAGE_H */
+
+
+
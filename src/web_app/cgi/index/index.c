@@ -5,7 +5,6 @@
  *
  * TODO:
  *	- Update client API's when done modifying in this directory
- *	- Built-in roster for stricter registration checks
  *	- Change hacky implementations
  *
  */
@@ -12,6 +12,7 @@
 #define DB_NOT_FOUND	0x04
 #define DB_BAD_QUERY	0x05
 #define DB_CONN_FAILED	0x06
+#define DB_NOT_ENROLLED	0x09
 
 
 
@@ -23,6 +24,23 @@ struct db_msg_data {
 
 } __attribute__((packed));
 
+/* Connection to the database server kept open across requests */
+struct db_conn {
+
+	char server_ip[16];
+	int server_port;
+
+	/* Socket of the open connection, -1 while there is none */
+	int sock_fd;
+
+	/* Number of times the connection was made, for diagnostics */
+	int n_connects;
+
+};
+
+/* Callback for records of backup, restore and search streams */
+typedef int (*db_record_callback)(struct db_msg_data *record, void *cb_data);
+
 
 
 struct db_msg_data *db_msg_data_new(void);
@@ -30,6 +48,16 @@ int db_get_record(char *server_ip, int server_port, struct db_msg_data *query);
 int db_put_record(char *server_ip, int server_port, struct db_msg_data *record);
 int db_commit_all(char *server_ip, int server_port);
 int db_send_exit(char *server_ip, int server_port);
+struct db_conn *db_conn_new(char *server_ip, int server_port);
+int db_conn_get_record(struct db_conn *conn, struct db_msg_data *query);
+int db_conn_put_record(struct db_conn *conn, struct db_msg_data *record);
+int db_conn_commit_all(struct db_conn *conn);
+void db_conn_free(struct db_conn *conn);
+int db_search(char *server_ip, int server_port, char *prefix, int max_results,
+	db_record_callback record_cb, void *cb_data);
+int db_backup(char *server_ip, int server_port, db_record_callback record_cb, void *cb_data);
+int db_restore(char *server_ip, int server_port, db_record_callback next_record_cb, void *cb_data,
+	int *n_restored);
 void db_msg_data_destroy(struct db_msg_data *data);
 void db_status_print(int status);
 
@@ -6,81 +6,59 @@
 #include <stdlib.h>
 
 #include "cgi_common.h"
-#include "database_client.h"
 #include "attendance_client.h"
 
 
 
 int main(void) {
 
-	struct db_msg_data *data;
-	int status, content_len, roll_number;
+	unsigned char mac_addr[6];
+	int status, content_len, roll_number, session_id;
+	char *session_str;
 	char *client_ip, *len_str, line[MAXLEN];
 
 	printf("Content-Type:text/html\n\n");
 
-	/* New database message */
-	if ( !(data = db_msg_data_new()) ) {
-		server_print_error("Failed allocation");
-		return -1;
-	}
-
 	/* Determine client IP and load MAC address */
 	if ( !(client_ip = getenv("REMOTE_ADDR")) ) {
 		server_print_error("Failed to determine user IP");
-		db_msg_data_destroy(data);
 		return -1;
 	}
-	if ( find_macaddr(client_ip, data->mac_addr) < 0 ) {
+	if ( find_macaddr(client_ip, mac_addr) < 0 ) {
 		server_print_error("Failed to determine user MAC");
-		db_msg_data_destroy(data);
-		return -1;
-	}
-
-	/* Get the roll number and name from the MAC */
-	status = db_get_record(DB_SERVER_IP, DB_SERVER_PORT, data);
-	if ( status != DB_FOUND ) {
-		/* Bad status */
-		printf(ETAG_START);
-		printf("Database error: ");
-		db_status_print(status);
-		printf(ETAG_END);
-		db_msg_data_destroy(data);
 		return -1;
 	}
 
 	/* Determine content length */
 	if ( !(len_str = getenv("CONTENT_LENGTH")) ) {
 		server_print_error("Request was invalid (1)");
-		db_msg_data_destroy(data);
 		return -1;
 	}
 	content_len = atoi(len_str);
 
-	/* Fetch roll number from form input */
+	/* Fetch roll number and optional session from form input */
 	roll_number = 0;
+	session_id = AS_DEFAULT_SESSION;
 	while ( fgets(line, sizeof(line), stdin) ) {
 		if ( memcmp(line, "roll_number=", 12) == 0 ) {
 			sscanf(line+12, "%d", &roll_number);
+			if ( (session_str = strstr(line, "&session=")) )
+				sscanf(session_str+9, "%d", &session_id);
 			break;
 		}
 	}
 	if ( !roll_number ) {
 		server_print_error("Request was invalid (2)");
-		db_msg_data_destroy(data);
-		return -1;
-	}
-
-	/* Verify roll number from form input */
-	if ( roll_number != data->roll_number ) {
-		server_print_error("Identity mismatch");
-		db_msg_data_destroy(data);
 		return -1;
 	}
 
-	/* Mark attendance */
-	status = as_mark_attendance(LOCALHOST_IP,
-		AS_SERVER_IP, AS_SERVER_PORT, roll_number);
+	/*
+	 * Mark attendance. The server looks the MAC up in its copy of the
+	 * device registry and denies the mark unless the device is
+	 * registered to the roll number from form input.
+	 */
+	status = as_mark_by_mac(LOCALHOST_IP,
+		AS_SERVER_IP, AS_SERVER_PORT, session_id, mac_addr, roll_number);
 	if ( status == AS_PRESENT ) {
 		printf(STAG_START);
 		printf("You were marked present");
@@ -93,17 +71,17 @@ int main(void) {
 		printf(MTAG_START);
 		printf("You were marked late");
 		printf(MTAG_END);
+	} else if ( status == AS_UNREGISTERED ) {
+		server_print_error("This device is not registered");
+		return -1;
 	} else {
 		printf(ETAG_START);
 		printf("Attendance server error: ");
 		as_status_print(status);
 		printf(ETAG_END);
-		db_msg_data_destroy(data);
 		return -1;
 	}
 
-	db_msg_data_destroy(data);
-
 	return 0;
 
 }
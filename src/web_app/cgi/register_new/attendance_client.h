@@ -13,15 +13,87 @@
 #define CLIENT_FAILURE	0x05 /* The operation failed due to a problem with the client */
 #define AS_REQ_DENIED	0x06 /* The server denied the request */
 #define AS_SUCCESS	0x07 /* The operation succeeded */
+#define AS_UNREGISTERED	0x08 /* The device is not registered */
+#define AS_BUSY		0x09 /* The server stayed overloaded for as long as the mark was retried, or had too many admins */
 
+/* Anomalies reported by as_watch_anomalies */
+#define AS_ANOMALY_DEVICE_ROLLS	0x01 /* A device marked a roll number other than the one it marked first */
+#define AS_ANOMALY_DEVICE_BURST	0x02 /* A device marked many times in a few seconds */
+#define AS_ANOMALY_RATE_SPIKE	0x04 /* Marks arrived far faster than usual */
+#define AS_ANOMALY_TIMING	0x08 /* A mark claimed a time far off the server's, or before the last mark of its device */
 
+/* Session of as_mark_attendance and as_close_attendance */
+#define AS_DEFAULT_SESSION	0
+
+
+
+#include <time.h>
 
 #include "arecord_list.h"
 
 
 
+/*
+ * A student to mark with as_mark_batch, at tv_sec and tv_usec or, if
+ * tv_sec is 0, when the server receives the batch. The status is set
+ * to that of the mark, as returned by as_mark_session.
+ */
+struct as_batch_entry {
+
+	int roll_number;
+
+	long long tv_sec;
+	long long tv_usec;
+
+	int status;
+
+};
+
+
+
+/*
+ * An anomaly the server flagged in a mark, with the roll number and time
+ * of the mark. The MAC address of the device that made it is zeroed if
+ * the server did not know it.
+ */
+struct as_anomaly {
+
+	int type;
+
+	int roll_number;
+
+	long long tv_sec;
+	long long tv_usec;
+
+	unsigned char mac_addr[6];
+
+};
+
+typedef int (*as_anomaly_callback)(struct as_anomaly *anomaly, void *cb_data);
+
+
+
 int as_mark_attendance(char *client_ip, char *server_ip, int server_port, int roll_number);
 int as_close_attendance(char *client_ip, char *server_ip, int server_port, struct arecord_list *list);
+int as_mark_session(char *client_ip, char *server_ip, int server_port, int session_id, int roll_number);
+int as_close_session(char *client_ip, char *server_ip, int server_port, int session_id, struct arecord_list *list);
+int as_mark_by_mac(char *client_ip, char *server_ip, int server_port, int session_id,
+	unsigned char *mac_addr, int roll_number);
+int as_invalidate_identities(char *client_ip, char *server_ip, int server_port);
+int as_open_session(char *client_ip, char *server_ip, int server_port, int session_id);
+int as_expire_session(char *client_ip, char *server_ip, int server_port, int session_id);
+int as_sync_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	long long *cursor, struct arecord_list *list);
+int as_export_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	long long *cursor, struct arecord_list *list);
+int as_subscribe_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	arecord_callback cb, void *cb_data);
+int as_watch_anomalies(char *client_ip, char *server_ip, int server_port, int session_id,
+	as_anomaly_callback cb, void *cb_data);
+int as_schedule_session(char *client_ip, char *server_ip, int server_port, int session_id,
+	time_t open_time, time_t late_time, time_t close_time);
+int as_mark_batch(char *client_ip, char *server_ip, int server_port, int session_id,
+	struct as_batch_entry *entries, int n_entries);
 void as_status_print(int status);
 
 
@@ -7,6 +7,7 @@
 
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -16,6 +17,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include "sockio.h"
 #include "database_client.h"
 
 
@@ -25,10 +27,18 @@
 #define OP_PUT		0x01
 #define OP_COMMIT	0x02
 #define OP_EXIT		0x03
+#define OP_BACKUP	0x04
+#define OP_RESTORE	0x05
+#define OP_SEARCH	0x06
+
+/* Stream status codes */
+#define DB_DATA		0x07
+#define DB_END_DATA	0x08
 
 /* Configuration */
 #define MAXNAMESZ	64
 #define MSG_LEN		256
+#define DB_IO_TIMEOUT	10	/* Seconds the database server may take over a message */
 
 
 
@@ -58,10 +68,13 @@ struct db_message {
 
 static int ipport2addr(char *ip, int port, struct sockaddr_in *addr);
 static int client_socket_new(const char *ip);
+static int client_connect(char *server_ip, int server_port);
+static void conn_init(struct db_conn *conn, char *server_ip, int server_port);
+static void conn_drop(struct db_conn *conn);
+static int conn_healthy(struct db_conn *conn);
+static int conn_request(struct db_conn *conn, struct db_message *msg, struct db_message *response);
 static void ntohmsg(struct db_message *msg);
 static void htonmsg(struct db_message *msg);
-static int send_data(int sock_fd, char *send_buf, int send_len);
-static int recv_data(int sock_fd, char *recv_buf, int recv_len);
 static int send_msg(int sock_fd, struct db_message *msg);
 static int recv_msg(int sock_fd, struct db_message *msg);
 
@@ -84,53 +97,128 @@ struct db_msg_data *db_msg_data_new(void) {
 
 int db_get_record(char *server_ip, int server_port, struct db_msg_data *query) {
 
-	int conn_sockfd;
+	struct db_conn conn;
+	int status;
+
+	conn_init(&conn, server_ip, server_port);
+	status = db_conn_get_record(&conn, query);
+	conn_drop(&conn);
+
+	return status;
+
+}
+
+int db_put_record(char *server_ip, int server_port, struct db_msg_data *record) {
+
+	struct db_conn conn;
+	int status;
+
+	conn_init(&conn, server_ip, server_port);
+	status = db_conn_put_record(&conn, record);
+	conn_drop(&conn);
+
+	return status;
+
+}
+
+int db_commit_all(char *server_ip, int server_port) {
+
+	struct db_conn conn;
+	int status;
+
+	conn_init(&conn, server_ip, server_port);
+	status = db_conn_commit_all(&conn);
+	conn_drop(&conn);
+
+	return status;
+
+}
+
+/*
+ * Prepare a connection to be kept open across requests. It is made on
+ * the first request, checked before every request and made again if
+ * the server closed it, so a request costs a send and a receive
+ * instead of a new connection each time. Not safe to share between
+ * threads without a lock.
+ */
+struct db_conn *db_conn_new(char *server_ip, int server_port) {
+
+	struct db_conn *conn;
+
+	if ( !(conn = (struct db_conn*)malloc(sizeof(struct db_conn))) ) {
+		printf("db_conn_new(): Failed allocation.\n");
+		return NULL;
+	}
+
+	conn_init(conn, server_ip, server_port);
+
+	return conn;
+
+}
+
+int db_conn_get_record(struct db_conn *conn, struct db_msg_data *query) {
+
 	char recv_buf[MSG_LEN];
-	struct sockaddr_in server_addr;
-	struct db_msg_data *response_data;
 	struct db_message *msg, *response;
+	int status;
 
 	response = (struct db_message*)recv_buf;
-	response_data = (struct db_msg_data*)(recv_buf + sizeof(struct db_msg_hdr));
 
 	msg = (struct db_message*)(((char*)query) - sizeof(struct db_msg_hdr));
 	msg->operation = OP_GET;
 
-	if ( (conn_sockfd = client_socket_new("127.0.0.1")) < 0 )
-		return DB_CONN_FAILED;
+	if ( (status = conn_request(conn, msg, response)) == DB_FOUND )
+		memcpy(query, recv_buf + sizeof(struct db_msg_hdr), MSG_LEN - sizeof(struct db_msg_hdr));
 
-	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 )
-		return DB_CONN_FAILED;
+	return status;
 
-	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
-		perror("connect() failed");
-		return DB_CONN_FAILED;
-	}
+}
 
-	if ( send_msg(conn_sockfd, msg) < 0 )
-		return DB_CONN_FAILED;
+int db_conn_put_record(struct db_conn *conn, struct db_msg_data *record) {
 
-	if ( recv_msg(conn_sockfd, response) < 0 )
-		return DB_CONN_FAILED;
+	char recv_buf[MSG_LEN];
+	struct db_message *msg;
 
-	if ( response->status == DB_FOUND )
-		memcpy(query, response_data, MSG_LEN - sizeof(struct db_msg_hdr));
+	msg = (struct db_message*)(((char*)record) - sizeof(struct db_msg_hdr));
+	msg->operation = OP_PUT;
 
-	return response->status;
+	return conn_request(conn, msg, (struct db_message*)recv_buf);
 
 }
 
-int db_put_record(char *server_ip, int server_port, struct db_msg_data *record) {
+int db_conn_commit_all(struct db_conn *conn) {
 
-	int conn_sockfd;
+	char send_buf[MSG_LEN];
 	char recv_buf[MSG_LEN];
-	struct sockaddr_in server_addr;
-	struct db_message *msg, *response;
+	struct db_message *msg;
 
-	response = (struct db_message*)recv_buf;
+	msg = (struct db_message*)send_buf;
 
-	msg = (struct db_message*)(((char*)record) - sizeof(struct db_msg_hdr));
-	msg->operation = OP_PUT;
+	memset(send_buf, 0, MSG_LEN);
+	msg->operation = OP_COMMIT;
+
+	return conn_request(conn, msg, (struct db_message*)recv_buf);
+
+}
+
+void db_conn_free(struct db_conn *conn) {
+
+	conn_drop(conn);
+	free(conn);
+
+	return;
+
+}
+
+int db_send_exit(char *server_ip, int server_port) {
+
+	int conn_sockfd;
+	char send_buf[MSG_LEN];
+	struct sockaddr_in server_addr;
+	struct db_message *msg;
+
+	msg = (struct db_message*)send_buf;
+	msg->operation = OP_EXIT;
 
 	if ( (conn_sockfd = client_socket_new("127.0.0.1")) < 0 )
 		return DB_CONN_FAILED;
@@ -143,75 +231,196 @@ int db_put_record(char *server_ip, int server_port, struct db_msg_data *record)
 		return DB_CONN_FAILED;
 	}
 
-	if ( send_msg(conn_sockfd, msg) < 0 )
+	if ( send_msg(conn_sockfd, msg) < 0 ) {
+		close(conn_sockfd);
 		return DB_CONN_FAILED;
+	}
 
-	if ( recv_msg(conn_sockfd, response) < 0 )
-		return DB_CONN_FAILED;
+	close(conn_sockfd);
 
-	return response->status;
+	return DB_OP_SUCCESS;
 
 }
 
-int db_commit_all(char *server_ip, int server_port) {
+/*
+ * Receive a point-in-time snapshot of all records held by the
+ * database server. The callback is invoked for every record and
+ * may stop the transfer by returning 0.
+ */
+int db_backup(char *server_ip, int server_port, db_record_callback record_cb, void *cb_data) {
 
-	int conn_sockfd;
+	int conn_sockfd, status;
 	char send_buf[MSG_LEN];
 	char recv_buf[MSG_LEN];
-	struct sockaddr_in server_addr;
 	struct db_message *msg, *response;
+	struct db_msg_data *response_data;
 
 	msg = (struct db_message*)send_buf;
 	response = (struct db_message*)recv_buf;
+	response_data = (struct db_msg_data*)(recv_buf + sizeof(struct db_msg_hdr));
 
-	msg->operation = OP_COMMIT;
+	memset(send_buf, 0, MSG_LEN);
+	msg->operation = OP_BACKUP;
 
-	if ( (conn_sockfd = client_socket_new("127.0.0.1")) < 0 )
+	if ( (conn_sockfd = client_connect(server_ip, server_port)) < 0 )
 		return DB_CONN_FAILED;
 
-	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 )
+	if ( send_msg(conn_sockfd, msg) < 0 ) {
+		close(conn_sockfd);
 		return DB_CONN_FAILED;
+	}
+
+	status = DB_OP_SUCCESS;
+
+	while ( 1 ) {
+
+		if ( recv_msg(conn_sockfd, response) < 0 ) {
+			status = DB_CONN_FAILED;
+			break;
+		}
+
+		if ( response->status == DB_END_DATA )
+			break;
+
+		if ( response->status != DB_DATA ) {
+			status = DB_OP_FAILED;
+			break;
+		}
+
+		recv_buf[MSG_LEN - 1] = '\0';
+		if ( !record_cb(response_data, cb_data) ) {
+			status = DB_OP_FAILED;
+			break;
+		}
 
-	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
-		perror("connect() failed");
-		return DB_CONN_FAILED;
 	}
 
-	if ( send_msg(conn_sockfd, msg) < 0 )
+	close(conn_sockfd);
+
+	return status;
+
+}
+
+/*
+ * Find up to max_results records whose name starts with a prefix,
+ * ignoring case. The callback is invoked for every match in
+ * alphabetical order. Returns DB_FOUND if there were matches.
+ */
+int db_search(char *server_ip, int server_port, char *prefix, int max_results,
+	db_record_callback record_cb, void *cb_data) {
+
+	int conn_sockfd, status;
+	char send_buf[MSG_LEN];
+	char recv_buf[MSG_LEN];
+	struct db_message *msg, *response;
+	struct db_msg_data *response_data;
+
+	msg = (struct db_message*)send_buf;
+	response = (struct db_message*)recv_buf;
+	response_data = (struct db_msg_data*)(recv_buf + sizeof(struct db_msg_hdr));
+
+	memset(send_buf, 0, MSG_LEN);
+	msg->operation = OP_SEARCH;
+	msg->roll_number = max_results;
+	strncpy(msg->name, prefix, MAXNAMESZ - 1);
+
+	if ( (conn_sockfd = client_connect(server_ip, server_port)) < 0 )
 		return DB_CONN_FAILED;
 
-	if ( recv_msg(conn_sockfd, response) < 0 )
+	if ( send_msg(conn_sockfd, msg) < 0 ) {
+		close(conn_sockfd);
 		return DB_CONN_FAILED;
+	}
 
-	return response->status;
+	status = DB_NOT_FOUND;
+
+	while ( 1 ) {
+
+		if ( recv_msg(conn_sockfd, response) < 0 ) {
+			status = DB_CONN_FAILED;
+			break;
+		}
+
+		if ( response->status == DB_END_DATA )
+			break;
+
+		if ( response->status != DB_DATA ) {
+			status = DB_OP_FAILED;
+			break;
+		}
+
+		recv_buf[MSG_LEN - 1] = '\0';
+		status = DB_FOUND;
+		if ( !record_cb(response_data, cb_data) )
+			break;
+
+	}
+
+	close(conn_sockfd);
+
+	return status;
 
 }
 
-int db_send_exit(char *server_ip, int server_port) {
+/*
+ * Bulk-load records into the database server. The callback fills
+ * in the next record and returns 1, or returns 0 once there are no
+ * more records. Records that already exist are skipped, in which
+ * case DB_OP_PARTIAL is returned.
+ */
+int db_restore(char *server_ip, int server_port, db_record_callback next_record_cb, void *cb_data,
+	int *n_restored) {
 
 	int conn_sockfd;
 	char send_buf[MSG_LEN];
-	struct sockaddr_in server_addr;
-	struct db_message *msg;
+	char recv_buf[MSG_LEN];
+	struct db_message *msg, *response;
+	struct db_msg_data *msg_data;
 
 	msg = (struct db_message*)send_buf;
-	msg->operation = OP_EXIT;
+	response = (struct db_message*)recv_buf;
+	msg_data = (struct db_msg_data*)(send_buf + sizeof(struct db_msg_hdr));
 
-	if ( (conn_sockfd = client_socket_new("127.0.0.1")) < 0 )
-		return DB_CONN_FAILED;
+	memset(send_buf, 0, MSG_LEN);
+	msg->operation = OP_RESTORE;
 
-	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 )
+	if ( (conn_sockfd = client_connect(server_ip, server_port)) < 0 )
 		return DB_CONN_FAILED;
 
-	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
-		perror("connect() failed");
+	if ( send_msg(conn_sockfd, msg) < 0 ) {
+		close(conn_sockfd);
 		return DB_CONN_FAILED;
 	}
 
-	if ( send_msg(conn_sockfd, msg) < 0 )
+	while ( 1 ) {
+
+		memset(send_buf, 0, MSG_LEN);
+		if ( !next_record_cb(msg_data, cb_data) )
+			break;
+		send_buf[MSG_LEN - 1] = '\0';
+		msg->operation = DB_DATA;
+
+		if ( send_msg(conn_sockfd, msg) < 0 ) {
+			close(conn_sockfd);
+			return DB_CONN_FAILED;
+		}
+
+	}
+
+	memset(send_buf, 0, MSG_LEN);
+	msg->operation = DB_END_DATA;
+
+	if ( send_msg(conn_sockfd, msg) < 0 || recv_msg(conn_sockfd, response) < 0 ) {
+		close(conn_sockfd);
 		return DB_CONN_FAILED;
+	}
 
-	return DB_OP_SUCCESS;
+	close(conn_sockfd);
+
+	if ( n_restored )
+		*n_restored = response->roll_number;
+
+	return response->status;
 
 }
 
@@ -249,6 +458,9 @@ void db_status_print(int status) {
 		case DB_CONN_FAILED:
 			printf("Failed to connect to the database server.\n");
 			break;
+		case DB_NOT_ENROLLED:
+			printf("The roll number is not on the class roster.\n");
+			break;
 		default:
 			printf("Unrecognized server response.\n");
 			break;
@@ -295,53 +507,105 @@ static int client_socket_new(const char *ip) {
 
 }
 
-static int recv_data(int sock_fd, char *recv_buf, int recv_len) {
+static int client_connect(char *server_ip, int server_port) {
 
-	while ( recv_len ) {
+	int conn_sockfd;
+	struct sockaddr_in server_addr;
 
-		int n_received;
+	if ( (conn_sockfd = client_socket_new("127.0.0.1")) < 0 )
+		return -1;
 
-		n_received = recv(sock_fd, recv_buf, recv_len, 0);
+	if ( ipport2addr(server_ip, server_port, &server_addr) < 0 ) {
+		close(conn_sockfd);
+		return -1;
+	}
 
-		if ( n_received < 0 ) {
-			perror("recv() failed");
-			return -1;
-		}
+	if ( connect(conn_sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ) {
+		perror("connect() failed");
+		close(conn_sockfd);
+		return -1;
+	}
 
-		recv_buf += n_received;
-		recv_len -= n_received;
+	return conn_sockfd;
 
-	}
+}
+
+static void conn_init(struct db_conn *conn, char *server_ip, int server_port) {
+
+	strncpy(conn->server_ip, server_ip, sizeof(conn->server_ip) - 1);
+	conn->server_ip[sizeof(conn->server_ip) - 1] = '\0';
+	conn->server_port = server_port;
+	conn->sock_fd = -1;
+	conn->n_connects = 0;
+
+	return;
+
+}
+
+static void conn_drop(struct db_conn *conn) {
+
+	if ( conn->sock_fd >= 0 )
+		close(conn->sock_fd);
+	conn->sock_fd = -1;
+
+	return;
+
+}
+
+/*
+ * An idle connection has nothing to read. If it does, the server
+ * closed it or it is out of step, and it cannot be used any more.
+ */
+static int conn_healthy(struct db_conn *conn) {
+
+	char byte;
+
+	if ( recv(conn->sock_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+		return 1;
 
 	return 0;
 
 }
 
-static int send_data(int sock_fd, char *send_buf, int send_len) {
+/*
+ * Send a request and receive the reply, connecting first if needed. A
+ * request failing on a connection that was already open is retried
+ * once on a new one, as the server may have restarted since.
+ */
+static int conn_request(struct db_conn *conn, struct db_message *msg, struct db_message *response) {
 
-	while ( send_len ) {
+	char send_buf[MSG_LEN];
+	int reused;
 
-		int n_sent;
+	while ( 1 ) {
 
-		n_sent = send(sock_fd, send_buf, send_len, 0);
+		if ( conn->sock_fd >= 0 && !conn_healthy(conn) )
+			conn_drop(conn);
 
-		if ( n_sent < 0 ) {
-			perror("send() failed");
-			return -1;
+		if ( !(reused = conn->sock_fd >= 0) ) {
+			if ( (conn->sock_fd = client_connect(conn->server_ip, conn->server_port)) < 0 )
+				return DB_CONN_FAILED;
+			conn->n_connects++;
 		}
 
-		send_buf += n_sent;
-		send_len -= n_sent;
+		// The message is converted in place when sent, send a copy to be able to retry
+		memcpy(send_buf, msg, MSG_LEN);
 
-	}
+		if ( send_msg(conn->sock_fd, (struct db_message*)send_buf) == 0 && recv_msg(conn->sock_fd, response) == 0 )
+			return response->status;
 
-	return 0;
+		conn_drop(conn);
+
+		if ( !reused )
+			return DB_CONN_FAILED;
+
+	}
 
 }
 
 static void htonmsg(struct db_message *msg) {
 
-	msg->operation = htonl(msg->operation);
+	/* The operation code is a single byte and needs no conversion */
 	msg->roll_number = htonl(msg->roll_number);
 
 	return;
@@ -350,7 +614,7 @@ static void htonmsg(struct db_message *msg) {
 
 static void ntohmsg(struct db_message *msg) {
 
-	msg->operation = ntohl(msg->operation);
+	/* The operation code is a single byte and needs no conversion */
 	msg->roll_number = ntohl(msg->roll_number);
 
 	return;
@@ -359,9 +623,8 @@ static void ntohmsg(struct db_message *msg) {
 
 static int recv_msg(int sock_fd, struct db_message *msg) {
 
-	int ret;
-
-	if ( recv_data(sock_fd, (char*)msg, MSG_LEN) < 0 )
+	// A server that closed the connection or stopped answering fails the request
+	if ( sockio_recv(sock_fd, msg, MSG_LEN, DB_IO_TIMEOUT * 1000) < 0 )
 		return -1;
 
 	ntohmsg(msg);
@@ -372,11 +635,9 @@ static int recv_msg(int sock_fd, struct db_message *msg) {
 
 static int send_msg(int sock_fd, struct db_message *msg) {
 
-	int ret;
-
 	htonmsg(msg);
 
-	if ( send_data(sock_fd, (char*)msg, MSG_LEN) < 0 )
+	if ( sockio_send(sock_fd, msg, MSG_LEN, DB_IO_TIMEOUT * 1000) < 0 )
 		return -1;
 
 	return 0;
@@ -0,0 +1,178 @@
+/*!
+
+	@file markpack.c
+
+	@brief Compact encoding of blocks of attendance marks.
+
+	Each mark is encoded as the difference of its roll number from
+	that of the previous mark, followed by the difference of its
+	time in microseconds from that of the previous mark. Both are
+	zigzag encoded so that small negative differences stay small,
+	and written as varints of 7 bits per byte, least significant
+	first. The first mark of a block is taken relative to zero.
+
+	Marks close in time, or consecutive on a roster, take 4 to 6
+	bytes each instead of the 20 of struct as_msg_data.
+
+*/
+
+
+
+#ifndef MARKPACK_C
+#define MARKPACK_C
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "markpack.h"
+
+
+
+static unsigned long long zigzag(long long value) {
+
+	return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+
+}
+
+static long long unzigzag(unsigned long long value) {
+
+	return (long long)(value >> 1) ^ -(long long)(value & 1);
+
+}
+
+static int put_varint(unsigned char *buf, unsigned long long value) {
+
+	int len = 0;
+
+	while ( value >= 0x80 ) {
+		buf[len++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (unsigned char)value;
+
+	return len;
+
+}
+
+static int get_varint(const unsigned char *buf, int len, unsigned long long *value) {
+
+	int i, shift = 0;
+
+	*value = 0;
+
+	for ( i = 0; i < len && shift < 64; i++, shift += 7 ) {
+		*value |= (unsigned long long)(buf[i] & 0x7F) << shift;
+		if ( !(buf[i] & 0x80) )
+			return i + 1;
+	}
+
+	/* Truncated or overlong */
+	return -1;
+
+}
+
+/*!
+
+	@brief Encode a block of marks.
+
+	@param marks Marks to encode.
+	@param n_marks Number of marks.
+	@param buf Output buffer of at least MARKPACK_MAX_LEN(n_marks) bytes.
+	@return Length of the encoding.
+
+*/
+int markpack_encode(const struct markpack_mark *marks, int n_marks, unsigned char *buf) {
+
+	long long prev_time = 0;
+	int i, len = 0, prev_roll = 0;
+
+	for ( i = 0; i < n_marks; i++ ) {
+
+		long long time = marks[i].tv_sec * 1000000 + marks[i].tv_usec;
+
+		len += put_varint(buf + len, zigzag((long long)marks[i].roll_number - prev_roll));
+		len += put_varint(buf + len, zigzag(time - prev_time));
+
+		prev_roll = marks[i].roll_number;
+		prev_time = time;
+
+	}
+
+	return len;
+
+}
+
+/*!
+
+	@brief Decode a block of marks.
+
+	@param buf Encoded block.
+	@param len Length of the encoded block.
+	@param marks Output array of n_marks marks.
+	@param n_marks Number of marks in the block.
+	@return 0 on success, or -1 if the block does not hold exactly
+	n_marks marks.
+
+*/
+int markpack_decode(const unsigned char *buf, int len, struct markpack_mark *marks, int n_marks) {
+
+	long long prev_time = 0;
+	int i, n, offset = 0, prev_roll = 0;
+
+	for ( i = 0; i < n_marks; i++ ) {
+
+		unsigned long long value;
+		long long time;
+
+		if ( (n = get_varint(buf + offset, len - offset, &value)) < 0 )
+			return -1;
+		offset += n;
+		prev_roll = (int)(prev_roll + unzigzag(value));
+
+		if ( (n = get_varint(buf + offset, len - offset, &value)) < 0 )
+			return -1;
+		offset += n;
+		time = prev_time + unzigzag(value);
+		prev_time = time;
+
+		marks[i].roll_number = prev_roll;
+		marks[i].tv_sec = time / 1000000;
+		marks[i].tv_usec = time % 1000000;
+
+	}
+
+	return offset == len ? 0 : -1;
+
+}
+
+/*!
+
+	@brief CRC-32 of an encoded block.
+
+	Computed bit by bit, blocks are only a few kilobytes long.
+
+*/
+unsigned markpack_crc32(const unsigned char *buf, int len) {
+
+	unsigned crc = 0xFFFFFFFF;
+	int i, j;
+
+	for ( i = 0; i < len; i++ ) {
+		crc ^= buf[i];
+		for ( j = 0; j < 8; j++ )
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+
+	return ~crc;
+
+}
+
+
+
+#endif /* MARKPACK_C */
+
+
+
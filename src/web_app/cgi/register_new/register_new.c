@@ -35,6 +35,7 @@ int is_admin_mac(char *mac);
  *    - Check if MAC address is already registered
  *
  *    - Check if roll number is already registered
+ *    and enrolled
  *
  *    - Add new data to database
  *
@@ -131,6 +132,13 @@ int main(void) {
 		printf(ETAG_END);
 		db_msg_data_destroy(data);
 		return -1;
+	} else if ( status == DB_NOT_ENROLLED ) {
+		printf(ETAG_START);
+		printf("Request denied: %d is not "
+			"enrolled in this class", roll_number);
+		printf(ETAG_END);
+		db_msg_data_destroy(data);
+		return -1;
 	} else if ( status != DB_NOT_FOUND ) {
 		printf(ETAG_START);
 		printf("Database error: ");
@@ -154,6 +162,13 @@ int main(void) {
 		return -1;
 	}
 
+	/*
+	 * The attendance server caches registered devices, have it fetch
+	 * them again. If this fails it still does when the device is first
+	 * used, after AS_IDENTITY_RETRY seconds at most.
+	 */
+	as_invalidate_identities(LOCALHOST_IP, AS_SERVER_IP, AS_SERVER_PORT);
+
 	/* Mark attendance */
 	status = as_mark_attendance(LOCALHOST_IP,
 		AS_SERVER_IP, AS_SERVER_PORT, roll_number);